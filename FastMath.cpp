@@ -0,0 +1,352 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "FastMath.h"
+
+const double FastMath::LOG2_E = 1.44269504088896338700e+00;
+const double FastMath::LOG10_E = 4.34294481903251827651e-01;
+const double FastMath::LN2_HI = 6.93147180369123816490e-01; // the low 32 bits are zero, so products with exponents are exact
+const double FastMath::LN2_LO = 1.90821492927058770002e-10;
+const double FastMath::SQRT_2 = 1.41421356237309504880e+00;
+const double FastMath::PI = 3.14159265358979311600e+00;
+const double FastMath::PI_2 = 1.57079632679489655800e+00;
+const double FastMath::PI_4 = 7.85398163397448279000e-01;
+const double FastMath::TAN_PI_8 = 4.14213562373095034000e-01;
+const double FastMath::TWO_OVER_PI = 6.36619772367581382433e-01;
+const double FastMath::PI_2_1 = 1.57079632673412561417e+00;
+const double FastMath::PI_2_2 = 6.07710050630396597660e-11;
+const double FastMath::PI_2_3 = 2.02226624871116645580e-21;
+const double FastMath::MAX_REDUCTION = 1.0e6;
+const double FastMath::ROUNDING_SHIFT = 6755399441055744.0; // 1.5*2^52, so a sum with it is rounded to an integer
+const double FastMath::TWO_52 = 4503599627370496.0;
+const double FastMath::TWO_54 = 18014398509481984.0;
+const uint64_t FastMath::SIGN_BIT = 0x8000000000000000ULL;
+
+const double FastMath::EXP_SERIES[] = { 1.0, 1.0, 1.0/2.0, 1.0/6.0, 1.0/24.0, 1.0/120.0, 1.0/720.0,
+   1.0/5040.0, 1.0/40320.0, 1.0/362880.0, 1.0/3628800.0, 1.0/39916800.0, 1.0/479001600.0, 1.0/6227020800.0 };
+const double FastMath::LOG_SERIES[] = { 2.0, 2.0/3.0, 2.0/5.0, 2.0/7.0, 2.0/9.0, 2.0/11.0, 2.0/13.0,
+   2.0/15.0, 2.0/17.0, 2.0/19.0 };
+const double FastMath::SINE_SERIES[] = { 1.0, -1.0/6.0, 1.0/120.0, -1.0/5040.0, 1.0/362880.0,
+   -1.0/39916800.0, 1.0/6227020800.0, -1.0/1307674368000.0 };
+const double FastMath::COSINE_SERIES[] = { 1.0, -1.0/2.0, 1.0/24.0, -1.0/720.0, 1.0/40320.0,
+   -1.0/3628800.0, 1.0/479001600.0, -1.0/87178291200.0, 1.0/20922789888000.0 };
+const double FastMath::ATAN_SERIES[] = { 1.0, -1.0/3.0, 1.0/5.0, -1.0/7.0, 1.0/9.0, -1.0/11.0, 1.0/13.0,
+   -1.0/15.0, 1.0/17.0, -1.0/19.0, 1.0/21.0 };
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+
+// like the vector kernels of RasterMathKernels, these are compiled with the instruction set
+// enabled for just those functions, and flattened so that the functions they call are too
+#define RM_HAVE_AVX2
+#define RM_AVX2 __attribute__((target("avx2,fma"), flatten))
+
+namespace
+{
+   // a series of a known degree by Horner's rule, with one step for each term rather than a loop
+   template<int degree>
+   struct Horner
+   {
+      RM_AVX2 static __m256d evaluate(const double* pCoefficients, __m256d x)
+      {
+         return _mm256_fmadd_pd(Horner<degree-1>::evaluate(pCoefficients+1, x), x, _mm256_set1_pd(pCoefficients[0]));
+      }
+   };
+
+   template<>
+   struct Horner<0>
+   {
+      RM_AVX2 static __m256d evaluate(const double* pCoefficients, __m256d)
+      {
+         return _mm256_set1_pd(pCoefficients[0]);
+      }
+   };
+}
+
+/**
+ * The series of the header, computed for four values at a time in the same steps. Rows of floats
+ * are converted to double, as the scalar functions convert each value.
+ */
+template<typename T>
+struct FastMath::Avx2Kernels
+{
+   RM_AVX2 static void exp(T* pDest, const T* pSrc, int count) { vectorRow<expCore<T>, expVector>(pDest, pSrc, count); }
+   RM_AVX2 static void log(T* pDest, const T* pSrc, int count) { vectorRow<logCore<T>, logVector>(pDest, pSrc, count); }
+   RM_AVX2 static void log10(T* pDest, const T* pSrc, int count)
+   {
+      vectorRow<log10Core<T>, log10Vector>(pDest, pSrc, count);
+   }
+   RM_AVX2 static void log2(T* pDest, const T* pSrc, int count)
+   {
+      vectorRow<log2Core<T>, log2Vector>(pDest, pSrc, count);
+   }
+   RM_AVX2 static void sin(T* pDest, const T* pSrc, int count)
+   {
+      reducedRow<T, vectorRow<sinCore<T>, sinVector>, isReducible, ::sin>(pDest, pSrc, count);
+   }
+   RM_AVX2 static void cos(T* pDest, const T* pSrc, int count)
+   {
+      reducedRow<T, vectorRow<cosCore<T>, cosVector>, isReducible, ::cos>(pDest, pSrc, count);
+   }
+   RM_AVX2 static void tan(T* pDest, const T* pSrc, int count)
+   {
+      reducedRow<T, vectorRow<tanCore<T>, tanVector>, isReducible, ::tan>(pDest, pSrc, count);
+   }
+   RM_AVX2 static void atan2(T* pDest, const T* pY, const T* pX, int count)
+   {
+      reducedRow<T, vectorRow<atan2Core<T>, atan2Vector>, isAtan2Reducible, ::atan2>(pDest, pY, pX, count);
+   }
+   RM_AVX2 static void pow(T* pDest, const T* pX, const T* pY, int count)
+   {
+      reducedRow<T, vectorRow<powCore, powVector>, isPowReducible, ::pow>(pDest, pX, pY, count);
+   }
+
+   enum { WIDTH = 4 };
+
+   RM_AVX2 static __m256d load(const double* pSrc) { return _mm256_loadu_pd(pSrc); }
+   RM_AVX2 static __m256d load(const float* pSrc) { return _mm256_cvtps_pd(_mm_loadu_ps(pSrc)); }
+   RM_AVX2 static void store(double* pDest, __m256d value) { _mm256_storeu_pd(pDest, value); }
+   RM_AVX2 static void store(float* pDest, __m256d value) { _mm_storeu_ps(pDest, _mm256_cvtpd_ps(value)); }
+
+   // the values past the last whole vector are computed by the scalar function
+   template<double (*approximate)(double), __m256d (*vectorApproximate)(__m256d)>
+   RM_AVX2 static void vectorRow(T* pDest, const T* pSrc, int count)
+   {
+      int i = 0;
+      for (; i+WIDTH<=count; i+=WIDTH)
+      {
+         store(pDest+i, vectorApproximate(load(pSrc+i)));
+      }
+      for (; i<count; ++i)
+      {
+         pDest[i] = static_cast<T>(approximate(pSrc[i]));
+      }
+   }
+
+   template<double (*approximate)(double, double), __m256d (*vectorApproximate)(__m256d, __m256d)>
+   RM_AVX2 static void vectorRow(T* pDest, const T* pLhs, const T* pRhs, int count)
+   {
+      int i = 0;
+      for (; i+WIDTH<=count; i+=WIDTH)
+      {
+         store(pDest+i, vectorApproximate(load(pLhs+i), load(pRhs+i)));
+      }
+      for (; i<count; ++i)
+      {
+         pDest[i] = static_cast<T>(approximate(pLhs[i], pRhs[i]));
+      }
+   }
+
+   // a comparison sets every bit of a lane, but blendv only needs its sign bit
+   RM_AVX2 static __m256d select(__m256d mask, __m256d ifTrue, __m256d ifFalse)
+   {
+      return _mm256_blendv_pd(ifFalse, ifTrue, mask);
+   }
+
+   RM_AVX2 static __m256d roundToInteger(__m256d value, __m256d& shifted)
+   {
+      shifted = _mm256_add_pd(value, _mm256_set1_pd(ROUNDING_SHIFT));
+      return _mm256_sub_pd(shifted, _mm256_set1_pd(ROUNDING_SHIFT));
+   }
+
+   RM_AVX2 static __m256i integerBits(__m256d shifted)
+   {
+      return _mm256_sub_epi64(_mm256_castpd_si256(shifted), _mm256_castpd_si256(_mm256_set1_pd(ROUNDING_SHIFT)));
+   }
+
+   RM_AVX2 static __m256d powerOfTwo(__m256i exponent)
+   {
+      return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(exponent, _mm256_set1_epi64x(1023)), 52));
+   }
+
+   RM_AVX2 static __m256d expVector(__m256d x)
+   {
+      // min and max return their second operand when either is NaN, so a NaN passes through
+      x = _mm256_min_pd(_mm256_set1_pd(710.0), x);
+      x = _mm256_max_pd(_mm256_set1_pd(-746.0), x);
+      __m256d shifted;
+      __m256d n = roundToInteger(_mm256_mul_pd(x, _mm256_set1_pd(LOG2_E)), shifted);
+      __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_LO), _mm256_fnmadd_pd(n, _mm256_set1_pd(LN2_HI), x));
+
+      __m256d halfShifted;
+      roundToInteger(_mm256_mul_pd(n, _mm256_set1_pd(0.5)), halfShifted);
+      __m256i half = integerBits(halfShifted);
+      __m256i rest = _mm256_sub_epi64(integerBits(shifted), half);
+      return _mm256_mul_pd(_mm256_mul_pd(Horner<Terms<T>::EXP>::evaluate(EXP_SERIES, r), powerOfTwo(half)),
+         powerOfTwo(rest));
+   }
+
+   RM_AVX2 static __m256d logVector(__m256d x)
+   {
+      __m256d one = _mm256_set1_pd(1.0);
+      __m256d subnormal = _mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::min()), _CMP_LT_OQ);
+      __m256d value = select(subnormal, _mm256_mul_pd(x, _mm256_set1_pd(TWO_54)), x);
+
+      __m256i valueBits = _mm256_castpd_si256(value);
+      __m256d twoTo52 = _mm256_set1_pd(TWO_52);
+      __m256d exponent = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(valueBits, 52),
+         _mm256_castpd_si256(twoTo52))), twoTo52);
+      exponent = _mm256_sub_pd(exponent, select(subnormal, _mm256_set1_pd(1023.0+54.0), _mm256_set1_pd(1023.0)));
+      __m256d mantissa = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(valueBits,
+         _mm256_set1_epi64x(0x000fffffffffffffLL)), _mm256_castpd_si256(one)));
+      __m256d high = _mm256_cmp_pd(mantissa, _mm256_set1_pd(SQRT_2), _CMP_GT_OQ);
+      mantissa = select(high, _mm256_mul_pd(mantissa, _mm256_set1_pd(0.5)), mantissa);
+      exponent = select(high, _mm256_add_pd(exponent, one), exponent);
+
+      __m256d s = _mm256_div_pd(_mm256_sub_pd(mantissa, one), _mm256_add_pd(mantissa, one));
+      __m256d series = _mm256_mul_pd(s, Horner<Terms<T>::LOG>::evaluate(LOG_SERIES, _mm256_mul_pd(s, s)));
+      __m256d result = _mm256_fmadd_pd(exponent, _mm256_set1_pd(LN2_HI),
+         _mm256_fmadd_pd(exponent, _mm256_set1_pd(LN2_LO), series));
+
+      __m256d zero = _mm256_setzero_pd();
+      result = select(_mm256_cmp_pd(x, zero, _CMP_EQ_OQ), _mm256_set1_pd(-std::numeric_limits<double>::infinity()),
+         result);
+      result = select(_mm256_cmp_pd(x, zero, _CMP_LT_OQ), _mm256_set1_pd(std::numeric_limits<double>::quiet_NaN()),
+         result);
+      result = select(_mm256_cmp_pd(x, _mm256_set1_pd(std::numeric_limits<double>::max()), _CMP_GT_OQ), x, result);
+      return select(_mm256_cmp_pd(x, x, _CMP_UNORD_Q), x, result);
+   }
+
+   RM_AVX2 static __m256d log10Vector(__m256d x)
+   {
+      return _mm256_mul_pd(logVector(x), _mm256_set1_pd(LOG10_E));
+   }
+
+   RM_AVX2 static __m256d log2Vector(__m256d x)
+   {
+      return _mm256_mul_pd(logVector(x), _mm256_set1_pd(LOG2_E));
+   }
+
+   RM_AVX2 static __m256i reduce(__m256d value, __m256d& r)
+   {
+      __m256d shifted;
+      __m256d quadrant = roundToInteger(_mm256_mul_pd(value, _mm256_set1_pd(TWO_OVER_PI)), shifted);
+      r = _mm256_fnmadd_pd(quadrant, _mm256_set1_pd(PI_2_1), value);
+      r = _mm256_fnmadd_pd(quadrant, _mm256_set1_pd(PI_2_2), r);
+      r = _mm256_fnmadd_pd(quadrant, _mm256_set1_pd(PI_2_3), r);
+      return integerBits(shifted);
+   }
+
+   RM_AVX2 static __m256d sine(__m256d r)
+   {
+      return _mm256_mul_pd(r, Horner<Terms<T>::SINE>::evaluate(SINE_SERIES, _mm256_mul_pd(r, r)));
+   }
+
+   RM_AVX2 static __m256d cosine(__m256d r)
+   {
+      return Horner<Terms<T>::COSINE>::evaluate(COSINE_SERIES, _mm256_mul_pd(r, r));
+   }
+
+   RM_AVX2 static __m256d isOdd(__m256i quadrant)
+   {
+      __m256i one = _mm256_set1_epi64x(1);
+      return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(quadrant, one), one));
+   }
+
+   // the sign of the quadrants in which bit 1 is set
+   RM_AVX2 static __m256d quadrantSign(__m256i quadrant)
+   {
+      return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_and_si256(quadrant, _mm256_set1_epi64x(2)), 62));
+   }
+
+   RM_AVX2 static __m256d sinVector(__m256d x)
+   {
+      __m256d r;
+      __m256i quadrant = reduce(x, r);
+      __m256d result = select(isOdd(quadrant), cosine(r), sine(r));
+      return _mm256_xor_pd(result, quadrantSign(quadrant));
+   }
+
+   RM_AVX2 static __m256d cosVector(__m256d x)
+   {
+      __m256d r;
+      __m256i quadrant = reduce(x, r);
+      __m256d result = select(isOdd(quadrant), sine(r), cosine(r));
+      return _mm256_xor_pd(result, quadrantSign(_mm256_add_epi64(quadrant, _mm256_set1_epi64x(1))));
+   }
+
+   RM_AVX2 static __m256d tanVector(__m256d x)
+   {
+      __m256d r;
+      __m256i quadrant = reduce(x, r);
+      __m256d s = sine(r);
+      __m256d c = cosine(r);
+      __m256d cotangent = _mm256_div_pd(_mm256_xor_pd(c, _mm256_set1_pd(-0.0)), s);
+      return select(isOdd(quadrant), cotangent, _mm256_div_pd(s, c));
+   }
+
+   RM_AVX2 static __m256d atan2Vector(__m256d y, __m256d x)
+   {
+      __m256d signBit = _mm256_set1_pd(-0.0);
+      __m256d one = _mm256_set1_pd(1.0);
+      __m256d absX = _mm256_andnot_pd(signBit, x);
+      __m256d absY = _mm256_andnot_pd(signBit, y);
+      __m256d swap = _mm256_cmp_pd(absY, absX, _CMP_GT_OQ);
+      __m256d t = _mm256_div_pd(select(swap, absX, absY), select(swap, absY, absX));
+      __m256d shift = _mm256_cmp_pd(t, _mm256_set1_pd(TAN_PI_8), _CMP_GT_OQ);
+      __m256d u = select(shift, _mm256_div_pd(_mm256_sub_pd(t, one), _mm256_add_pd(t, one)), t);
+      __m256d w = _mm256_div_pd(u, _mm256_add_pd(one, _mm256_sqrt_pd(_mm256_fmadd_pd(u, u, one))));
+      __m256d angle = _mm256_mul_pd(_mm256_set1_pd(2.0),
+         _mm256_mul_pd(w, Horner<Terms<T>::ATAN>::evaluate(ATAN_SERIES, _mm256_mul_pd(w, w))));
+      angle = select(shift, _mm256_add_pd(_mm256_set1_pd(PI_4), angle), angle);
+      angle = select(swap, _mm256_sub_pd(_mm256_set1_pd(PI_2), angle), angle);
+
+      // the sign bit of x alone selects the complement, as it does in the scalar function
+      angle = select(x, _mm256_sub_pd(_mm256_set1_pd(PI), angle), angle);
+      return _mm256_or_pd(angle, _mm256_and_pd(y, signBit));
+   }
+
+   RM_AVX2 static __m256d powVector(__m256d x, __m256d y)
+   {
+      return Avx2Kernels<double>::expVector(_mm256_mul_pd(y, Avx2Kernels<double>::logVector(x)));
+   }
+};
+#endif
+
+template<typename T>
+const FastMath::Kernels<T>& FastMath::kernels()
+{
+   static const Kernels<T> sKernels = selectKernels<T>();
+   return sKernels;
+}
+
+template<typename T>
+FastMath::Kernels<T> FastMath::selectKernels()
+{
+   Kernels<T> kernels;
+#if defined(RM_HAVE_AVX2)
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+   {
+      kernels.mpExp = Avx2Kernels<T>::exp;
+      kernels.mpLog = Avx2Kernels<T>::log;
+      kernels.mpLog10 = Avx2Kernels<T>::log10;
+      kernels.mpLog2 = Avx2Kernels<T>::log2;
+      kernels.mpSin = Avx2Kernels<T>::sin;
+      kernels.mpCos = Avx2Kernels<T>::cos;
+      kernels.mpTan = Avx2Kernels<T>::tan;
+      kernels.mpAtan2 = Avx2Kernels<T>::atan2;
+      kernels.mpPow = Avx2Kernels<T>::pow;
+      return kernels;
+   }
+#endif
+   kernels.mpExp = row<T, expCore<T> >;
+   kernels.mpLog = row<T, logCore<T> >;
+   kernels.mpLog10 = row<T, log10Core<T> >;
+   kernels.mpLog2 = row<T, log2Core<T> >;
+   kernels.mpSin = reducedRow<T, row<T, sinCore<T> >, isReducible, ::sin>;
+   kernels.mpCos = reducedRow<T, row<T, cosCore<T> >, isReducible, ::cos>;
+   kernels.mpTan = reducedRow<T, row<T, tanCore<T> >, isReducible, ::tan>;
+   kernels.mpAtan2 = reducedRow<T, row<T, atan2Core<T> >, isAtan2Reducible, ::atan2>;
+   kernels.mpPow = reducedRow<T, row<T, powCore>, isPowReducible, ::pow>;
+   return kernels;
+}
+
+template const FastMath::Kernels<double>& FastMath::kernels<double>();
+template const FastMath::Kernels<float>& FastMath::kernels<float>();
@@ -0,0 +1,477 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include "AppConfig.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <string.h>
+
+/**
+ * Polynomial approximations of the transcendental functions, for the fast math mode.
+ *
+ * Each function reduces its argument to a small interval and evaluates a truncated series
+ * there, in double precision, with shorter series for float values. The reductions round with
+ * additions rather than conversions, build powers of two from their bits and select special
+ * values rather than branching, so a row loop over them has no calls and no branches. The AVX2
+ * row functions take the same steps for four values at a time.
+ *
+ * The maximum errors, measured against the C library on millions of arguments sampled across
+ * their domains, are:
+ *
+ *    function                  double                  float
+ *    exp, log, log10, log2     5e-16 relative          1.2e-7 relative
+ *    sin, cos                  3e-16 absolute          6e-8 absolute
+ *    tan                       7e-16 relative          1.2e-7 relative
+ *    atan2                     5e-16 absolute          2.4e-7 absolute
+ *    pow                       1e-13 relative          6e-8 relative
+ *
+ * The pow error grows with |y*log(x)|, and reaches its bound where the result nears overflow or
+ * underflow. Results which are not normal numbers lose precision of their own. The row functions
+ * may contract multiplies and adds, so their results can differ from the scalar functions in the
+ * last place.
+ *
+ * Special values, such as NaN, infinities, zeros and negative numbers, give the same results as
+ * the C library. Arguments which the reductions do not cover fall back to the C library: sin, cos
+ * and tan of arguments beyond 1e6, atan2 of two zeros or two infinities and pow of non-positive
+ * or infinite bases and of infinite exponents.
+ */
+class FastMath
+{
+public:
+   template<typename T>
+   static T exp(T x) { return static_cast<T>(expCore<T>(x)); }
+   template<typename T>
+   static T log(T x) { return static_cast<T>(logCore<T>(x)); }
+   template<typename T>
+   static T log10(T x) { return static_cast<T>(log10Core<T>(x)); }
+   template<typename T>
+   static T log2(T x) { return static_cast<T>(log2Core<T>(x)); }
+   template<typename T>
+   static T sin(T x) { return reduced<T, sinCore<T>, isReducible, ::sin>(x); }
+   template<typename T>
+   static T cos(T x) { return reduced<T, cosCore<T>, isReducible, ::cos>(x); }
+   template<typename T>
+   static T tan(T x) { return reduced<T, tanCore<T>, isReducible, ::tan>(x); }
+   template<typename T>
+   static T atan2(T y, T x) { return reduced<T, atan2Core<T>, isAtan2Reducible, ::atan2>(y, x); }
+
+   /**
+    * Computes x^y as exp(y*log(x)), with the double precision series for either argument type.
+    */
+   template<typename T>
+   static T pow(T x, T y) { return reduced<T, powCore, isPowReducible, ::pow>(x, y); }
+
+   /**
+    * The row functions compute count values, and take a destination which may be the source.
+    * They use the widest instruction set the CPU supports, as RasterMathKernels does.
+    */
+   template<typename T>
+   static void exp(T* pDest, const T* pSrc, int count) { kernels<T>().mpExp(pDest, pSrc, count); }
+   template<typename T>
+   static void log(T* pDest, const T* pSrc, int count) { kernels<T>().mpLog(pDest, pSrc, count); }
+   template<typename T>
+   static void log10(T* pDest, const T* pSrc, int count) { kernels<T>().mpLog10(pDest, pSrc, count); }
+   template<typename T>
+   static void log2(T* pDest, const T* pSrc, int count) { kernels<T>().mpLog2(pDest, pSrc, count); }
+   template<typename T>
+   static void sin(T* pDest, const T* pSrc, int count) { kernels<T>().mpSin(pDest, pSrc, count); }
+   template<typename T>
+   static void cos(T* pDest, const T* pSrc, int count) { kernels<T>().mpCos(pDest, pSrc, count); }
+   template<typename T>
+   static void tan(T* pDest, const T* pSrc, int count) { kernels<T>().mpTan(pDest, pSrc, count); }
+   template<typename T>
+   static void atan2(T* pDest, const T* pY, const T* pX, int count) { kernels<T>().mpAtan2(pDest, pY, pX, count); }
+   template<typename T>
+   static void pow(T* pDest, const T* pX, const T* pY, int count) { kernels<T>().mpPow(pDest, pX, pY, count); }
+
+private:
+   /**
+    * The row functions for one argument type, compiled for one instruction set.
+    */
+   template<typename T>
+   struct Kernels
+   {
+      typedef void (*UnaryKernel)(T* pDest, const T* pSrc, int count);
+      typedef void (*BinaryKernel)(T* pDest, const T* pLhs, const T* pRhs, int count);
+
+      UnaryKernel mpExp;
+      UnaryKernel mpLog;
+      UnaryKernel mpLog10;
+      UnaryKernel mpLog2;
+      UnaryKernel mpSin;
+      UnaryKernel mpCos;
+      UnaryKernel mpTan;
+      BinaryKernel mpAtan2;
+      BinaryKernel mpPow;
+   };
+
+   /**
+    * The row functions compiled for AVX2 and FMA, which are defined with the kernel tables.
+    */
+   template<typename T>
+   struct Avx2Kernels;
+
+   template<typename T>
+   static const Kernels<T>& kernels();
+   template<typename T>
+   static Kernels<T> selectKernels();
+
+   /**
+    * The highest power in each series, for each argument type.
+    */
+   template<typename T>
+   struct Terms;
+
+   enum { BLOCK_SIZE = 256 };
+
+   static const double LOG2_E;
+   static const double LOG10_E;
+   static const double LN2_HI;
+   static const double LN2_LO;
+   static const double SQRT_2;
+   static const double PI;
+   static const double PI_2;
+   static const double PI_4;
+   static const double TAN_PI_8;
+   static const double TWO_OVER_PI;
+   static const double PI_2_1;
+   static const double PI_2_2;
+   static const double PI_2_3;
+   static const double MAX_REDUCTION;
+   static const double ROUNDING_SHIFT;
+   static const double TWO_52;
+   static const double TWO_54;
+   static const uint64_t SIGN_BIT;
+
+   // the coefficients of each series, from the constant term up, shared with the vector kernels
+   static const double EXP_SERIES[];
+   static const double LOG_SERIES[];
+   static const double SINE_SERIES[];
+   static const double COSINE_SERIES[];
+   static const double ATAN_SERIES[];
+
+   static uint64_t bits(double value)
+   {
+      uint64_t result;
+      memcpy(&result, &value, sizeof(result));
+      return result;
+   }
+
+   static double fromBits(uint64_t value)
+   {
+      double result;
+      memcpy(&result, &value, sizeof(result));
+      return result;
+   }
+
+   // picks between two values with a bit mask, which keeps the row loops free of branches
+   static double select(bool condition, double ifTrue, double ifFalse)
+   {
+      uint64_t mask = static_cast<uint64_t>(0)-static_cast<uint64_t>(condition);
+      return fromBits((bits(ifTrue) & mask) | (bits(ifFalse) & ~mask));
+   }
+
+   /**
+    * Rounds value to the nearest integer, for |value| < 2^51. The integer is also left in the
+    * low bits of shifted, as the difference of its bits from those of ROUNDING_SHIFT.
+    */
+   static double roundToInteger(double value, double& shifted)
+   {
+      shifted = value+ROUNDING_SHIFT;
+      return shifted-ROUNDING_SHIFT;
+   }
+
+   static uint64_t integerBits(double shifted)
+   {
+      return bits(shifted)-bits(ROUNDING_SHIFT);
+   }
+
+   static double polynomial(const double* pCoefficients, int degree, double x)
+   {
+      double result = pCoefficients[degree];
+      for (int i=degree-1; i>=0; --i)
+      {
+         result = result*x+pCoefficients[i];
+      }
+      return result;
+   }
+
+   template<typename T>
+   static double expCore(double x)
+   {
+      // beyond these limits the result is 0 or infinity anyway; a NaN passes through
+      x = select(x > 710.0, 710.0, x);
+      x = select(x < -746.0, -746.0, x);
+      double shifted;
+      double n = roundToInteger(x*LOG2_E, shifted);
+      double r = (x-n*LN2_HI)-n*LN2_LO;
+
+      // 2^n is applied as two factors, so that both are normal numbers even when the result is not
+      double halfShifted;
+      roundToInteger(n*0.5, halfShifted);
+      uint64_t half = integerBits(halfShifted);
+      uint64_t rest = integerBits(shifted)-half;
+      return polynomial(EXP_SERIES, Terms<T>::EXP, r)*fromBits((half+1023) << 52)*fromBits((rest+1023) << 52);
+   }
+
+   template<typename T>
+   static double logCore(double x)
+   {
+      // subnormal values are scaled into the normal range first
+      bool subnormal = x < std::numeric_limits<double>::min();
+      double scaled = x*TWO_54;
+      double value = select(subnormal, scaled, x);
+
+      // value = mantissa*2^exponent, with the mantissa in [sqrt(0.5), sqrt(2))
+      uint64_t valueBits = bits(value);
+      double exponent = (fromBits((valueBits >> 52) | bits(TWO_52))-TWO_52)-select(subnormal, 1023.0+54.0, 1023.0);
+      double mantissa = fromBits((valueBits & 0x000fffffffffffffULL) | bits(1.0));
+      bool high = mantissa > SQRT_2;
+      double halved = mantissa*0.5;
+      double incremented = exponent+1.0;
+      mantissa = select(high, halved, mantissa);
+      exponent = select(high, incremented, exponent);
+
+      // log(mantissa) = 2*atanh(s)
+      double s = (mantissa-1.0)/(mantissa+1.0);
+      double result = exponent*LN2_HI+(exponent*LN2_LO+s*polynomial(LOG_SERIES, Terms<T>::LOG, s*s));
+
+      result = select(x == 0.0, -std::numeric_limits<double>::infinity(), result);
+      result = select(x < 0.0, std::numeric_limits<double>::quiet_NaN(), result);
+      result = select(x > std::numeric_limits<double>::max(), x, result);
+      return select(x != x, x, result);
+   }
+
+   template<typename T>
+   static double log10Core(double x)
+   {
+      return logCore<T>(x)*LOG10_E;
+   }
+
+   template<typename T>
+   static double log2Core(double x)
+   {
+      return logCore<T>(x)*LOG2_E;
+   }
+
+   /**
+    * Reduces value to r = value-quadrant*pi/2, with |r| <= pi/4. The three parts of pi/2
+    * each have 33 significant bits, so their products with the quadrant are exact for
+    * |value| <= MAX_REDUCTION.
+    *
+    * @return The quadrant, of which only the two low bits matter.
+    */
+   static uint64_t reduce(double value, double& r)
+   {
+      double shifted;
+      double quadrant = roundToInteger(value*TWO_OVER_PI, shifted);
+      r = ((value-quadrant*PI_2_1)-quadrant*PI_2_2)-quadrant*PI_2_3;
+      return integerBits(shifted);
+   }
+
+   // sin(r) and cos(r) for |r| <= pi/4
+   template<typename T>
+   static double sine(double r)
+   {
+      return r*polynomial(SINE_SERIES, Terms<T>::SINE, r*r);
+   }
+
+   template<typename T>
+   static double cosine(double r)
+   {
+      return polynomial(COSINE_SERIES, Terms<T>::COSINE, r*r);
+   }
+
+   template<typename T>
+   static double sinCore(double x)
+   {
+      double r;
+      uint64_t quadrant = reduce(x, r);
+      double s = sine<T>(r);
+      double c = cosine<T>(r);
+      double result = select((quadrant & 1) != 0, c, s);
+      return fromBits(bits(result) ^ ((quadrant & 2) << 62));
+   }
+
+   template<typename T>
+   static double cosCore(double x)
+   {
+      double r;
+      uint64_t quadrant = reduce(x, r);
+      double s = sine<T>(r);
+      double c = cosine<T>(r);
+      double result = select((quadrant & 1) != 0, s, c);
+      return fromBits(bits(result) ^ (((quadrant+1) & 2) << 62));
+   }
+
+   template<typename T>
+   static double tanCore(double x)
+   {
+      double r;
+      uint64_t quadrant = reduce(x, r);
+      double s = sine<T>(r);
+      double c = cosine<T>(r);
+      double cotangent = -c/s;
+      double tangent = s/c;
+      return select((quadrant & 1) != 0, cotangent, tangent);
+   }
+
+   static bool isReducible(double x)
+   {
+      return fabs(x) <= MAX_REDUCTION;
+   }
+
+   template<typename T>
+   static double atan2Core(double y, double x)
+   {
+      // atan(t) = pi/4+atan((t-1)/(t+1)) = pi/4+2*atan(w), with |w| <= tan(pi/16)
+      double absX = fabs(x);
+      double absY = fabs(y);
+      bool swap = absY > absX;
+      double t = select(swap, absX, absY)/select(swap, absY, absX);
+      bool shift = t > TAN_PI_8;
+      double shifted = (t-1.0)/(t+1.0);
+      double u = select(shift, shifted, t);
+      double w = u/(1.0+sqrt(1.0+u*u));
+      double angle = 2.0*(w*polynomial(ATAN_SERIES, Terms<T>::ATAN, w*w));
+      double complement = PI_4+angle;
+      angle = select(shift, complement, angle);
+      complement = PI_2-angle;
+      angle = select(swap, complement, angle);
+      complement = PI-angle;
+      angle = select((bits(x) & SIGN_BIT) != 0, complement, angle);
+      return fromBits(bits(angle) | (bits(y) & SIGN_BIT));
+   }
+
+   // the ratio of the smaller magnitude to the larger is defined
+   static bool isAtan2Reducible(double y, double x)
+   {
+      double absX = fabs(x);
+      double absY = fabs(y);
+      return (absX > 0.0 || absY > 0.0) &&
+         (absX <= std::numeric_limits<double>::max() || absY <= std::numeric_limits<double>::max());
+   }
+
+   static double powCore(double x, double y)
+   {
+      return expCore<double>(y*logCore<double>(x));
+   }
+
+   static bool isPowReducible(double x, double y)
+   {
+      return x > 0.0 && x <= std::numeric_limits<double>::max() && fabs(y) <= std::numeric_limits<double>::max();
+   }
+
+   template<typename T, double (*approximate)(double), bool (*reducible)(double), double (*exact)(double)>
+   static T reduced(T x)
+   {
+      return static_cast<T>(reducible(x) ? approximate(x) : exact(x));
+   }
+
+   template<typename T, double (*approximate)(double, double), bool (*reducible)(double, double),
+      double (*exact)(double, double)>
+   static T reduced(T lhs, T rhs)
+   {
+      return static_cast<T>(reducible(lhs, rhs) ? approximate(lhs, rhs) : exact(lhs, rhs));
+   }
+
+   template<typename T, double (*approximate)(double)>
+   static void row(T* pDest, const T* pSrc, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         pDest[i] = static_cast<T>(approximate(pSrc[i]));
+      }
+   }
+
+   template<typename T, double (*approximate)(double, double)>
+   static void row(T* pDest, const T* pLhs, const T* pRhs, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         pDest[i] = static_cast<T>(approximate(pLhs[i], pRhs[i]));
+      }
+   }
+
+   /**
+    * Approximates a block of values at a time with a row function, and then recomputes the values
+    * of the block which the reduction does not cover. The block keeps the arguments, since the
+    * destination may be the source.
+    */
+   template<typename T, void (*approximate)(T*, const T*, int), bool (*reducible)(double), double (*exact)(double)>
+   static void reducedRow(T* pDest, const T* pSrc, int count)
+   {
+      T values[BLOCK_SIZE];
+      for (int start=0; start<count; start+=BLOCK_SIZE)
+      {
+         int blockCount = std::min(static_cast<int>(BLOCK_SIZE), count-start);
+         std::copy(pSrc+start, pSrc+start+blockCount, values);
+         T* pBlockDest = pDest+start;
+         approximate(pBlockDest, values, blockCount);
+         for (int i=0; i<blockCount; ++i)
+         {
+            if (!reducible(values[i]))
+            {
+               pBlockDest[i] = static_cast<T>(exact(values[i]));
+            }
+         }
+      }
+   }
+
+   template<typename T, void (*approximate)(T*, const T*, const T*, int), bool (*reducible)(double, double),
+      double (*exact)(double, double)>
+   static void reducedRow(T* pDest, const T* pLhs, const T* pRhs, int count)
+   {
+      T lhs[BLOCK_SIZE];
+      T rhs[BLOCK_SIZE];
+      for (int start=0; start<count; start+=BLOCK_SIZE)
+      {
+         int blockCount = std::min(static_cast<int>(BLOCK_SIZE), count-start);
+         std::copy(pLhs+start, pLhs+start+blockCount, lhs);
+         std::copy(pRhs+start, pRhs+start+blockCount, rhs);
+         T* pBlockDest = pDest+start;
+         approximate(pBlockDest, lhs, rhs, blockCount);
+         for (int i=0; i<blockCount; ++i)
+         {
+            if (!reducible(lhs[i], rhs[i]))
+            {
+               pBlockDest[i] = static_cast<T>(exact(lhs[i], rhs[i]));
+            }
+         }
+      }
+   }
+};
+
+// the series of all but exp are in powers of the square of their reduced argument
+template<>
+struct FastMath::Terms<double>
+{
+   static const int EXP = 13;
+   static const int LOG = 9;
+   static const int SINE = 7;
+   static const int COSINE = 8;
+   static const int ATAN = 10;
+};
+
+template<>
+struct FastMath::Terms<float>
+{
+   static const int EXP = 7;
+   static const int LOG = 4;
+   static const int SINE = 4;
+   static const int COSINE = 4;
+   static const int ATAN = 4;
+};
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "AppConfig.h"
+#include "DynamicModule.h"
+#include "NativeProgram.h"
+#include "PlugInManagerServices.h"
+#include "RasterMathKernels.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QString>
+
+#include <fstream>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace std;
+using namespace boost;
+
+namespace
+{
+#if defined(_WIN32)
+   const char* const DEFAULT_COMPILER = "cl /nologo /O2 /fp:precise /LD";
+   const char* const LIBRARY_SUFFIX = ".dll";
+   const char* const QUIET = " > NUL 2>&1";
+#else
+   // no contraction into fused multiply-adds, which would round differently than the interpreter
+   const char* const DEFAULT_COMPILER = "c++ -O3 -ffp-contract=off -fPIC -shared";
+   const char* const LIBRARY_SUFFIX = ".so";
+   const char* const QUIET = " > /dev/null 2>&1";
+#endif
+   const char* const PROBE_SOURCE = "int rasterMathProbe() { return 0; }\n";
+
+   bool sCompilerRuns = false;
+   bool sCompilerMissing = false;
+   set<string> sFailedKeys; // programs the compiler did not accept this session
+
+   // by hash, so a program is loaded once per session; leaked on purpose, since unloading the
+   // libraries during static destruction could run after the plug-in manager is gone, and the
+   // process unloads them when it exits
+   map<string, shared_ptr<NativeProgram> >& sPrograms = *new map<string, shared_ptr<NativeProgram> >;
+
+   bool fileExists(const string& path)
+   {
+      return ifstream(path.c_str()).good();
+   }
+
+   // distinguishes the files one session writes into a cache shared with others
+   string processId()
+   {
+      return QString::number(QCoreApplication::applicationPid()).toStdString();
+   }
+}
+
+const char* const NativeProgram::FUNCTION_NAME = "rasterMathRow";
+
+shared_ptr<NativeProgram> NativeProgram::load(const string& source, const string& cacheDirectory)
+{
+   string command = compilerCommand();
+   string key = hash(source+"\n"+command+"\n"+static_cast<char>('0'+RasterMathKernels::instance().instructionSet()));
+   map<string, shared_ptr<NativeProgram> >::const_iterator pProgram = sPrograms.find(key);
+   if (pProgram != sPrograms.end())
+   {
+      return pProgram->second;
+   }
+
+   string libraryPath = cacheDirectory+"/rastermath_"+key+LIBRARY_SUFFIX;
+   if (!fileExists(libraryPath))
+   {
+      if (sCompilerMissing || sFailedKeys.find(key) != sFailedKeys.end())
+      {
+         return shared_ptr<NativeProgram>();
+      }
+      if (!compile(source, libraryPath))
+      {
+         // a compiler which cannot build even an empty library is not there, and fails every program
+         if (!sCompilerRuns)
+         {
+            string probePath = cacheDirectory+"/rastermath_probe_"+processId()+LIBRARY_SUFFIX;
+            sCompilerRuns = compile(PROBE_SOURCE, probePath);
+            sCompilerMissing = !sCompilerRuns;
+            remove(probePath.c_str());
+         }
+         sFailedKeys.insert(key);
+         return shared_ptr<NativeProgram>();
+      }
+   }
+
+   Service<PlugInManagerServices> pManager;
+   DynamicModule* pModule = pManager->getDynamicModule(libraryPath);
+   if (pModule == NULL)
+   {
+      return shared_ptr<NativeProgram>();
+   }
+   RowFunction pFunction = reinterpret_cast<RowFunction>(pModule->getProcedureAddress(FUNCTION_NAME));
+   if (pFunction == NULL)
+   {
+      pManager->destroyDynamicModule(pModule);
+      return shared_ptr<NativeProgram>();
+   }
+
+   shared_ptr<NativeProgram> program(new NativeProgram(pFunction));
+   sPrograms[key] = program;
+   return program;
+}
+
+NativeProgram::NativeProgram(RowFunction pFunction) :
+   mpFunction(pFunction)
+{
+}
+
+/**
+ * The compiler, and unless it is named by RASTERMATH_COMPILER, the instructions it may use. These
+ * are those of the kernels' instruction set, rather than all those of the CPU, so a library
+ * cached by one computer runs on every other whose kernels use the same instruction set.
+ */
+string NativeProgram::compilerCommand()
+{
+   const char* pCompiler = getenv("RASTERMATH_COMPILER");
+   if (pCompiler != NULL && *pCompiler != '\0')
+   {
+      return pCompiler;
+   }
+   string command = DEFAULT_COMPILER;
+   switch (RasterMathKernels::instance().instructionSet())
+   {
+#if defined(_WIN32)
+      case RasterMathKernels::AVX:
+         command += " /arch:AVX";
+         break;
+      case RasterMathKernels::AVX512:
+         command += " /arch:AVX512";
+         break;
+#else
+      case RasterMathKernels::SSE2:
+         command += " -msse2";
+         break;
+      case RasterMathKernels::AVX:
+         command += " -mavx";
+         break;
+      case RasterMathKernels::AVX512:
+         command += " -mavx512f";
+         break;
+#endif
+      default:
+         break;
+   }
+   return command;
+}
+
+/**
+ * The 64-bit FNV-1a hash of text, in hexadecimal.
+ */
+string NativeProgram::hash(const string& text)
+{
+   uint64_t value = 14695981039346656037ULL;
+   for (string::const_iterator pChar=text.begin(); pChar!=text.end(); ++pChar)
+   {
+      value ^= static_cast<unsigned char>(*pChar);
+      value *= 1099511628211ULL;
+   }
+   char digits[17];
+   sprintf(digits, "%08x%08x", static_cast<unsigned int>(value >> 32), static_cast<unsigned int>(value & 0xffffffffU));
+   return digits;
+}
+
+/**
+ * Compiles source into the library at libraryPath. The source, object and library are written
+ * under names of this process, so sessions compiling the same program do not write over each
+ * other's files, and the library is then renamed into place, so another session never loads a
+ * partly written library.
+ */
+bool NativeProgram::compile(const string& source, const string& libraryPath)
+{
+   string temporaryBase = libraryPath+"."+processId();
+   string sourcePath = temporaryBase+".cpp";
+   string temporaryPath = temporaryBase+".tmp";
+   {
+      ofstream sourceFile(sourcePath.c_str());
+      sourceFile << source;
+      if (!sourceFile)
+      {
+         return false;
+      }
+   }
+
+#if defined(_WIN32)
+   string output = " /Fe\""+temporaryPath+"\" /Fo\""+temporaryBase+".obj\"";
+#else
+   string output = " -o \""+temporaryPath+"\"";
+#endif
+   string command = compilerCommand()+output+" \""+sourcePath+"\""+QUIET;
+   int status = system(command.c_str());
+   remove(sourcePath.c_str());
+#if defined(_WIN32)
+   // cl also leaves the object, and the import library of the exported function
+   remove((temporaryBase+".obj").c_str());
+   remove((temporaryBase+".lib").c_str());
+   remove((temporaryBase+".exp").c_str());
+#endif
+   if (status != 0)
+   {
+      remove(temporaryPath.c_str());
+      return false;
+   }
+   if (rename(temporaryPath.c_str(), libraryPath.c_str()) != 0)
+   {
+      // another session compiled the same program first; POSIX systems replace its library
+      // atomically instead, and Windows fails the rename
+      remove(temporaryPath.c_str());
+   }
+   return fileExists(libraryPath);
+}
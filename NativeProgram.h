@@ -0,0 +1,72 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef NATIVEPROGRAM_H
+#define NATIVEPROGRAM_H
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+/**
+ * A ProcessProgram translated to C++ and compiled ahead of time into a shared library.
+ *
+ * The library exports one function, which evaluates the whole program for each pixel of a row
+ * in a single loop, with every intermediate value in a local variable instead of a register row.
+ * Libraries are cached in a directory under a hash of their source, the compiler command and
+ * the kernels' instruction set, so a formula is only compiled the first time it is run.
+ *
+ * The compiler is "c++" on POSIX systems and "cl" on Windows, unless the RASTERMATH_COMPILER
+ * environment variable names another command; the source and library paths are appended to it.
+ * A program the compiler does not accept is interpreted, and not compiled again in the session.
+ * When the compiler cannot be run at all, no program is compiled for the rest of the session.
+ * Loaded libraries stay loaded until the process exits.
+ */
+class NativeProgram
+{
+public:
+   /**
+    * The exported function. It reads the row of each raster or AOI input from pInputs, in the
+    * order of the program, and the values of its numbers and fused constants from pConstants.
+    * The operand of each result is stored in its register of pRegisters, and the columns with
+    * a computation error are flagged in pErrors.
+    *
+    * @return nonzero if any column had an error.
+    */
+   typedef int (*RowFunction)(const double* pInputs, const double* pConstants, double* pRegisters,
+      char* pErrors, int columnCount);
+
+   static const char* const FUNCTION_NAME;
+
+   /**
+    * Loads the library compiled from source, compiling it into cacheDirectory first if
+    * it is not cached there.
+    *
+    * @return the loaded program, or NULL if it could not be compiled or loaded.
+    */
+   static boost::shared_ptr<NativeProgram> load(const std::string& source, const std::string& cacheDirectory);
+
+   int computeRow(const double* pInputs, const double* pConstants, double* pRegisters, char* pErrors,
+      int columnCount) const
+   {
+      return mpFunction(pInputs, pConstants, pRegisters, pErrors, columnCount);
+   }
+
+private:
+   NativeProgram(RowFunction pFunction);
+   NativeProgram(const NativeProgram& rhs);
+   NativeProgram& operator=(const NativeProgram& rhs);
+
+   static std::string compilerCommand();
+   static std::string hash(const std::string& text);
+   static bool compile(const std::string& source, const std::string& libraryPath);
+
+   RowFunction mpFunction;
+};
+
+#endif
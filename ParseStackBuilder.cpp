@@ -10,6 +10,7 @@
 #include "AppVerify.h"
 #include "ParseStackBuilder.h"
 #include "ProcessStep.h"
+#include "ProcessStepConditional.h"
 #include "ProcessStepStatFunc.h"
 #include "RasterMathException.h"
 
@@ -63,6 +64,83 @@ namespace
       return vector<shared_ptr<ProcessStep> >(ppStart, ppStop);
    }
 
+   vector<shared_ptr<ProcessStep> > popSubStack(ProcessStack& stack)
+   {
+      vector<shared_ptr<ProcessStep> > subStack = getSubStack(stack.getSteps(), 1);
+      for (size_t i=0; i<subStack.size(); ++i)
+      {
+         stack.pop_back();
+      }
+      return subStack;
+   }
+
+   // whether a subexpression can fail, or costs more per pixel than the arithmetic of a mask
+   bool isCostly(const vector<shared_ptr<ProcessStep> >& steps)
+   {
+      for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
+      {
+         switch (RM_NULLCHK(*ppStep)->type())
+         {
+            case ProcessStep::NUMBER:
+            case ProcessStep::VALUE_RASTER:
+            case ProcessStep::VALUE_AOI:
+            case ProcessStep::NEGATE:
+            case ProcessStep::ADD:
+            case ProcessStep::SUBTRACT:
+            case ProcessStep::MULTIPLY:
+            case ProcessStep::ABS:
+            case ProcessStep::LESS_THAN:
+            case ProcessStep::GREATER_THAN:
+            case ProcessStep::EQUALS:
+            case ProcessStep::NOT_EQUALS:
+            case ProcessStep::LESS_OR_EQUAL:
+            case ProcessStep::GREATER_OR_EQUAL:
+            case ProcessStep::NOT:
+            case ProcessStep::AND:
+            case ProcessStep::OR:
+            case ProcessStep::CLAMP:
+               break;
+            default:
+               return true;
+         }
+      }
+      return false;
+   }
+
+   shared_ptr<ProcessStep> createNumber(double value)
+   {
+      stringstream s;
+      s << value;
+      return shared_ptr<ProcessStep>(new ProcessStepNumber(s.str(), ProcessStep::NUMBER, value));
+   }
+
+   /**
+    * Replaces the operands of "and", or of "or" when isOr is set, by a conditional which only
+    * evaluates the right operand where the left one does not decide the result.
+    *
+    * @return false if both operands should be evaluated, because the right one is cheap.
+    */
+   bool addShortCircuit(ProcessStack& stack, bool isOr)
+   {
+      if (!isCostly(getSubStack(stack.getSteps(), 1)))
+      {
+         return false;
+      }
+
+      // the right operand's truth, as the logical operators take it
+      vector<shared_ptr<ProcessStep> > rightSteps = popSubStack(stack);
+      rightSteps.push_back(createNumber(0.0));
+      rightSteps.push_back(shared_ptr<ProcessStep>(new ProcessStepFunction("not equals", ProcessStep::NOT_EQUALS, rightSteps, 2)));
+
+      vector<shared_ptr<ProcessStep> > constantSteps(1, createNumber(isOr ? 1.0 : 0.0));
+      RM_VERIFY(!stack.getSteps().empty());
+      const ProcessStep& condition = *RM_NULLCHK(stack.getSteps().back());
+      stack.add(shared_ptr<ProcessStep>(isOr ?
+         new ProcessStepConditional(condition, constantSteps, rightSteps) :
+         new ProcessStepConditional(condition, rightSteps, constantSteps)));
+      return true;
+   }
+
    ProcessStep::StepType typeFromName(const string& fname, const char* pNames[], const ProcessStep::StepType* pTypes, int typeCount)
    {
       vector<string> fnames(pNames, &pNames[typeCount]);
@@ -193,11 +271,19 @@ void ParseStackBuilder::not(char const* pStr, char const* pEnd)
 
 void ParseStackBuilder::and(char const* pStr, char const* pEnd)
 {
+   if (addShortCircuit(sStack, false))
+   {
+      return;
+   }
    sStack.add(shared_ptr<ProcessStep>(new ProcessStepFunction("and", ProcessStep::AND, sStack.getSteps(), 2)));
 }
 
 void ParseStackBuilder::or(char const* pStr, char const* pEnd)
 {
+   if (addShortCircuit(sStack, true))
+   {
+      return;
+   }
    sStack.add(shared_ptr<ProcessStep>(new ProcessStepFunction("or", ProcessStep::OR, sStack.getSteps(), 2)));
 }
 
@@ -251,6 +337,14 @@ void ParseStackBuilder::statfunc1(char const* pStr, char const* pEnd)
    sStack.add(pStep);
 }
 
+void ParseStackBuilder::conditional(char const* pStr, char const* pEnd)
+{
+   vector<shared_ptr<ProcessStep> > falseSteps = popSubStack(sStack);
+   vector<shared_ptr<ProcessStep> > trueSteps = popSubStack(sStack);
+   RM_VERIFY(!sStack.getSteps().empty());
+   sStack.add(shared_ptr<ProcessStep>(new ProcessStepConditional(*RM_NULLCHK(sStack.getSteps().back()), trueSteps, falseSteps)));
+}
+
 void ParseStackBuilder::fullRaster(char const* pStr, char const* pEnd)
 {
    sStack.add(shared_ptr<ProcessStep>(new ProcessStepRaster(getFirstWord(pStr, pEnd), ProcessStep::VALUE_RASTER, 0, -1)));
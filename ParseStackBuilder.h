@@ -45,6 +45,7 @@ public:
    static void func2(char const* pStr, char const* pEnd);
    static void func3(char const* pStr, char const* pEnd);
    static void statfunc1(char const* pStr, char const* pEnd);
+   static void conditional(char const* pStr, char const* pEnd);
    static void fullRaster(char const* pStr, char const* pEnd);
    static void rasterIndex(char const* pStr, char const* pEnd);
    static void rasterFullSlice(char const* pStr, char const* pEnd);
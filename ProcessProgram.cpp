@@ -0,0 +1,1735 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "FastMath.h"
+#include "NativeProgram.h"
+#include "ProcessProgram.h"
+#include "ProcessStepConditional.h"
+#include "ProcessStepInvariant.h"
+#include "ProcessStepStatFunc.h"
+#include "RasterMathException.h"
+#include "RasterMathKernels.h"
+#include "RasterMathProgress.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <sstream>
+
+using namespace std;
+using namespace boost;
+
+namespace
+{
+   // the fused form of a binary step with a NUMBER operand, which becomes the right operand
+   ProcessStep::StepType constantStepType(ProcessStep::StepType type, bool constantOnLeft)
+   {
+      switch (type)
+      {
+         case ProcessStep::ADD:
+            return ProcessStep::ADD_CONSTANT;
+         case ProcessStep::MULTIPLY:
+            return ProcessStep::MULTIPLY_CONSTANT;
+         case ProcessStep::LESS_THAN:
+            return constantOnLeft ? ProcessStep::GREATER_THAN_CONSTANT : ProcessStep::LESS_THAN_CONSTANT;
+         case ProcessStep::GREATER_THAN:
+            return constantOnLeft ? ProcessStep::LESS_THAN_CONSTANT : ProcessStep::GREATER_THAN_CONSTANT;
+         case ProcessStep::LESS_OR_EQUAL:
+            return constantOnLeft ? ProcessStep::GREATER_OR_EQUAL_CONSTANT : ProcessStep::LESS_OR_EQUAL_CONSTANT;
+         case ProcessStep::GREATER_OR_EQUAL:
+            return constantOnLeft ? ProcessStep::LESS_OR_EQUAL_CONSTANT : ProcessStep::GREATER_OR_EQUAL_CONSTANT;
+         case ProcessStep::EQUALS:
+            return ProcessStep::EQUALS_CONSTANT;
+         case ProcessStep::NOT_EQUALS:
+            return ProcessStep::NOT_EQUALS_CONSTANT;
+         default:
+            return type;
+      }
+   }
+
+   // the number of operands whose NaN the step would not pass on to its result
+   int droppedNanCount(ProcessStep::StepType type)
+   {
+      switch (type)
+      {
+         case ProcessStep::NOT:
+         case ProcessStep::CONDITIONAL:
+         case ProcessStep::LESS_THAN_CONSTANT:
+         case ProcessStep::GREATER_THAN_CONSTANT:
+         case ProcessStep::LESS_OR_EQUAL_CONSTANT:
+         case ProcessStep::GREATER_OR_EQUAL_CONSTANT:
+         case ProcessStep::EQUALS_CONSTANT:
+         case ProcessStep::NOT_EQUALS_CONSTANT:
+            return 1;
+         case ProcessStep::EXPONENTIATE: // pow(NaN, 0) and pow(1, NaN) are 1
+         case ProcessStep::LESS_THAN:
+         case ProcessStep::GREATER_THAN:
+         case ProcessStep::LESS_OR_EQUAL:
+         case ProcessStep::GREATER_OR_EQUAL:
+         case ProcessStep::EQUALS:
+         case ProcessStep::NOT_EQUALS:
+         case ProcessStep::AND:
+         case ProcessStep::OR:
+            return 2;
+         case ProcessStep::CLAMP:
+            return 3;
+         default:
+            return 0;
+      }
+   }
+}
+
+ProcessProgram::ProcessProgram(const vector<shared_ptr<ProcessStep> >& steps, int columnCount,
+                               bool failOnError, double defaultValue, double toRadians, bool propagateNan,
+                               bool singlePrecision, bool fastMath) :
+   mColumnCount(columnCount),
+   mRegisterCount(0),
+   mStackRegisterCount(0),
+   mResultRegister(0),
+   mFailOnError(failOnError),
+   mDefaultValue(defaultValue),
+   mToRadians(toRadians),
+   mPropagateNan(propagateNan),
+   mSinglePrecision(singlePrecision),
+   mFastMath(fastMath),
+   mInteger(false)
+{
+   compile(steps);
+   fuse();
+   mInteger = fitsIntegers();
+   allocateRegisters();
+}
+
+/**
+ * Compiles a branch of a conditional in program, with the same settings. A branch runs in the
+ * precision of its program's registers, so it never computes in integers.
+ */
+ProcessProgram::ProcessProgram(const ProcessProgram& program, const vector<shared_ptr<ProcessStep> >& steps) :
+   mColumnCount(program.mColumnCount),
+   mRegisterCount(0),
+   mStackRegisterCount(0),
+   mResultRegister(0),
+   mFailOnError(program.mFailOnError),
+   mDefaultValue(program.mDefaultValue),
+   mToRadians(program.mToRadians),
+   mPropagateNan(program.mPropagateNan),
+   mSinglePrecision(program.mSinglePrecision),
+   mFastMath(program.mFastMath),
+   mInteger(false)
+{
+   compile(steps);
+   fuse();
+   allocateRegisters();
+}
+
+void ProcessProgram::allocateRegisters()
+{
+   if (mInteger)
+   {
+      mIntegerRegisters.assign(static_cast<size_t>(mRegisterCount)*mColumnCount, 0);
+   }
+   else if (mSinglePrecision)
+   {
+      mFloatRegisters.assign(static_cast<size_t>(mRegisterCount)*mColumnCount, 0.0f);
+   }
+   else
+   {
+      mRegisters.assign(static_cast<size_t>(mRegisterCount)*mColumnCount, 0.0);
+   }
+   mErrors.assign(mColumnCount, 0);
+   if (mFastMath)
+   {
+      mFailedColumns.reserve(mColumnCount);
+   }
+}
+
+void ProcessProgram::compile(const vector<shared_ptr<ProcessStep> >& steps)
+{
+   if (steps.empty())
+   {
+      throw RasterMathException("Computing empty process stack");
+   }
+
+   // steps whose values are reused by a later reference keep them in a register of their own
+   vector<int> targets(steps.size(), -1);
+   vector<int> pinned(steps.size(), -1);
+   int pinnedCount = 0;
+   int depth = 0;
+   int maxDepth = 0;
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
+   {
+      const ProcessStep& step = *RM_NULLCHK(*ppStep);
+      if (ProcessStep::isSink(step.mStepType))
+      {
+         --depth;
+      }
+      else
+      {
+         depth += 1-step.mArgCount;
+      }
+      maxDepth = max(maxDepth, depth);
+
+      if (step.mStepType != ProcessStep::REFERENCE)
+      {
+         continue;
+      }
+      const ProcessStep& target = static_cast<const ProcessStepReference&>(step).mStep;
+      for (vector<shared_ptr<ProcessStep> >::const_iterator ppTarget=steps.begin(); ppTarget!=ppStep; ++ppTarget)
+      {
+         if (ppTarget->get() == &target)
+         {
+            int targetIndex = ppTarget-steps.begin();
+            if (pinned[targetIndex] == -1)
+            {
+               pinned[targetIndex] = pinnedCount++;
+            }
+            targets[ppStep-steps.begin()] = targetIndex;
+            break;
+         }
+      }
+   }
+   mStackRegisterCount = maxDepth;
+   mRegisterCount = max(maxDepth, 1)+pinnedCount;
+   RM_VERIFY(mRegisterCount <= numeric_limits<unsigned short>::max());
+
+   // the registers holding the working stack, deepest entry first
+   vector<unsigned short> stack;
+   mInstructions.reserve(steps.size());
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
+   {
+      int index = ppStep-steps.begin();
+      ProcessStep& step = **ppStep;
+
+      Instruction instruction;
+      instruction.mType = step.mStepType;
+      instruction.mDest = 0;
+      instruction.mArgs[0] = instruction.mArgs[1] = instruction.mArgs[2] = 0;
+      instruction.mpStep = &step;
+      instruction.mpValue = &step.mValue;
+      instruction.mConstants[0] = instruction.mConstants[1] = 0.0;
+      instruction.mpBranches[0] = instruction.mpBranches[1] = NULL;
+      if (ProcessStepConstantFunction::isConstantFunction(step.mStepType))
+      {
+         instruction.mConstants[0] = static_cast<ProcessStepConstantFunction&>(step).mConstant;
+      }
+      int argCount = ProcessStep::isSink(step.mStepType) ? 1 : step.mArgCount;
+
+      if (step.mStepType == ProcessStep::REFERENCE)
+      {
+         if (targets[index] != -1)
+         {
+            stack.push_back(maxDepth+pinned[targets[index]]);
+            continue;
+         }
+         // the referenced step is not part of this program, so read its value as a scalar
+         instruction.mType = ProcessStep::NUMBER;
+         instruction.mpValue = &static_cast<ProcessStepReference&>(step).mRef;
+      }
+      else if (step.mStepType == ProcessStep::COMPUTED_SIGNATURE)
+      {
+         instruction.mType = ProcessStep::NUMBER;
+      }
+      else if (step.mStepType == ProcessStep::BAND_INVARIANT && !static_cast<ProcessStepInvariant&>(step).mError)
+      {
+         instruction.mType = ProcessStep::NUMBER;
+      }
+      else if (step.mStepType == ProcessStep::CONDITIONAL)
+      {
+         ProcessStepConditional& conditionalStep = static_cast<ProcessStepConditional&>(step);
+         mBranches.push_back(shared_ptr<ProcessProgram>(new ProcessProgram(*this, conditionalStep.mTrueStack.getSteps())));
+         instruction.mpBranches[0] = mBranches.back().get();
+         mBranches.push_back(shared_ptr<ProcessProgram>(new ProcessProgram(*this, conditionalStep.mFalseStack.getSteps())));
+         instruction.mpBranches[1] = mBranches.back().get();
+      }
+
+      RM_VERIFY(argCount <= 3 && static_cast<int>(stack.size()) >= argCount);
+      for (int arg=0; arg<argCount; ++arg)
+      {
+         instruction.mArgs[arg] = stack[stack.size()-argCount+arg];
+      }
+      stack.resize(stack.size()-argCount);
+
+      if (!ProcessStep::isSink(step.mStepType))
+      {
+         instruction.mDest = (pinned[index] == -1) ? stack.size() : maxDepth+pinned[index];
+         stack.push_back(instruction.mDest);
+      }
+      mInstructions.push_back(instruction);
+   }
+   if (!stack.empty())
+   {
+      mResultRegister = stack.back();
+   }
+}
+
+void ProcessProgram::fuse()
+{
+   for (size_t index=0; index<mInstructions.size(); ++index)
+   {
+      // one fusion can enable another, e.g. a multiply by a constant followed by an add
+      while (fuseInstruction(index))
+      {
+      }
+   }
+}
+
+bool ProcessProgram::fuseInstruction(size_t& index)
+{
+   Instruction& instruction = mInstructions[index];
+   switch (instruction.mType)
+   {
+      case ProcessStep::ADD:
+      case ProcessStep::SUBTRACT:
+      case ProcessStep::MULTIPLY:
+      case ProcessStep::LESS_THAN:
+      case ProcessStep::GREATER_THAN:
+      case ProcessStep::LESS_OR_EQUAL:
+      case ProcessStep::GREATER_OR_EQUAL:
+      case ProcessStep::EQUALS:
+      case ProcessStep::NOT_EQUALS:
+      {
+         int lhs = findProducer(index, instruction.mArgs[0]);
+         int rhs = findProducer(index, instruction.mArgs[1]);
+         bool constantOnLeft = isConstant(lhs);
+         if (constantOnLeft == isConstant(rhs))
+         {
+            return false;
+         }
+         int constant = constantOnLeft ? lhs : rhs;
+         double value = *mInstructions[constant].mpValue;
+         if (constantOnLeft)
+         {
+            instruction.mArgs[0] = instruction.mArgs[1];
+         }
+         if (instruction.mType != ProcessStep::SUBTRACT)
+         {
+            instruction.mType = constantStepType(instruction.mType, constantOnLeft);
+            instruction.mConstants[0] = value;
+         }
+         else if (constantOnLeft)
+         {
+            // b-x == x*-1+b exactly
+            instruction.mType = ProcessStep::AFFINE;
+            instruction.mConstants[0] = -1.0;
+            instruction.mConstants[1] = value;
+         }
+         else
+         {
+            instruction.mType = ProcessStep::ADD_CONSTANT;
+            instruction.mConstants[0] = -value;
+         }
+         mInstructions.erase(mInstructions.begin()+constant);
+         --index;
+         return true;
+      }
+      case ProcessStep::ADD_CONSTANT:
+      case ProcessStep::AFFINE:
+      {
+         // x*a+b, x*a-b and b-x*a; other scales would round differently than the unfused formula
+         if (instruction.mType == ProcessStep::AFFINE && instruction.mConstants[0] != -1.0)
+         {
+            return false;
+         }
+         if (index == 0 || instruction.mArgs[0] >= mStackRegisterCount)
+         {
+            return false;
+         }
+         const Instruction& multiply = mInstructions[index-1];
+         if (multiply.mType != ProcessStep::MULTIPLY_CONSTANT || multiply.mDest != instruction.mArgs[0])
+         {
+            return false;
+         }
+         if (instruction.mType == ProcessStep::ADD_CONSTANT)
+         {
+            instruction.mConstants[1] = instruction.mConstants[0];
+            instruction.mConstants[0] = multiply.mConstants[0];
+         }
+         else
+         {
+            instruction.mConstants[0] = -multiply.mConstants[0];
+         }
+         instruction.mType = ProcessStep::AFFINE;
+         instruction.mArgs[0] = multiply.mArgs[0];
+         mInstructions.erase(mInstructions.begin()+index-1);
+         --index;
+         return true;
+      }
+      case ProcessStep::DIVIDE:
+      {
+         // (x-y)/(x+y), where x and y are registers held for the whole row
+         if (index < 2)
+         {
+            return false;
+         }
+         const Instruction& difference = mInstructions[index-2];
+         const Instruction& sum = mInstructions[index-1];
+         if (difference.mType != ProcessStep::SUBTRACT || sum.mType != ProcessStep::ADD ||
+            difference.mDest != instruction.mArgs[0] || sum.mDest != instruction.mArgs[1] ||
+            difference.mDest >= mStackRegisterCount || sum.mDest >= mStackRegisterCount)
+         {
+            return false;
+         }
+         unsigned short x = difference.mArgs[0];
+         unsigned short y = difference.mArgs[1];
+         if (x < mStackRegisterCount || y < mStackRegisterCount ||
+            !((sum.mArgs[0] == x && sum.mArgs[1] == y) || (sum.mArgs[0] == y && sum.mArgs[1] == x)))
+         {
+            return false;
+         }
+         instruction.mType = ProcessStep::NORMALIZED_DIFFERENCE;
+         instruction.mArgs[0] = x;
+         instruction.mArgs[1] = y;
+         mInstructions.erase(mInstructions.begin()+index-2, mInstructions.begin()+index);
+         index -= 2;
+         return true;
+      }
+      default:
+         return false;
+   }
+}
+
+int ProcessProgram::findProducer(size_t index, unsigned short reg) const
+{
+   while (index-- > 0)
+   {
+      const Instruction& instruction = mInstructions[index];
+      if (!ProcessStep::isSink(instruction.mType) && instruction.mDest == reg)
+      {
+         return static_cast<int>(index);
+      }
+   }
+   return -1;
+}
+
+bool ProcessProgram::isConstant(int index) const
+{
+   if (index == -1)
+   {
+      return false;
+   }
+
+   // a stack register is read only by the instruction which pops it, so the NUMBER can be dropped;
+   // band-invariant values are constant for as long as the program, which is compiled per band
+   const Instruction& instruction = mInstructions[index];
+   ProcessStep::StepType stepType = instruction.mpStep->mStepType;
+   return instruction.mType == ProcessStep::NUMBER && instruction.mDest < mStackRegisterCount &&
+      (stepType == ProcessStep::NUMBER || stepType == ProcessStep::BAND_INVARIANT);
+}
+
+/**
+ * Whether every value of the program is an integer which fits in 32 bits, so the program can
+ * run on rows of integers with exactly the results it has in double precision.
+ */
+bool ProcessProgram::fitsIntegers() const
+{
+   // the smallest and largest value of each register, which are exact in double
+   vector<pair<double, double> > ranges(mRegisterCount, make_pair(0.0, 0.0));
+   for (vector<Instruction>::const_iterator pInstruction=mInstructions.begin(); pInstruction!=mInstructions.end(); ++pInstruction)
+   {
+      const pair<double, double>& lhs = ranges[pInstruction->mArgs[0]];
+      const pair<double, double>& rhs = ranges[pInstruction->mArgs[1]];
+      double scale = pInstruction->mConstants[0];
+      double offset = pInstruction->mConstants[1];
+      if (scale != floor(scale) || offset != floor(offset))
+      {
+         return false;
+      }
+
+      pair<double, double> range(0.0, 1.0); // comparisons and logical operators
+      switch (pInstruction->mType)
+      {
+         case ProcessStep::NUMBER:
+         {
+            // only values which stay constant for as long as the program
+            ProcessStep::StepType stepType = pInstruction->mpStep->mStepType;
+            double value = *pInstruction->mpValue;
+            if ((stepType != ProcessStep::NUMBER && stepType != ProcessStep::BAND_INVARIANT) || value != floor(value))
+            {
+               return false;
+            }
+            range = make_pair(value, value);
+            break;
+         }
+         case ProcessStep::VALUE_RASTER:
+            switch (static_cast<const ProcessStepRaster&>(*pInstruction->mpStep).mEncodingType)
+            {
+               case INT1UBYTE:
+                  range = make_pair(0.0, 255.0);
+                  break;
+               case INT1SBYTE:
+                  range = make_pair(-128.0, 127.0);
+                  break;
+               case INT2UBYTES:
+                  range = make_pair(0.0, 65535.0);
+                  break;
+               case INT2SBYTES:
+                  range = make_pair(-32768.0, 32767.0);
+                  break;
+               default:
+                  return false;
+            }
+            break;
+         case ProcessStep::RESULT_RASTER:
+            switch (static_cast<const ProcessStepRaster&>(*pInstruction->mpStep).mEncodingType)
+            {
+               case INT1UBYTE:
+               case INT1SBYTE:
+               case INT2UBYTES:
+               case INT2SBYTES:
+               case INT4UBYTES:
+               case INT4SBYTES:
+                  continue;
+               default:
+                  return false;
+            }
+         case ProcessStep::ADD:
+            range = make_pair(lhs.first+rhs.first, lhs.second+rhs.second);
+            break;
+         case ProcessStep::SUBTRACT:
+            range = make_pair(lhs.first-rhs.second, lhs.second-rhs.first);
+            break;
+         case ProcessStep::MULTIPLY:
+         {
+            double products[] = {lhs.first*rhs.first, lhs.first*rhs.second, lhs.second*rhs.first, lhs.second*rhs.second};
+            range = make_pair(*min_element(products, products+4), *max_element(products, products+4));
+            break;
+         }
+         case ProcessStep::NEGATE:
+            range = make_pair(-lhs.second, -lhs.first);
+            break;
+         case ProcessStep::ABS:
+            range = make_pair(lhs.first > 0.0 ? lhs.first : (lhs.second < 0.0 ? -lhs.second : 0.0),
+               max(fabs(lhs.first), fabs(lhs.second)));
+            break;
+         case ProcessStep::ADD_CONSTANT:
+            range = make_pair(lhs.first+scale, lhs.second+scale);
+            break;
+         case ProcessStep::MULTIPLY_CONSTANT:
+         case ProcessStep::AFFINE:
+            range = make_pair(min(lhs.first*scale, lhs.second*scale)+offset, max(lhs.first*scale, lhs.second*scale)+offset);
+            break;
+         case ProcessStep::LESS_THAN:
+         case ProcessStep::GREATER_THAN:
+         case ProcessStep::LESS_OR_EQUAL:
+         case ProcessStep::GREATER_OR_EQUAL:
+         case ProcessStep::EQUALS:
+         case ProcessStep::NOT_EQUALS:
+         case ProcessStep::LESS_THAN_CONSTANT:
+         case ProcessStep::GREATER_THAN_CONSTANT:
+         case ProcessStep::LESS_OR_EQUAL_CONSTANT:
+         case ProcessStep::GREATER_OR_EQUAL_CONSTANT:
+         case ProcessStep::EQUALS_CONSTANT:
+         case ProcessStep::NOT_EQUALS_CONSTANT:
+         case ProcessStep::NOT:
+         case ProcessStep::AND:
+         case ProcessStep::OR:
+            break;
+         default:
+            return false;
+      }
+      if (range.first < numeric_limits<int>::min() || range.second > numeric_limits<int>::max())
+      {
+         return false;
+      }
+      ranges[pInstruction->mDest] = range;
+   }
+   return true;
+}
+
+void ProcessProgram::storeError(int column)
+{
+   if (mFailOnError)
+   {
+      throw RasterMathException ("Computation error");
+   }
+   mErrors[column] = 1;
+}
+
+/**
+ * Returns the value of a failed operation: NaN when errors propagate as NaN, otherwise the
+ * default value, with the column flagged.
+ */
+double ProcessProgram::errorValue(int column)
+{
+   if (mPropagateNan)
+   {
+      return numeric_limits<double>::quiet_NaN();
+   }
+   storeError(column);
+   return mDefaultValue;
+}
+
+/**
+ * Flags the columns where an operand of the instruction is NaN, for operators whose
+ * result would not be NaN.
+ */
+template<typename T>
+void ProcessProgram::flagNans(const T* pRegisters, const Instruction& instruction, int argCount, int columnCount)
+{
+   for (int arg=0; arg<argCount; ++arg)
+   {
+      const T* pValues = pRegisters+static_cast<size_t>(instruction.mArgs[arg])*columnCount;
+      for (int i=0; i<columnCount; ++i)
+      {
+         mErrors[i] |= static_cast<char>(pValues[i] != pValues[i]);
+      }
+   }
+}
+
+/**
+ * Turns the NaN values and flagged columns of an output row into errors, according to the
+ * failure mode. Only needed when errors propagate as NaN; otherwise errors are stored as they happen.
+ */
+template<typename T>
+void ProcessProgram::maskErrors(const T* pValues)
+{
+   if (!mPropagateNan)
+   {
+      return;
+   }
+   for (int i=0; i<mColumnCount; ++i)
+   {
+      if (mErrors[i] != 0 || pValues[i] != pValues[i])
+      {
+         storeError(i);
+      }
+   }
+}
+
+#define ROW_DEST (pRegisters+static_cast<size_t>(pInstruction->mDest)*columnCount)
+#define ROW_ARG(n) (pRegisters+static_cast<size_t>(pInstruction->mArgs[n])*columnCount)
+
+#define ROW_COMPUTE1(errorChk,func) \
+   { \
+      const T* pValues = ROW_ARG(0); \
+      T* pDest = ROW_DEST; \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         T v1 = pValues[i]; \
+         if (errorChk) \
+         { \
+            pDest[i] = static_cast<T>(errorValue(i)); \
+         } \
+         else \
+         { \
+            pDest[i] = static_cast<T>(func); \
+         } \
+      } \
+   }
+
+#define SAFE_ROW_COMPUTE1(func) \
+   { \
+      const T* pValues = ROW_ARG(0); \
+      T* pDest = ROW_DEST; \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         T v1 = pValues[i]; \
+         pDest[i] = static_cast<T>(func); \
+      } \
+   }
+
+#define ROW_COMPUTE2(errorChk,func) \
+   { \
+      const T* pValues1 = ROW_ARG(1); \
+      const T* pValues2 = ROW_ARG(0); \
+      T* pDest = ROW_DEST; \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         T v1 = pValues1[i]; \
+         T v2 = pValues2[i]; \
+         if (errorChk) \
+         { \
+            pDest[i] = static_cast<T>(errorValue(i)); \
+         } \
+         else \
+         { \
+            pDest[i] = static_cast<T>(func); \
+         } \
+      } \
+   }
+
+// the fast math row functions compute every column, so the columns which fail are found first,
+// and receive the error value once the function has run; the function may overwrite its operands
+#define FAST_ROW_COMPUTE1(errorChk,function) \
+   { \
+      const T* pValues = ROW_ARG(0); \
+      T* pDest = ROW_DEST; \
+      mFailedColumns.clear(); \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         T v1 = pValues[i]; \
+         if (errorChk) \
+         { \
+            mFailedColumns.push_back(i); \
+         } \
+      } \
+      function; \
+      for (vector<int>::const_iterator pColumn=mFailedColumns.begin(); pColumn!=mFailedColumns.end(); ++pColumn) \
+      { \
+         pDest[*pColumn] = static_cast<T>(errorValue(*pColumn)); \
+      } \
+   }
+
+#define FAST_ROW_COMPUTE2(errorChk,function) \
+   { \
+      const T* pValues1 = ROW_ARG(1); \
+      const T* pValues2 = ROW_ARG(0); \
+      T* pDest = ROW_DEST; \
+      mFailedColumns.clear(); \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         T v1 = pValues1[i]; \
+         T v2 = pValues2[i]; \
+         if (errorChk) \
+         { \
+            mFailedColumns.push_back(i); \
+         } \
+      } \
+      function; \
+      for (vector<int>::const_iterator pColumn=mFailedColumns.begin(); pColumn!=mFailedColumns.end(); ++pColumn) \
+      { \
+         pDest[*pColumn] = static_cast<T>(errorValue(*pColumn)); \
+      } \
+   }
+
+// the angle is converted to radians in the destination, which the function then reads
+#define FAST_ROW_TRIG(function) \
+   { \
+      const T* pValues = ROW_ARG(0); \
+      if (mToRadians != 1.0) \
+      { \
+         kernels.multiplyConstant(ROW_DEST, pValues, mToRadians, columnCount); \
+         pValues = ROW_DEST; \
+      } \
+      FastMath::function(ROW_DEST, pValues, columnCount); \
+   }
+
+#define ROW_KERNEL1(kernel) \
+   kernels.kernel(ROW_DEST, ROW_ARG(0), columnCount)
+
+#define ROW_KERNEL2(kernel) \
+   kernels.kernel(ROW_DEST, ROW_ARG(0), ROW_ARG(1), columnCount)
+
+#define ROW_CONSTANT_KERNEL(kernel) \
+   kernels.kernel(ROW_DEST, ROW_ARG(0), pInstruction->mConstants[0], columnCount)
+
+// the statistics accumulate in double precision whatever the precision of the rows, into
+// a partial value for the row which is merged into the row's value so far
+#define ROW_ACCUMULATE(accumulate) \
+   { \
+      ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(*pInstruction->mpStep); \
+      const T* pValues = ROW_ARG(0); \
+      maskErrors(pValues); \
+      StatAccumulator partial = statStep.emptyAccumulator(); \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         if (mErrors[i] == 0) \
+         { \
+            double v1 = pValues[i]; \
+            accumulate; \
+            partial.mCount++; \
+         } \
+      } \
+      statStep.merge(statStep.mRowAccumulator, partial); \
+   }
+
+void ProcessProgram::computeRow(RasterMathProgress& progress)
+{
+   if (mpNative.get() != NULL)
+   {
+      computeNativeRow(progress);
+   }
+   else if (mInteger)
+   {
+      computeIntegerRow();
+   }
+   else if (mSinglePrecision)
+   {
+      computeRow(mFloatRegisters, mColumnCount, progress);
+   }
+   else
+   {
+      computeRow(mRegisters, mColumnCount, progress);
+   }
+}
+
+template<>
+vector<double>& ProcessProgram::registers<double>()
+{
+   return mRegisters;
+}
+
+template<>
+vector<float>& ProcessProgram::registers<float>()
+{
+   return mFloatRegisters;
+}
+
+/**
+ * Evaluates the program for the next columnCount pixels of the row. Only a branch is evaluated
+ * for fewer pixels than the program was compiled for; its registers then hold columnCount values each.
+ */
+template<typename T>
+void ProcessProgram::computeRow(vector<T>& registers, int columnCount, RasterMathProgress& progress)
+{
+   const RasterMathKernels& kernels = RasterMathKernels::instance();
+   const double failedValue = mPropagateNan ? numeric_limits<double>::quiet_NaN() : mDefaultValue; // for the checked kernels
+   T* pRegisters = &registers[0];
+   std::fill(mErrors.begin(), mErrors.begin()+columnCount, 0);
+
+   const Instruction* pEnd = &mInstructions[0]+mInstructions.size();
+   for (const Instruction* pInstruction=&mInstructions[0]; pInstruction!=pEnd; ++pInstruction)
+   {
+      if (mPropagateNan)
+      {
+         flagNans(pRegisters, *pInstruction, droppedNanCount(pInstruction->mType), columnCount);
+      }
+      switch (pInstruction->mType)
+      {
+         case ProcessStep::NUMBER:
+            std::fill(ROW_DEST, ROW_DEST+columnCount, static_cast<T>(*pInstruction->mpValue));
+            break;
+         case ProcessStep::VALUE_RASTER:
+         {
+            ProcessStepRaster& rasterStep = static_cast<ProcessStepRaster&>(*pInstruction->mpStep);
+            if (!rasterStep.readRow(ROW_DEST, columnCount) && mFailOnError)
+            {
+               throw RasterMathException ("Raster column-size mismatch");
+            }
+            if (rasterStep.marksErrors())
+            {
+               T* pDest = ROW_DEST;
+               for (int i=0; i<columnCount; ++i)
+               {
+                  if (ProcessStepRaster::isErrorMarker(pDest[i]))
+                  {
+                     pDest[i] = static_cast<T>(errorValue(i));
+                  }
+               }
+            }
+            break;
+         }
+         case ProcessStep::VALUE_AOI:
+            static_cast<ProcessStepAoi&>(*pInstruction->mpStep).readRow(ROW_DEST, columnCount);
+            break;
+         case ProcessStep::BAND_INVARIANT:
+            // the band-invariant value could not be computed, so every pixel of the band is an error
+            for (int i=0; i<columnCount; ++i)
+            {
+               ROW_DEST[i] = static_cast<T>(errorValue(i));
+            }
+            break;
+         case ProcessStep::ADD:
+            ROW_KERNEL2(add);
+            break;
+         case ProcessStep::SUBTRACT:
+            ROW_KERNEL2(subtract);
+            break;
+         case ProcessStep::MULTIPLY:
+            ROW_KERNEL2(multiply);
+            break;
+         case ProcessStep::DIVIDE:
+            if (kernels.divide(ROW_DEST, ROW_ARG(0), ROW_ARG(1), &mErrors[0], failedValue, columnCount) &&
+               mFailOnError && !mPropagateNan)
+            {
+               throw RasterMathException ("Computation error");
+            }
+            break;
+         case ProcessStep::RESULT_NUMBER:
+         case ProcessStep::RESULT_SIGNATURE:
+         case ProcessStep::RESULT_RASTER:
+            storeResult(*pInstruction, ROW_ARG(0), columnCount);
+            break;
+         case ProcessStep::NEGATE:
+            ROW_KERNEL1(negate);
+            break;
+         case ProcessStep::EXPONENTIATE:
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE2(v1==0.0&&v2==0.0, FastMath::pow(pDest, pValues2, pValues1, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE2(v1==0.0&&v2==0.0, pow(v2, v1));
+            }
+            break;
+         case ProcessStep::ABS:
+            ROW_KERNEL1(abs);
+            break;
+         case ProcessStep::SQRT:
+            ROW_COMPUTE1(v1<0.0, sqrt(v1));
+            break;
+         case ProcessStep::ACOS:
+            ROW_COMPUTE1(v1<-1.0||v1>1.0, acos(v1)/mToRadians);
+            break;
+         case ProcessStep::COS:
+            if (mFastMath)
+            {
+               FAST_ROW_TRIG(cos);
+            }
+            else
+            {
+               SAFE_ROW_COMPUTE1(cos(v1*mToRadians));
+            }
+            break;
+         case ProcessStep::ASIN:
+            ROW_COMPUTE1(v1<-1.0||v1>1.0, asin(v1)/mToRadians);
+            break;
+         case ProcessStep::SIN:
+            if (mFastMath)
+            {
+               FAST_ROW_TRIG(sin);
+            }
+            else
+            {
+               SAFE_ROW_COMPUTE1(sin(v1*mToRadians));
+            }
+            break;
+         case ProcessStep::ATAN:
+            ROW_COMPUTE1(v1==0.0, atan(v1)/mToRadians);
+            break;
+         case ProcessStep::TAN:
+            if (mFastMath)
+            {
+               FAST_ROW_TRIG(tan);
+            }
+            else
+            {
+               SAFE_ROW_COMPUTE1(tan(v1*mToRadians));
+            }
+            break;
+         case ProcessStep::COSH:
+            SAFE_ROW_COMPUTE1(cosh(v1));
+            break;
+         case ProcessStep::SINH:
+            SAFE_ROW_COMPUTE1(sinh(v1));
+            break;
+         case ProcessStep::TANH:
+            SAFE_ROW_COMPUTE1(tanh(v1));
+            break;
+         case ProcessStep::EXP:
+            if (mFastMath)
+            {
+               FastMath::exp(ROW_DEST, ROW_ARG(0), columnCount);
+            }
+            else
+            {
+               SAFE_ROW_COMPUTE1(exp(v1));
+            }
+            break;
+         case ProcessStep::LOG10:
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE1(v1<=0.0, FastMath::log10(pDest, pValues, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE1(v1<=0.0, log10(v1));
+            }
+            break;
+         case ProcessStep::LOG2:
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE1(v1<=0.0, FastMath::log2(pDest, pValues, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE1(v1<=0.0, log10(v1)/log10(2.0));
+            }
+            break;
+         case ProcessStep::LOG:
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE1(v1<=0.0, FastMath::log(pDest, pValues, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE1(v1<=0.0, ::log(v1));
+            }
+            break;
+         case ProcessStep::ATAN2:
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE2(v1==0.0&&v2==0.0, FastMath::atan2(pDest, pValues2, pValues1, columnCount);
+                  kernels.multiplyConstant(pDest, pDest, 1.0/mToRadians, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE2(v1==0.0&&v2==0.0, atan2(v2, v1)/mToRadians);
+            }
+            break;
+         case ProcessStep::LOGN:
+            ROW_COMPUTE2(v1<=0.0||v2<=0.0, mFastMath ? FastMath::log(v2)/FastMath::log(v1) : log10(v2)/log10(v1));
+            break;
+         case ProcessStep::MODULO:
+            ROW_COMPUTE2(v1==0.0, fmod(v2, v1));
+            break;
+         case ProcessStep::LESS_THAN:
+            ROW_KERNEL2(lessThan);
+            break;
+         case ProcessStep::GREATER_THAN:
+            ROW_KERNEL2(greaterThan);
+            break;
+         case ProcessStep::LESS_OR_EQUAL:
+            ROW_KERNEL2(lessOrEqual);
+            break;
+         case ProcessStep::GREATER_OR_EQUAL:
+            ROW_KERNEL2(greaterOrEqual);
+            break;
+         case ProcessStep::EQUALS:
+            ROW_KERNEL2(equals);
+            break;
+         case ProcessStep::NOT_EQUALS:
+            ROW_KERNEL2(notEquals);
+            break;
+         case ProcessStep::NOT:
+            ROW_KERNEL1(logicalNot);
+            break;
+         case ProcessStep::AND:
+            ROW_KERNEL2(logicalAnd);
+            break;
+         case ProcessStep::OR:
+            ROW_KERNEL2(logicalOr);
+            break;
+         case ProcessStep::CLAMP:
+            kernels.clamp(ROW_DEST, ROW_ARG(0), ROW_ARG(1), ROW_ARG(2), columnCount);
+            break;
+         case ProcessStep::NORMALIZED_DIFFERENCE:
+            if (kernels.normalizedDifference(ROW_DEST, ROW_ARG(0), ROW_ARG(1), &mErrors[0], failedValue, columnCount) &&
+               mFailOnError && !mPropagateNan)
+            {
+               throw RasterMathException ("Computation error");
+            }
+            break;
+         case ProcessStep::AFFINE:
+            kernels.affine(ROW_DEST, ROW_ARG(0), pInstruction->mConstants[0], pInstruction->mConstants[1], columnCount);
+            break;
+         case ProcessStep::ADD_CONSTANT:
+            ROW_CONSTANT_KERNEL(addConstant);
+            break;
+         case ProcessStep::MULTIPLY_CONSTANT:
+            ROW_CONSTANT_KERNEL(multiplyConstant);
+            break;
+         case ProcessStep::LESS_THAN_CONSTANT:
+            ROW_CONSTANT_KERNEL(lessThanConstant);
+            break;
+         case ProcessStep::GREATER_THAN_CONSTANT:
+            ROW_CONSTANT_KERNEL(greaterThanConstant);
+            break;
+         case ProcessStep::LESS_OR_EQUAL_CONSTANT:
+            ROW_CONSTANT_KERNEL(lessOrEqualConstant);
+            break;
+         case ProcessStep::GREATER_OR_EQUAL_CONSTANT:
+            ROW_CONSTANT_KERNEL(greaterOrEqualConstant);
+            break;
+         case ProcessStep::EQUALS_CONSTANT:
+            ROW_CONSTANT_KERNEL(equalsConstant);
+            break;
+         case ProcessStep::NOT_EQUALS_CONSTANT:
+            ROW_CONSTANT_KERNEL(notEqualsConstant);
+            break;
+         case ProcessStep::INTEGER_POWER:
+         {
+            int exponent = static_cast<int>(pInstruction->mConstants[0]);
+            SAFE_ROW_COMPUTE1(RasterMathKernels::integerPower(v1, exponent));
+            break;
+         }
+         case ProcessStep::HALF_POWER:
+            SAFE_ROW_COMPUTE1(sqrt(v1));
+            break;
+         case ProcessStep::SCALED_LOG10:
+         {
+            double scale = pInstruction->mConstants[0];
+            if (mFastMath)
+            {
+               FAST_ROW_COMPUTE1(v1<=0.0, FastMath::log10(pDest, pValues, columnCount);
+                  kernels.multiplyConstant(pDest, pDest, scale, columnCount));
+            }
+            else
+            {
+               ROW_COMPUTE1(v1<=0.0, log10(v1)*scale);
+            }
+            break;
+         }
+         case ProcessStep::BAND_MIN:
+         case ProcessStep::BAND_MAX:
+         case ProcessStep::BAND_SUM:
+         case ProcessStep::BAND_MEAN:
+         case ProcessStep::BAND_GEOMEAN:
+         case ProcessStep::BAND_HARMEAN:
+         case ProcessStep::BAND_STDDEV:
+         {
+            // the statistic is computed on first use, after which the step holds its value
+            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(*pInstruction->mpStep);
+            if (statStep.mStepType != ProcessStep::COMPUTED_SIGNATURE)
+            {
+               statStep.execute(progress);
+            }
+            std::fill(ROW_DEST, ROW_DEST+columnCount, static_cast<T>(statStep.mValue));
+            break;
+         }
+         case ProcessStep::BAND_MIN_ACCUM:
+            ROW_ACCUMULATE(partial.mValue = min(partial.mValue, v1));
+            break;
+         case ProcessStep::BAND_MAX_ACCUM:
+            ROW_ACCUMULATE(partial.mValue = max(partial.mValue, v1));
+            break;
+         case ProcessStep::BAND_SUM_ACCUM:
+         case ProcessStep::BAND_MEAN_ACCUM:
+            ROW_ACCUMULATE(partial.mValue += v1);
+            break;
+         case ProcessStep::BAND_GEOMEAN_ACCUM:
+         case ProcessStep::BAND_HARMEAN_ACCUM:
+         {
+            // the logarithms of negative values and the reciprocal of zero are errors
+            bool geometric = (pInstruction->mType == ProcessStep::BAND_GEOMEAN_ACCUM);
+            const T* pValues = ROW_ARG(0);
+            for (int i=0; i<columnCount; ++i)
+            {
+               if (geometric ? pValues[i] < 0.0 : pValues[i] == 0.0)
+               {
+                  storeError(i);
+               }
+            }
+            ROW_ACCUMULATE(partial.mValue += geometric ? log(v1) : 1.0/v1);
+            break;
+         }
+         case ProcessStep::BAND_STDDEV_ACCUM:
+         {
+            // the mean of the row, and then the squared deviations from it
+            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(*pInstruction->mpStep);
+            const T* pValues = ROW_ARG(0);
+            maskErrors(pValues);
+            StatAccumulator partial;
+            for (int i=0; i<columnCount; ++i)
+            {
+               if (mErrors[i] == 0)
+               {
+                  partial.mValue += pValues[i];
+                  partial.mCount++;
+               }
+            }
+            if (partial.mCount > 0.0)
+            {
+               partial.mValue /= partial.mCount;
+               for (int i=0; i<columnCount; ++i)
+               {
+                  if (mErrors[i] == 0)
+                  {
+                     double deviation = pValues[i] - partial.mValue;
+                     partial.mDeviations += deviation*deviation;
+                  }
+               }
+            }
+            statStep.merge(statStep.mRowAccumulator, partial);
+            break;
+         }
+         case ProcessStep::CONDITIONAL:
+            computeConditional(pRegisters, *pInstruction, columnCount, progress);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+/**
+ * Evaluates each branch of a conditional over the runs of adjacent columns which take it, while
+ * the inputs of the other branch skip those columns. The errors of a branch are its columns' errors.
+ */
+template<typename T>
+void ProcessProgram::computeConditional(T* pRegisters, const Instruction& instruction, int columnCount,
+                                        RasterMathProgress& progress)
+{
+   const T* pConditions = pRegisters+static_cast<size_t>(instruction.mArgs[0])*columnCount;
+   T* pDest = pRegisters+static_cast<size_t>(instruction.mDest)*columnCount; // may be the conditions' register
+   const ProcessStepConditional& conditionalStep = static_cast<const ProcessStepConditional&>(*instruction.mpStep);
+   int start = 0;
+   while (start < columnCount)
+   {
+      bool condition = (pConditions[start] != 0);
+      int end = start+1;
+      while (end < columnCount && (pConditions[end] != 0) == condition)
+      {
+         ++end;
+      }
+      int count = end-start;
+
+      ProcessStepConditional::skipBranch(condition ? conditionalStep.mFalseStack : conditionalStep.mTrueStack, count);
+      ProcessProgram& branch = *RM_NULLCHK(instruction.mpBranches[condition ? 0 : 1]);
+      vector<T>& branchRegisters = branch.registers<T>();
+      branch.computeRow(branchRegisters, count, progress);
+      const T* pValues = &branchRegisters[0]+static_cast<size_t>(branch.mResultRegister)*count;
+      std::copy(pValues, pValues+count, pDest+start);
+      for (int i=0; i<count; ++i)
+      {
+         mErrors[start+i] |= branch.mErrors[i];
+      }
+      start = end;
+   }
+}
+
+/**
+ * Stores a row of values, with the errors of its columns, in a result step.
+ */
+template<typename T>
+void ProcessProgram::storeResult(const Instruction& instruction, T* pValues, int columnCount)
+{
+   maskErrors(pValues);
+   switch (instruction.mType)
+   {
+      case ProcessStep::RESULT_NUMBER:
+         instruction.mpStep->mValue = (mErrors[columnCount-1] != 0) ? mDefaultValue : pValues[columnCount-1];
+         break;
+      case ProcessStep::RESULT_SIGNATURE:
+      {
+         ProcessStepSignature& sigStep = static_cast<ProcessStepSignature&>(*instruction.mpStep);
+         for (int i=0; i<columnCount; ++i)
+         {
+            sigStep.mValues.push_back(mErrors[i] != 0 ? mDefaultValue : pValues[i]);
+         }
+         break;
+      }
+      case ProcessStep::RESULT_RASTER:
+         for (int i=0; i<columnCount; ++i)
+         {
+            if (mErrors[i] != 0)
+            {
+               pValues[i] = static_cast<T>(mDefaultValue);
+            }
+         }
+         static_cast<ProcessStepRaster&>(*instruction.mpStep).writeRow(pValues, columnCount);
+         break;
+      default:
+         break;
+   }
+}
+
+// v2 is the left operand and v1 the right operand, as in the double kernels
+#define INTEGER_ROW_COMPUTE1(func) \
+   { \
+      const int* pValues = ROW_ARG(0); \
+      int* pDest = ROW_DEST; \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         int v1 = pValues[i]; \
+         pDest[i] = func; \
+      } \
+   }
+
+#define INTEGER_ROW_COMPUTE2(func) \
+   { \
+      const int* pValues1 = ROW_ARG(1); \
+      const int* pValues2 = ROW_ARG(0); \
+      int* pDest = ROW_DEST; \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         int v1 = pValues1[i]; \
+         int v2 = pValues2[i]; \
+         pDest[i] = func; \
+      } \
+   }
+
+#define INTEGER_ROW_COMPARE_CONSTANT(func) \
+   { \
+      const int* pValues = ROW_ARG(0); \
+      int* pDest = ROW_DEST; \
+      int v1 = static_cast<int>(pInstruction->mConstants[0]); \
+      for (int i=0; i<columnCount; ++i) \
+      { \
+         int v2 = pValues[i]; \
+         pDest[i] = func; \
+      } \
+   }
+
+/**
+ * Evaluates a program which fitsIntegers(). None of its operations can fail.
+ */
+void ProcessProgram::computeIntegerRow()
+{
+   const RasterMathKernels& kernels = RasterMathKernels::instance();
+   const int columnCount = mColumnCount;
+   int* pRegisters = &mIntegerRegisters[0];
+
+   const Instruction* pEnd = &mInstructions[0]+mInstructions.size();
+   for (const Instruction* pInstruction=&mInstructions[0]; pInstruction!=pEnd; ++pInstruction)
+   {
+      switch (pInstruction->mType)
+      {
+         case ProcessStep::NUMBER:
+            std::fill(ROW_DEST, ROW_DEST+columnCount, static_cast<int>(*pInstruction->mpValue));
+            break;
+         case ProcessStep::VALUE_RASTER:
+         {
+            ProcessStepRaster& rasterStep = static_cast<ProcessStepRaster&>(*pInstruction->mpStep);
+            if (!rasterStep.readRow(ROW_DEST, columnCount) && mFailOnError)
+            {
+               throw RasterMathException ("Raster column-size mismatch");
+            }
+            break;
+         }
+         case ProcessStep::RESULT_RASTER:
+            static_cast<ProcessStepRaster&>(*pInstruction->mpStep).writeRow(ROW_ARG(0), columnCount);
+            break;
+         case ProcessStep::ADD:
+            ROW_KERNEL2(add);
+            break;
+         case ProcessStep::SUBTRACT:
+            ROW_KERNEL2(subtract);
+            break;
+         case ProcessStep::MULTIPLY:
+            ROW_KERNEL2(multiply);
+            break;
+         case ProcessStep::NEGATE:
+            INTEGER_ROW_COMPUTE1(-v1);
+            break;
+         case ProcessStep::ABS:
+            INTEGER_ROW_COMPUTE1(v1 < 0 ? -v1 : v1);
+            break;
+         case ProcessStep::ADD_CONSTANT:
+            kernels.addConstant(ROW_DEST, ROW_ARG(0), static_cast<int>(pInstruction->mConstants[0]), columnCount);
+            break;
+         case ProcessStep::MULTIPLY_CONSTANT:
+            kernels.multiplyConstant(ROW_DEST, ROW_ARG(0), static_cast<int>(pInstruction->mConstants[0]), columnCount);
+            break;
+         case ProcessStep::AFFINE:
+            kernels.affine(ROW_DEST, ROW_ARG(0), static_cast<int>(pInstruction->mConstants[0]),
+               static_cast<int>(pInstruction->mConstants[1]), columnCount);
+            break;
+         case ProcessStep::LESS_THAN:
+            INTEGER_ROW_COMPUTE2(v2<v1);
+            break;
+         case ProcessStep::GREATER_THAN:
+            INTEGER_ROW_COMPUTE2(v2>v1);
+            break;
+         case ProcessStep::LESS_OR_EQUAL:
+            INTEGER_ROW_COMPUTE2(v2<=v1);
+            break;
+         case ProcessStep::GREATER_OR_EQUAL:
+            INTEGER_ROW_COMPUTE2(v2>=v1);
+            break;
+         case ProcessStep::EQUALS:
+            INTEGER_ROW_COMPUTE2(v2==v1);
+            break;
+         case ProcessStep::NOT_EQUALS:
+            INTEGER_ROW_COMPUTE2(v2!=v1);
+            break;
+         case ProcessStep::LESS_THAN_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2<v1);
+            break;
+         case ProcessStep::GREATER_THAN_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2>v1);
+            break;
+         case ProcessStep::LESS_OR_EQUAL_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2<=v1);
+            break;
+         case ProcessStep::GREATER_OR_EQUAL_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2>=v1);
+            break;
+         case ProcessStep::EQUALS_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2==v1);
+            break;
+         case ProcessStep::NOT_EQUALS_CONSTANT:
+            INTEGER_ROW_COMPARE_CONSTANT(v2!=v1);
+            break;
+         case ProcessStep::NOT:
+            INTEGER_ROW_COMPUTE1(v1==0);
+            break;
+         case ProcessStep::AND:
+            INTEGER_ROW_COMPUTE2(v2!=0 && v1!=0);
+            break;
+         case ProcessStep::OR:
+            INTEGER_ROW_COMPUTE2(v2!=0 || v1!=0);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+namespace
+{
+   // the default value and the degree conversion come first in the native constants,
+   // followed by the value and the two fused constants of each instruction
+   const int NATIVE_SETTINGS = 2;
+
+   string nativeConstant(size_t index, int slot)
+   {
+      ostringstream constant;
+      constant << "pConstants[" << NATIVE_SETTINGS+3*index+slot << "]";
+      return constant.str();
+   }
+
+   // a value whose operation fails when check holds
+   void nativeChecked(ostream& code, const string& name, const string& check, const string& expression)
+   {
+      code << "      double " << name << ";\n"
+           << "      if (" << check << ")\n"
+           << "      {\n"
+           << "         pErrors[i] = 1;\n"
+           << "         failed = 1;\n"
+           << "         " << name << " = defaultValue;\n"
+           << "      }\n"
+           << "      else\n"
+           << "      {\n"
+           << "         " << name << " = " << expression << ";\n"
+           << "      }\n";
+   }
+}
+
+/**
+ * Translates the program to the C++ source of a NativeProgram, in which each instruction
+ * computes one local variable from those of its operands. The operations are written as they are
+ * in computeRow(), with the left operand a and the right operand b.
+ *
+ * @return the source, or an empty string if the program cannot be translated.
+ */
+string ProcessProgram::nativeSource() const
+{
+   if (mInteger || mSinglePrecision || mPropagateNan || mFastMath)
+   {
+      return string();
+   }
+
+   ostringstream body;
+   vector<string> names(mRegisterCount); // the variable holding the value of each register
+   int inputCount = 0;
+   for (size_t index=0; index<mInstructions.size(); ++index)
+   {
+      const Instruction& instruction = mInstructions[index];
+      const string& a = names[instruction.mArgs[0]];
+      const string& b = names[instruction.mArgs[1]];
+      const string& c = names[instruction.mArgs[2]];
+      const string c0 = nativeConstant(index, 1);
+      const string c1 = nativeConstant(index, 2);
+      ostringstream nameStream;
+      nameStream << "v" << index;
+      const string name = nameStream.str();
+
+      string expression;
+      switch (instruction.mType)
+      {
+         case ProcessStep::NUMBER:
+         case ProcessStep::BAND_MIN:
+         case ProcessStep::BAND_MAX:
+         case ProcessStep::BAND_SUM:
+         case ProcessStep::BAND_MEAN:
+         case ProcessStep::BAND_GEOMEAN:
+         case ProcessStep::BAND_HARMEAN:
+         case ProcessStep::BAND_STDDEV:
+            expression = nativeConstant(index, 0);
+            break;
+         case ProcessStep::VALUE_RASTER:
+         case ProcessStep::VALUE_AOI:
+         {
+            if (instruction.mType == ProcessStep::VALUE_RASTER &&
+               static_cast<const ProcessStepRaster&>(*instruction.mpStep).marksErrors())
+            {
+               return string(); // the native code has no error checks of its own inputs
+            }
+            ostringstream input;
+            input << "pInputs[static_cast<size_t>(" << inputCount++ << ")*columnCount+i]";
+            expression = input.str();
+            break;
+         }
+         case ProcessStep::RESULT_NUMBER:
+         case ProcessStep::RESULT_SIGNATURE:
+         case ProcessStep::RESULT_RASTER:
+            body << "      pRegisters[static_cast<size_t>(" << instruction.mArgs[0] << ")*columnCount+i] = " << a << ";\n";
+            continue;
+         case ProcessStep::ADD:
+            expression = a+"+"+b;
+            break;
+         case ProcessStep::SUBTRACT:
+            expression = a+"-"+b;
+            break;
+         case ProcessStep::MULTIPLY:
+            expression = a+"*"+b;
+            break;
+         case ProcessStep::DIVIDE:
+            nativeChecked(body, name, b+"==0.0", a+"/"+b);
+            break;
+         case ProcessStep::NEGATE:
+            expression = "-"+a;
+            break;
+         case ProcessStep::EXPONENTIATE:
+            nativeChecked(body, name, b+"==0.0&&"+a+"==0.0", "pow("+a+", "+b+")");
+            break;
+         case ProcessStep::ABS:
+            expression = "fabs("+a+")";
+            break;
+         case ProcessStep::SQRT:
+            nativeChecked(body, name, a+"<0.0", "sqrt("+a+")");
+            break;
+         case ProcessStep::ACOS:
+            nativeChecked(body, name, a+"<-1.0||"+a+">1.0", "acos("+a+")/toRadians");
+            break;
+         case ProcessStep::COS:
+            expression = "cos("+a+"*toRadians)";
+            break;
+         case ProcessStep::ASIN:
+            nativeChecked(body, name, a+"<-1.0||"+a+">1.0", "asin("+a+")/toRadians");
+            break;
+         case ProcessStep::SIN:
+            expression = "sin("+a+"*toRadians)";
+            break;
+         case ProcessStep::ATAN:
+            nativeChecked(body, name, a+"==0.0", "atan("+a+")/toRadians");
+            break;
+         case ProcessStep::TAN:
+            expression = "tan("+a+"*toRadians)";
+            break;
+         case ProcessStep::COSH:
+            expression = "cosh("+a+")";
+            break;
+         case ProcessStep::SINH:
+            expression = "sinh("+a+")";
+            break;
+         case ProcessStep::TANH:
+            expression = "tanh("+a+")";
+            break;
+         case ProcessStep::EXP:
+            expression = "exp("+a+")";
+            break;
+         case ProcessStep::LOG10:
+            nativeChecked(body, name, a+"<=0.0", "log10("+a+")");
+            break;
+         case ProcessStep::LOG2:
+            nativeChecked(body, name, a+"<=0.0", "log10("+a+")/log10(2.0)");
+            break;
+         case ProcessStep::LOG:
+            nativeChecked(body, name, a+"<=0.0", "log("+a+")");
+            break;
+         case ProcessStep::ATAN2:
+            nativeChecked(body, name, b+"==0.0&&"+a+"==0.0", "atan2("+a+", "+b+")/toRadians");
+            break;
+         case ProcessStep::LOGN:
+            nativeChecked(body, name, b+"<=0.0||"+a+"<=0.0", "log10("+a+")/log10("+b+")");
+            break;
+         case ProcessStep::MODULO:
+            nativeChecked(body, name, b+"==0.0", "fmod("+a+", "+b+")");
+            break;
+         case ProcessStep::LESS_THAN:
+            expression = "static_cast<double>("+a+"<"+b+")";
+            break;
+         case ProcessStep::GREATER_THAN:
+            expression = "static_cast<double>("+a+">"+b+")";
+            break;
+         case ProcessStep::LESS_OR_EQUAL:
+            expression = "static_cast<double>("+a+"<="+b+")";
+            break;
+         case ProcessStep::GREATER_OR_EQUAL:
+            expression = "static_cast<double>("+a+">="+b+")";
+            break;
+         case ProcessStep::EQUALS:
+            expression = "static_cast<double>("+a+"=="+b+")";
+            break;
+         case ProcessStep::NOT_EQUALS:
+            expression = "static_cast<double>("+a+"!="+b+")";
+            break;
+         case ProcessStep::NOT:
+            expression = "static_cast<double>("+a+"==0.0)";
+            break;
+         case ProcessStep::AND:
+            expression = "static_cast<double>("+a+"!=0.0 && "+b+"!=0.0)";
+            break;
+         case ProcessStep::OR:
+            expression = "static_cast<double>("+a+"!=0.0 || "+b+"!=0.0)";
+            break;
+         case ProcessStep::CLAMP:
+            // the value, the low bound and the high bound
+            expression = "std::max("+b+", std::min("+a+", "+c+"))";
+            break;
+         case ProcessStep::NORMALIZED_DIFFERENCE:
+            body << "      const double " << name << "Sum = " << a << "+" << b << ";\n";
+            nativeChecked(body, name, name+"Sum==0.0", "("+a+"-"+b+")/"+name+"Sum");
+            break;
+         case ProcessStep::AFFINE:
+            expression = a+"*"+c0+"+"+c1;
+            break;
+         case ProcessStep::ADD_CONSTANT:
+            expression = a+"+"+c0;
+            break;
+         case ProcessStep::MULTIPLY_CONSTANT:
+            expression = a+"*"+c0;
+            break;
+         case ProcessStep::LESS_THAN_CONSTANT:
+            expression = "static_cast<double>("+a+"<"+c0+")";
+            break;
+         case ProcessStep::GREATER_THAN_CONSTANT:
+            expression = "static_cast<double>("+a+">"+c0+")";
+            break;
+         case ProcessStep::LESS_OR_EQUAL_CONSTANT:
+            expression = "static_cast<double>("+a+"<="+c0+")";
+            break;
+         case ProcessStep::GREATER_OR_EQUAL_CONSTANT:
+            expression = "static_cast<double>("+a+">="+c0+")";
+            break;
+         case ProcessStep::EQUALS_CONSTANT:
+            expression = "static_cast<double>("+a+"=="+c0+")";
+            break;
+         case ProcessStep::NOT_EQUALS_CONSTANT:
+            expression = "static_cast<double>("+a+"!="+c0+")";
+            break;
+         case ProcessStep::INTEGER_POWER:
+            expression = "integerPower("+a+", static_cast<int>("+c0+"))";
+            break;
+         case ProcessStep::HALF_POWER:
+            expression = "sqrt("+a+")";
+            break;
+         case ProcessStep::SCALED_LOG10:
+            nativeChecked(body, name, a+"<=0.0", "log10("+a+")*"+c0);
+            break;
+         default:
+            // conditionals, accumulators and failed band-invariant values
+            return string();
+      }
+      if (!expression.empty())
+      {
+         body << "      const double " << name << " = " << expression << ";\n";
+      }
+      names[instruction.mDest] = name;
+   }
+
+   ostringstream source;
+   source << "#include <algorithm>\n"
+          << "#include <math.h>\n"
+          << "#include <stddef.h>\n"
+          << "\n"
+          << "#if defined(_WIN32)\n"
+          << "#define RM_EXPORT extern \"C\" __declspec(dllexport)\n"
+          << "#else\n"
+          << "#define RM_EXPORT extern \"C\"\n"
+          << "#endif\n"
+          << "\n"
+          << "static double integerPower(double value, int exponent)\n"
+          << "{\n"
+          << "   double result = 1.0;\n"
+          << "   double base = value;\n"
+          << "   for (int bits=(exponent < 0) ? -exponent : exponent; bits!=0; bits>>=1)\n"
+          << "   {\n"
+          << "      if ((bits & 1) != 0)\n"
+          << "      {\n"
+          << "         result *= base;\n"
+          << "      }\n"
+          << "      base *= base;\n"
+          << "   }\n"
+          << "   return (exponent < 0) ? 1.0/result : result;\n"
+          << "}\n"
+          << "\n"
+          << "RM_EXPORT int " << NativeProgram::FUNCTION_NAME << "(const double* pInputs, const double* pConstants,\n"
+          << "   double* pRegisters, char* pErrors, int columnCount)\n"
+          << "{\n"
+          << "   const double defaultValue = pConstants[0];\n"
+          << "   const double toRadians = pConstants[1];\n"
+          << "   int failed = 0;\n"
+          << "   for (int i=0; i<columnCount; ++i)\n"
+          << "   {\n"
+          << body.str()
+          << "   }\n"
+          << "   return failed;\n"
+          << "}\n";
+   return source.str();
+}
+
+void ProcessProgram::loadNative(const string& cacheDirectory)
+{
+   string source = nativeSource();
+   if (source.empty())
+   {
+      return;
+   }
+   mpNative = NativeProgram::load(source, cacheDirectory);
+   if (mpNative.get() == NULL)
+   {
+      return;
+   }
+
+   int inputCount = 0;
+   mNativeConstants.assign(NATIVE_SETTINGS+3*mInstructions.size(), 0.0);
+   mNativeConstants[0] = mDefaultValue;
+   mNativeConstants[1] = mToRadians;
+   for (size_t index=0; index<mInstructions.size(); ++index)
+   {
+      const Instruction& instruction = mInstructions[index];
+      if (instruction.mType == ProcessStep::VALUE_RASTER || instruction.mType == ProcessStep::VALUE_AOI)
+      {
+         ++inputCount;
+      }
+      mNativeConstants[NATIVE_SETTINGS+3*index+1] = instruction.mConstants[0];
+      mNativeConstants[NATIVE_SETTINGS+3*index+2] = instruction.mConstants[1];
+   }
+   mNativeInputs.assign(static_cast<size_t>(inputCount)*mColumnCount, 0.0);
+}
+
+/**
+ * Evaluates a program which has been loaded as native code: reads the inputs and the values
+ * of the numbers and statistics, runs the native function, then stores the results.
+ */
+void ProcessProgram::computeNativeRow(RasterMathProgress& progress)
+{
+   const int columnCount = mColumnCount;
+   double* pRegisters = &mRegisters[0];
+   double* pInputs = mNativeInputs.empty() ? NULL : &mNativeInputs[0];
+
+   const Instruction* pBegin = &mInstructions[0];
+   const Instruction* pEnd = pBegin+mInstructions.size();
+   for (const Instruction* pInstruction=pBegin; pInstruction!=pEnd; ++pInstruction)
+   {
+      switch (pInstruction->mType)
+      {
+         case ProcessStep::VALUE_RASTER:
+         {
+            ProcessStepRaster& rasterStep = static_cast<ProcessStepRaster&>(*pInstruction->mpStep);
+            if (!rasterStep.readRow(pInputs, columnCount) && mFailOnError)
+            {
+               throw RasterMathException ("Raster column-size mismatch");
+            }
+            pInputs += columnCount;
+            break;
+         }
+         case ProcessStep::VALUE_AOI:
+            static_cast<ProcessStepAoi&>(*pInstruction->mpStep).readRow(pInputs, columnCount);
+            pInputs += columnCount;
+            break;
+         case ProcessStep::BAND_MIN:
+         case ProcessStep::BAND_MAX:
+         case ProcessStep::BAND_SUM:
+         case ProcessStep::BAND_MEAN:
+         case ProcessStep::BAND_GEOMEAN:
+         case ProcessStep::BAND_HARMEAN:
+         case ProcessStep::BAND_STDDEV:
+         {
+            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(*pInstruction->mpStep);
+            if (statStep.mStepType != ProcessStep::COMPUTED_SIGNATURE)
+            {
+               statStep.execute(progress);
+            }
+            break;
+         }
+         default:
+            break;
+      }
+      mNativeConstants[NATIVE_SETTINGS+3*(pInstruction-pBegin)] = *pInstruction->mpValue;
+   }
+
+   std::fill(mErrors.begin(), mErrors.end(), 0);
+   if (mpNative->computeRow(mNativeInputs.empty() ? NULL : &mNativeInputs[0], &mNativeConstants[0], pRegisters,
+      &mErrors[0], columnCount) != 0 && mFailOnError)
+   {
+      throw RasterMathException ("Computation error");
+   }
+   for (const Instruction* pInstruction=pBegin; pInstruction!=pEnd; ++pInstruction)
+   {
+      if (ProcessStep::isSink(pInstruction->mType))
+      {
+         storeResult(*pInstruction, ROW_ARG(0), columnCount);
+      }
+   }
+}
@@ -0,0 +1,147 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef PROCESSPROGRAM_H
+#define PROCESSPROGRAM_H
+
+#include "ProcessStep.h"
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+class NativeProgram;
+class RasterMathProgress;
+
+/**
+ * A ProcessStack's steps lowered into a flat array of three-address instructions.
+ *
+ * Each instruction reads and writes registers, where a register holds one row of values.
+ * Registers are assigned when the program is compiled: one per working stack slot, plus one
+ * for every step whose value is reused by a REFERENCE step, so references cost nothing
+ * at run time. The steps must outlive the program.
+ *
+ * After lowering, common formula shapes are fused into single instructions: operations with a
+ * NUMBER operand, affine rescales such as a*r1+b, and normalized differences such as
+ * (r1[4]-r1[3])/(r1[4]+r1[3]). Band-invariant values are fused like numbers, so a program with
+ * BAND_INVARIANT steps is only valid for the band it was compiled for.
+ *
+ * The branches of a CONDITIONAL step are compiled into programs of their own. Each branch is run
+ * over the runs of adjacent columns which take it, so it never computes the other columns.
+ *
+ * A program can also be translated to C++ and run as a NativeProgram, which computes all of its
+ * instructions for one pixel before moving to the next.
+ */
+class ProcessProgram
+{
+public:
+   ProcessProgram(const std::vector<boost::shared_ptr<ProcessStep> >& steps, int columnCount,
+      bool failOnError, double defaultValue, double toRadians, bool propagateNan, bool singlePrecision, bool fastMath);
+
+   /**
+    * Evaluates the program for the next row of pixels.
+    *
+    * This is equivalent to calling ProcessStack::compute() once per pixel. Pixels which hit
+    * a computation error are flagged and receive the default value when the result is stored.
+    *
+    * When NaN propagation is enabled, failed operations produce NaN instead of flagging their
+    * pixels, and the NaN flows through the following instructions. Each result or statistic
+    * then treats every NaN it receives as an error, in one pass over the row. Operators which
+    * would drop a NaN, such as comparisons, flag their NaN operands instead. In this mode a NaN
+    * read from a raster is an error too.
+    *
+    * In single precision, the registers hold floats and every instruction computes in float,
+    * except for the statistic accumulators, which stay double.
+    *
+    * A program which only adds, subtracts, multiplies and compares 8-bit and 16-bit integer rasters
+    * and integer constants into an integer result computes in 32-bit integers instead, whatever the
+    * precision, when range analysis shows that no value can overflow. Its results are exact, so they
+    * are the same as in double precision.
+    *
+    * With fast math, the transcendental functions use the FastMath row functions, in the
+    * precision of the registers.
+    */
+   void computeRow(RasterMathProgress& progress);
+
+   /**
+    * Runs the program as native code from now on, compiling it into cacheDirectory if it has not
+    * been compiled before. Only double precision programs without conditionals or band statistic
+    * accumulators, which flag their errors rather than propagating NaN and use the C library's
+    * functions, are translated; the others, or a program which cannot be compiled, stay interpreted.
+    *
+    * The native code computes exactly what the interpreter does. The values of numbers, fused
+    * constants and band statistics are passed to it for each row, so one library serves every
+    * band and every value of those constants.
+    */
+   void loadNative(const std::string& cacheDirectory);
+
+   int registerCount() const { return mRegisterCount; }
+
+private:
+   struct Instruction
+   {
+      ProcessStep::StepType mType;
+      unsigned short mDest;
+      unsigned short mArgs[3]; // deepest stack entry, i.e. the leftmost operand, first
+      ProcessStep* mpStep;
+      const double* mpValue;
+      double mConstants[2]; // the scalar operands of fused instructions
+      ProcessProgram* mpBranches[2]; // the programs of a CONDITIONAL's branches
+   };
+
+   ProcessProgram(const ProcessProgram& program, const std::vector<boost::shared_ptr<ProcessStep> >& steps);
+   void allocateRegisters();
+   void compile(const std::vector<boost::shared_ptr<ProcessStep> >& steps);
+   void fuse();
+   bool fuseInstruction(size_t& index);
+   int findProducer(size_t index, unsigned short reg) const;
+   bool isConstant(int index) const;
+   void storeError(int column);
+   double errorValue(int column);
+   template<typename T>
+   std::vector<T>& registers();
+   template<typename T>
+   void computeRow(std::vector<T>& registers, int columnCount, RasterMathProgress& progress);
+   template<typename T>
+   void computeConditional(T* pRegisters, const Instruction& instruction, int columnCount, RasterMathProgress& progress);
+   template<typename T>
+   void flagNans(const T* pRegisters, const Instruction& instruction, int argCount, int columnCount);
+   template<typename T>
+   void maskErrors(const T* pValues);
+   template<typename T>
+   void storeResult(const Instruction& instruction, T* pValues, int columnCount);
+   bool fitsIntegers() const;
+   void computeIntegerRow();
+   std::string nativeSource() const;
+   void computeNativeRow(RasterMathProgress& progress);
+
+   std::vector<Instruction> mInstructions;
+   int mColumnCount;
+   int mRegisterCount;
+   int mStackRegisterCount;
+   unsigned short mResultRegister; // the value left by a program without a result step, such as a branch
+   bool mFailOnError;
+   double mDefaultValue;
+   double mToRadians;
+   bool mPropagateNan;
+   bool mSinglePrecision;
+   bool mFastMath;
+   bool mInteger;
+   std::vector<double> mRegisters; // only one of mRegisters, mFloatRegisters and mIntegerRegisters is allocated
+   std::vector<float> mFloatRegisters;
+   std::vector<int> mIntegerRegisters;
+   std::vector<char> mErrors;
+   std::vector<int> mFailedColumns; // the columns where a fast math function fails
+   std::vector<boost::shared_ptr<ProcessProgram> > mBranches;
+   boost::shared_ptr<NativeProgram> mpNative;
+   std::vector<double> mNativeInputs; // the rows of the raster and AOI inputs, in the order of the program
+   std::vector<double> mNativeConstants;
+};
+
+#endif
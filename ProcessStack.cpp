@@ -11,20 +11,40 @@
 #include "DataRequest.h"
 #include "DataVariant.h"
 #include "DimensionDescriptor.h"
+#include "FastMath.h"
+#include "ProcessProgram.h"
 #include "ProcessStack.h"
+#include "ProcessStepConditional.h"
+#include "ProcessStepInvariant.h"
 #include "ProcessStepStatFunc.h"
 #include "RasterCorrelator.h"
 #include "RasterDataDescriptor.h"
 #include "RasterMathException.h"
+#include "RasterMathKernels.h"
 #include "RasterMathProgress.h"
 #include "RasterUtilities.h"
+#include "RowPipeline.h"
 #include "Signature.h"
-#include "switchOnEncoding.h"
+#include "TileScheduler.h"
 #include "UtilityServices.h"
 
+#include <algorithm>
 #include <math.h>
 #include <cmath>
+#include <deque>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string.h>
+#if !defined(WIN_API)
+#include <unistd.h>
+#endif
 
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QString>
 
 using namespace std;
@@ -32,76 +52,428 @@ using namespace boost;
 
 namespace
 {
-   template<typename T>
-   double getRasterStepValue(T* pData)
+   string getAvailableName(const string& baseStd, const string& typeName)
+   {
+      vector<DataElement*> allElements = Service<ModelServices>()->getElements(typeName);
+      vector<DataElement*>::iterator ppElement = allElements.begin();
+
+      QString base = QString::fromStdString(baseStd);
+      QString name = base;
+
+      for (int i=0; ppElement!=allElements.end(); ++i)
+      {
+         if (i == 0)
+         {
+            name = base;
+         }
+         else
+         {
+            name = base + " - " + QString::number(i);
+         }
+         for (ppElement=allElements.begin(); ppElement!=allElements.end(); ++ppElement)
+         {
+            if (RM_NULLCHK(*ppElement)->getName() == name.toStdString())
+            {
+               break;
+            }
+         }
+      }
+
+      return name.toStdString();
+   }
+
+   /**
+    * The physical memory which can be allocated without swapping, or -1 where it is not known.
+    */
+   int64_t availableMemory()
+   {
+#if defined(WIN_API)
+      MEMORYSTATUSEX stat;
+      stat.dwLength = sizeof(stat);
+      GlobalMemoryStatusEx(&stat);
+      return static_cast<int64_t>(stat.ullAvailPhys);
+#else
+      // the kernel's estimate counts the page cache it can drop, which the free pages do not
+      ifstream memoryInfo("/proc/meminfo");
+      string name;
+      int64_t kilobytes = 0;
+      while (memoryInfo >> name >> kilobytes)
+      {
+         if (name == "MemAvailable:")
+         {
+            return kilobytes*1024;
+         }
+         memoryInfo.ignore(numeric_limits<streamsize>::max(), '\n');
+      }
+#if defined(_SC_AVPHYS_PAGES)
+      long pageCount = sysconf(_SC_AVPHYS_PAGES);
+      long pageSize = sysconf(_SC_PAGESIZE);
+      if (pageCount >= 0 && pageSize > 0)
+      {
+         return static_cast<int64_t>(pageCount)*pageSize;
+      }
+#endif
+      return -1;
+#endif
+   }
+
+   // steps whose value depends only on their operands
+   bool isOperatorStep(ProcessStep::StepType type)
    {
-      return ModelServices::getDataValue(*pData, COMPLEX_MAGNITUDE);
+      switch (type)
+      {
+         case ProcessStep::NEGATE:
+         case ProcessStep::EXPONENTIATE:
+         case ProcessStep::MULTIPLY:
+         case ProcessStep::DIVIDE:
+         case ProcessStep::MODULO:
+         case ProcessStep::ADD:
+         case ProcessStep::SUBTRACT:
+         case ProcessStep::ABS:
+         case ProcessStep::ACOS:
+         case ProcessStep::COS:
+         case ProcessStep::ASIN:
+         case ProcessStep::SIN:
+         case ProcessStep::ATAN:
+         case ProcessStep::TAN:
+         case ProcessStep::COSH:
+         case ProcessStep::SINH:
+         case ProcessStep::TANH:
+         case ProcessStep::SQRT:
+         case ProcessStep::EXP:
+         case ProcessStep::ATAN2:
+         case ProcessStep::LOGN:
+         case ProcessStep::LOG10:
+         case ProcessStep::LOG2:
+         case ProcessStep::LOG:
+         case ProcessStep::LESS_THAN:
+         case ProcessStep::GREATER_THAN:
+         case ProcessStep::EQUALS:
+         case ProcessStep::NOT_EQUALS:
+         case ProcessStep::LESS_OR_EQUAL:
+         case ProcessStep::GREATER_OR_EQUAL:
+         case ProcessStep::NOT:
+         case ProcessStep::AND:
+         case ProcessStep::OR:
+         case ProcessStep::CLAMP:
+         case ProcessStep::MULTIPLY_CONSTANT:
+         case ProcessStep::INTEGER_POWER:
+         case ProcessStep::HALF_POWER:
+         case ProcessStep::SCALED_LOG10:
+            return true;
+         default:
+            return false;
+      }
    }
 
-   template<typename T>
-   double maxValue()
+   bool isCommutativeStep(ProcessStep::StepType type)
    {
-      return numeric_limits<T>::max();
+      return type == ProcessStep::ADD || type == ProcessStep::MULTIPLY || type == ProcessStep::AND ||
+         type == ProcessStep::OR || type == ProcessStep::EQUALS || type == ProcessStep::NOT_EQUALS;
    }
-   template<typename T>
-   double minValue()
+
+   bool isStatisticStep(ProcessStep::StepType type)
    {
-      return numeric_limits<T>::min();
+      return type >= ProcessStep::BAND_MIN && type <= ProcessStep::BAND_STDDEV;
    }
-   template<>
-   double minValue<float>()
+
+   bool isAccumulatorStep(ProcessStep::StepType type)
    {
-      return -numeric_limits<float>::max();
+      return type >= ProcessStep::BAND_MIN_ACCUM && type <= ProcessStep::BAND_STDDEV_ACCUM;
    }
-   template<>
-   double minValue<double>()
+
+   bool isCopyableStep(ProcessStep::StepType type)
    {
-      return -numeric_limits<double>::max();
+      return type != ProcessStep::CONDITIONAL && type != ProcessStep::RESULT_NUMBER &&
+         type != ProcessStep::RESULT_SIGNATURE && type != ProcessStep::RESULT_RASTER &&
+         !isStatisticStep(type) && !isAccumulatorStep(type);
    }
 
-   template<typename T>
-   double clampedValue(double data)
+   int64_t valueBits(double value)
    {
-      data = max(data, minValue<T>());
-      data = min(data, maxValue<T>());
-      return data;
+      int64_t bits = 0;
+      memcpy(&bits, &value, sizeof(bits));
+      return bits;
    }
 
-   template<typename T>
-   void setRasterStepValue(T* pRasterData, double data)
+   // the largest single-band raster kept in memory while it is reused for every band of a result
+   const int64_t MAX_CACHED_VALUES = 32*1024*1024;
+
+   bool isNumber(const ProcessStep& step, double value)
    {
-      *pRasterData = clampedValue<T>(data);
+      return step.type() == ProcessStep::NUMBER && step.value() == value;
    }
 
-   string getAvailableName(const string& baseStd, const string& typeName)
+   bool isSameStep(const shared_ptr<ProcessStep>& pStep1, const shared_ptr<ProcessStep>& pStep2)
    {
-      vector<DataElement*> allElements = Service<ModelServices>()->getElements(typeName);
-      vector<DataElement*>::iterator ppElement = allElements.begin();
+      return *RM_NULLCHK(pStep1) == *RM_NULLCHK(pStep2);
+   }
 
-      QString base = QString::fromStdString(baseStd);
-      QString name = base;
+   bool isAngleStep(ProcessStep::StepType type)
+   {
+      return (type >= ProcessStep::ACOS && type <= ProcessStep::TAN) || type == ProcessStep::ATAN2;
+   }
 
-      for (int i=0; ppElement!=allElements.end(); ++i)
+   // the estimated cost of computing a subexpression for one pixel, in additions
+   double pixelCost(const vector<shared_ptr<ProcessStep> >& steps)
+   {
+      double cost = 0.0;
+      for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
       {
-         if (i == 0)
+         switch (RM_NULLCHK(*ppStep)->type())
          {
-            name = base;
+            case ProcessStep::NUMBER:
+               break;
+            case ProcessStep::VALUE_RASTER:
+            case ProcessStep::INTEGER_POWER:
+               cost += 2.0;
+               break;
+            case ProcessStep::DIVIDE:
+            case ProcessStep::MODULO:
+            case ProcessStep::SQRT:
+            case ProcessStep::HALF_POWER:
+               cost += 4.0;
+               break;
+            case ProcessStep::EXPONENTIATE:
+            case ProcessStep::ACOS:
+            case ProcessStep::COS:
+            case ProcessStep::ASIN:
+            case ProcessStep::SIN:
+            case ProcessStep::ATAN:
+            case ProcessStep::TAN:
+            case ProcessStep::COSH:
+            case ProcessStep::SINH:
+            case ProcessStep::TANH:
+            case ProcessStep::EXP:
+            case ProcessStep::ATAN2:
+            case ProcessStep::LOGN:
+            case ProcessStep::LOG10:
+            case ProcessStep::LOG2:
+            case ProcessStep::LOG:
+            case ProcessStep::SCALED_LOG10:
+               cost += 20.0;
+               break;
+            default:
+               cost += 1.0;
+               break;
          }
-         else
+      }
+      return cost;
+   }
+
+   // the estimated cost of writing or reading a byte of a scratch raster, in additions
+   const double MEMORY_BYTE_COST = 0.25;
+   const double DISK_BYTE_COST = 4.0;
+
+   // the tiles of the result are about this many pixels, and at most MAX_TILE_COLUMNS wide
+   const int TILE_PIXELS = 65536;
+   const int MAX_TILE_COLUMNS = 1024;
+   // each thread is dealt at least this many tiles, when the result has the rows for them
+   const int TILES_PER_THREAD = 8;
+   // whole bands are computed by the threads at once when there are this many for each thread,
+   // so that the last bands to finish leave few threads idle
+   const int BANDS_PER_THREAD = 4;
+   // the blocks of rows a RowPipeline holds in memory: one being read, one computed, one written,
+   // and one read ahead while the computation catches up
+   const int PIPELINE_BLOCKS = 4;
+
+   // the accessors of the bands computed at once are created and released, and their programs
+   // compiled, one band at a time
+   QMutex sBandMutex;
+
+   /**
+    * The settings of a stack's programs, for compiling them in the threads which run them.
+    */
+   struct ProgramSettings
+   {
+      ProgramSettings(bool failOnError, double defaultValue, double toRadians, bool propagateNan,
+         bool singlePrecision, bool fastMath, const string& nativeCache) :
+         mFailOnError(failOnError),
+         mDefaultValue(defaultValue),
+         mToRadians(toRadians),
+         mPropagateNan(propagateNan),
+         mSinglePrecision(singlePrecision),
+         mFastMath(fastMath),
+         mNativeCache(nativeCache)
+      {
+      }
+
+      shared_ptr<ProcessProgram> create(const vector<shared_ptr<ProcessStep> >& steps, int columnCount) const
+      {
+         shared_ptr<ProcessProgram> pProgram(new ProcessProgram(steps, columnCount, mFailOnError, mDefaultValue,
+            mToRadians, mPropagateNan, mSinglePrecision, mFastMath));
+         if (!mNativeCache.empty())
          {
-            name = base + " - " + QString::number(i);
+            pProgram->loadNative(mNativeCache);
          }
-         for (ppElement=allElements.begin(); ppElement!=allElements.end(); ++ppElement)
+         return pProgram;
+      }
+
+      bool mFailOnError;
+      double mDefaultValue;
+      double mToRadians;
+      bool mPropagateNan;
+      bool mSinglePrecision;
+      bool mFastMath;
+      string mNativeCache;
+   };
+
+   /**
+    * The copies of a stack's steps which compute one band, and the inputs among them.
+    */
+   struct BandSteps
+   {
+      vector<shared_ptr<ProcessStep> > mSteps;
+      vector<shared_ptr<ProcessStep> > mInputs;
+   };
+
+   /**
+    * Computes tiles of one band with programs of its own, whose inputs are copies of the stack's
+    * inputs, moved to each row of a tile before it is computed. There is a program for each
+    * width of tile.
+    */
+   class TileWorker : public TileScheduler::Worker
+   {
+   public:
+      TileWorker(const vector<shared_ptr<ProcessStep> >& steps, const vector<shared_ptr<ProcessStep> >& inputs,
+         const map<int, shared_ptr<ProcessProgram> >& programs, bool failOnError, RasterMathProgress& progress) :
+         mSteps(steps),
+         mInputs(inputs),
+         mPrograms(programs),
+         mFailOnError(failOnError),
+         mProgress(progress)
+      {
+      }
+
+      void computeTile(const TileScheduler::Tile& tile)
+      {
+         map<int, shared_ptr<ProcessProgram> >::const_iterator pProgram = mPrograms.find(tile.mColumnCount);
+         RM_VERIFY(pProgram != mPrograms.end());
+         for (int row=tile.mFirstRow; row<tile.mFirstRow+tile.mRowCount; ++row)
          {
-            if (RM_NULLCHK(*ppElement)->getName() == name.toStdString())
+            for (vector<shared_ptr<ProcessStep> >::const_iterator ppInput=mInputs.begin(); ppInput!=mInputs.end(); ++ppInput)
             {
-               break;
+               switch ((*ppInput)->type())
+               {
+                  case ProcessStep::VALUE_AOI:
+                     static_cast<ProcessStepAoi&>(**ppInput).moveTo(row, tile.mFirstColumn);
+                     break;
+                  case ProcessStep::VALUE_RASTER:
+                  case ProcessStep::RESULT_RASTER:
+                     static_cast<ProcessStepRaster&>(**ppInput).moveTo(row, tile.mFirstColumn);
+                     break;
+                  default:
+                     static_cast<ProcessStepStatFunc&>(**ppInput).moveTo(row);
+                     break;
+               }
+            }
+
+            // without statistics to compute first or conditionals, the program never reports progress
+            pProgram->second->computeRow(mProgress);
+
+            // to find the rasters which ran out of rows, as the single-threaded loop does,
+            // and to keep the partial values of the rows of a statistic
+            for (vector<shared_ptr<ProcessStep> >::const_iterator ppInput=mInputs.begin(); ppInput!=mInputs.end(); ++ppInput)
+            {
+               if (!(*ppInput)->nextRow() && mFailOnError)
+               {
+                  throw RasterMathException("Raster row-size mismatch");
+               }
             }
          }
       }
 
-      return name.toStdString();
-   }
+   private:
+      vector<shared_ptr<ProcessStep> > mSteps; // the programs' steps, which must outlive them
+      vector<shared_ptr<ProcessStep> > mInputs;
+      map<int, shared_ptr<ProcessProgram> > mPrograms; // by width
+      bool mFailOnError;
+      RasterMathProgress& mProgress;
+   };
+
+   /**
+    * Computes whole bands in one of the scheduler's threads, each from the steps kept for it,
+    * as a single tile. A band's accessors and program are only created when it is computed, and
+    * released once it is done, so a thread only holds those of its current band.
+    */
+   class BandWorker : public TileScheduler::Worker
+   {
+   public:
+      BandWorker(vector<BandSteps>& bands, const ProgramSettings& settings, int rowCount, int columnCount,
+         RasterMathProgress& progress) :
+         mBands(bands),
+         mSettings(settings),
+         mRowCount(rowCount),
+         mColumnCount(columnCount),
+         mProgress(progress)
+      {
+      }
+
+      void computeTile(const TileScheduler::Tile& tile)
+      {
+         for (int band=tile.mFirstRow; band<tile.mFirstRow+tile.mRowCount; ++band)
+         {
+            BandSteps& steps = mBands[band];
+            shared_ptr<TileWorker> pWorker;
+            try
+            {
+               {
+                  QMutexLocker lock(&sBandMutex);
+                  for (vector<shared_ptr<ProcessStep> >::const_iterator ppInput=steps.mInputs.begin();
+                     ppInput!=steps.mInputs.end(); ++ppInput)
+                  {
+                     if ((*ppInput)->type() != ProcessStep::VALUE_AOI)
+                     {
+                        static_cast<ProcessStepRaster&>(**ppInput).separateAccessor();
+                     }
+                  }
+                  map<int, shared_ptr<ProcessProgram> > programs;
+                  programs[mColumnCount] = mSettings.create(steps.mSteps, mColumnCount);
+                  pWorker.reset(new TileWorker(steps.mSteps, steps.mInputs, programs, mSettings.mFailOnError,
+                     mProgress));
+               }
+               TileScheduler::Tile bandTile = {0, mRowCount, 0, mColumnCount};
+               pWorker->computeTile(bandTile);
+            }
+            catch (...)
+            {
+               release(steps, pWorker);
+               throw;
+            }
+            release(steps, pWorker);
+         }
+      }
+
+   private:
+      void release(BandSteps& steps, shared_ptr<TileWorker>& pWorker)
+      {
+         QMutexLocker lock(&sBandMutex);
+         pWorker.reset();
+         steps.mSteps.clear();
+         steps.mInputs.clear();
+      }
+
+      vector<BandSteps>& mBands;
+      const ProgramSettings& mSettings;
+      int mRowCount;
+      int mColumnCount;
+      RasterMathProgress& mProgress;
+   };
+
+   /**
+    * The copies of a stack's steps which compute one band from the blocks of a RowPipeline. The
+    * worker's rasters read and write the rows of the blocks, and the pipeline's threads read and
+    * write the rasters through copies of them with accessors of their own.
+    */
+   struct PipelineBand
+   {
+      int mIndex;
+      shared_ptr<TileWorker> mpWorker;
+      vector<ProcessStepRaster*> mInputs; // the worker's rasters whose rows are read into the blocks
+      ProcessStepRaster* mpResult;
+      vector<shared_ptr<ProcessStepRaster> > mInputAccessors; // the pipeline's copies, in the same order
+      shared_ptr<ProcessStepRaster> mpResultAccessor;
+   };
 }
 
 ProcessStack::ProcessStack() :
@@ -109,7 +481,14 @@ ProcessStack::ProcessStack() :
    mpResultSignature(static_cast<Signature*>(NULL)),
    mDefaultValue(0.0),
    mToRadians(1.0),
-   mFailOnError(false)
+   mFailOnError(false),
+   mEvaluationMode(ROW_EVALUATION),
+   mErrorMode(FLAG_ERRORS),
+   mPrecision(DOUBLE_PRECISION),
+   mFastMath(false),
+   mThreadCount(1),
+   mPipelineMemory(0),
+   mExecution(SERIAL_EXECUTION)
 {
 }
 
@@ -117,9 +496,18 @@ ProcessStack::ProcessStack(const ProcessStack& rhs) :
    mSteps(rhs.mSteps),
    mpResultRaster(static_cast<RasterElement*>(NULL)),
    mpResultSignature(static_cast<Signature*>(NULL)),
+   mResultLocation(rhs.mResultLocation),
    mDefaultValue(rhs.mDefaultValue),
    mToRadians(rhs.mToRadians),
-   mFailOnError(rhs.mFailOnError)
+   mFailOnError(rhs.mFailOnError),
+   mEvaluationMode(rhs.mEvaluationMode),
+   mErrorMode(rhs.mErrorMode),
+   mPrecision(rhs.mPrecision),
+   mFastMath(rhs.mFastMath),
+   mNativeCache(rhs.mNativeCache),
+   mThreadCount(rhs.mThreadCount),
+   mPipelineMemory(rhs.mPipelineMemory),
+   mExecution(SERIAL_EXECUTION)
 {
 }
 
@@ -138,6 +526,61 @@ void ProcessStack::setDegrees(bool asDegrees)
    {
       mToRadians = 1.0;
    }
+
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType == ProcessStep::CONDITIONAL)
+      {
+         static_cast<ProcessStepConditional&>(**ppStep).mTrueStack.setDegrees(asDegrees);
+         static_cast<ProcessStepConditional&>(**ppStep).mFalseStack.setDegrees(asDegrees);
+      }
+   }
+}
+
+/**
+ * Computes the transcendental functions of each pixel with the FastMath approximations instead
+ * of the C library. Values which are only computed once, such as folded constants, band-invariant
+ * values and lookup tables, stay exact.
+ */
+void ProcessStack::setFastMath(bool fastMath)
+{
+   mFastMath = fastMath;
+
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType == ProcessStep::CONDITIONAL)
+      {
+         static_cast<ProcessStepConditional&>(**ppStep).mTrueStack.setFastMath(fastMath);
+         static_cast<ProcessStepConditional&>(**ppStep).mFalseStack.setFastMath(fastMath);
+      }
+   }
+}
+
+/**
+ * Computes the result in tiles with count threads where the formula allows, along with the
+ * passes of the statistics.
+ */
+void ProcessStack::setThreadCount(int count)
+{
+   mThreadCount = count;
+
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType == ProcessStep::CONDITIONAL)
+      {
+         static_cast<ProcessStepConditional&>(**ppStep).mTrueStack.setThreadCount(count);
+         static_cast<ProcessStepConditional&>(**ppStep).mFalseStack.setThreadCount(count);
+      }
+      else if (isStatisticStep((*ppStep)->mStepType))
+      {
+         // the pass of a statistic ends with the statistic itself
+         ProcessStack& subStack = static_cast<ProcessStepStatFunc&>(**ppStep).mSubStack;
+         if (&subStack != this)
+         {
+            subStack.setThreadCount(count);
+         }
+      }
+   }
 }
 
 void ProcessStack::addResultStep(const string& baseName, EncodingType type, ProcessingLocation location)
@@ -159,13 +602,21 @@ void ProcessStack::addResultStep(const string& baseName, EncodingType type, Proc
    }
    else
    {
+      mResultLocation = location;
       if (location.isValid() == false)
       {
          location = computeLocation(rowCount, columnCount, bandCount, type);
       }
+
+      // the result is band sequential only when its bands will be computed at once; any other
+      // execution writes it a row of every band at a time, as before. The pipeline is preferred
+      // to computing the bands at once when a raster is on disk.
+      bool pipelined = mPipelineMemory > 0 && mEvaluationMode == ROW_EVALUATION &&
+         (location != IN_MEMORY || hasRasterOnDisk());
+      InterleaveFormatType interleave = (!pipelined && canComputeBands(bandCount, rowCount, columnCount)) ? BSQ : BIP;
       mpResultRaster = ModelResource<RasterElement>(RasterUtilities::createRasterElement(
          getAvailableName(baseName, "RasterElement"), rowCount, columnCount, bandCount, type,
-         BIP, location==IN_MEMORY));
+         interleave, location==IN_MEMORY));
       RM_NULLCHK(RasterCorrelator::instance())->setResultElement(mpResultRaster.get());
       add(shared_ptr<ProcessStep>(new ProcessStepRasterResult(bandCount)));
    }
@@ -173,7 +624,6 @@ void ProcessStack::addResultStep(const string& baseName, EncodingType type, Proc
 
 ProcessingLocation ProcessStack::computeLocation(int rowCount, int columnCount, int bandCount, EncodingType type) const
 {
-#ifdef WIN_API
    int64_t totalMemory = rowCount;
    totalMemory *= columnCount;
    totalMemory *= bandCount;
@@ -200,12 +650,8 @@ ProcessingLocation ProcessStack::computeLocation(int rowCount, int columnCount,
 
    totalMemory *= sizePerElement;
 
-   MEMORYSTATUSEX stat;
-   stat.dwLength = sizeof(stat);
-   GlobalMemoryStatusEx(&stat);
-   int64_t availPhys = static_cast<int64_t>(stat.ullAvailPhys);
-
-   if (totalMemory > availPhys)
+   int64_t availPhys = availableMemory();
+   if (availPhys >= 0 && totalMemory > availPhys)
    {
       return ON_DISK;
    }
@@ -213,9 +659,6 @@ ProcessingLocation ProcessStack::computeLocation(int rowCount, int columnCount,
    {
       return IN_MEMORY;
    }
-#else
-   return IN_MEMORY;
-#endif
 }
 
 RasterElement* ProcessStack::releaseRaster()
@@ -277,9 +720,7 @@ void ProcessStack::nextBand()
             ProcessStepRaster& rasterStep = static_cast<ProcessStepRaster&>(step);
             if (rasterStep.mBands == 1)
             {
-               rasterStep.mAccessor->toPixel(0,0);
-                  rasterStep.mCurrentRow = 0;
-                  rasterStep.mCurrentColumn = 0;
+               rasterStep.rewind();
                break;
             }
             else
@@ -297,13 +738,14 @@ void ProcessStack::nextBand()
                   ++rasterStep.mCurrentBand;
                   rasterStep.updateAccessor();
                }
-               if (rasterStep.mAccessor.isValid())
+               // a constant band has no accessor, and holds its rows instead
+               if (rasterStep.mAccessor.isValid() || rasterStep.mpConstantRow.get() != NULL)
                {
                   rasterStep.mCurrentRow = 0;
                   rasterStep.mCurrentColumn = 0;
                   if (step.mStepType == ProcessStep::VALUE_RASTER)
                   {
-                     switchOnEncoding(rasterStep.mEncodingType, rasterStep.mValue = getRasterStepValue, rasterStep.mAccessor->getColumn());
+                     rasterStep.updateValue();
                   }
                }
                else
@@ -316,6 +758,17 @@ void ProcessStack::nextBand()
             }
             break;
          }
+         case ProcessStep::VALUE_AOI:
+            // an AOI has no bands, so each band reads it from its first row again
+            static_cast<ProcessStepAoi&>(step).initialize();
+            break;
+         case ProcessStep::BAND_INVARIANT:
+            static_cast<ProcessStepInvariant&>(step).mSubStack.nextBand();
+            break;
+         case ProcessStep::CONDITIONAL:
+            static_cast<ProcessStepConditional&>(step).mTrueStack.nextBand();
+            static_cast<ProcessStepConditional&>(step).mFalseStack.nextBand();
+            break;
          case ProcessStep::COMPUTED_SIGNATURE:
          {
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
@@ -327,31 +780,19 @@ void ProcessStack::nextBand()
             break;
          }
          case ProcessStep::BAND_MIN_ACCUM:
-         {
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mValues.push_back(statStep.mAccumulator1);
-            statStep.mAccumulator1 = std::numeric_limits<double>::max();
-            break;
-         }
          case ProcessStep::BAND_MAX_ACCUM:
-         {
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mValues.push_back(statStep.mAccumulator1);
-            statStep.mAccumulator1 = -std::numeric_limits<double>::max();
-            break;
-         }
          case ProcessStep::BAND_SUM_ACCUM:
          {
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mValues.push_back(statStep.mAccumulator1);
-            statStep.mAccumulator1 = 0.0;
+            statStep.mValues.push_back(statStep.reduceRows().mValue);
             break;
          }
          case ProcessStep::BAND_MEAN_ACCUM:
          case ProcessStep::BAND_GEOMEAN_ACCUM:
          {
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            if (statStep.mAccumulator2 == 0.0)
+            StatAccumulator total = statStep.reduceRows();
+            if (total.mCount == 0.0)
             {
                if (mFailOnError)
                {
@@ -359,18 +800,21 @@ void ProcessStack::nextBand()
                }
                statStep.mValues.push_back(mDefaultValue);
             }
+            else if (step.mStepType == ProcessStep::BAND_GEOMEAN_ACCUM)
+            {
+               statStep.mValues.push_back(exp(total.mValue/total.mCount));
+            }
             else
             {
-               statStep.mValues.push_back(statStep.mAccumulator1/statStep.mAccumulator2);
+               statStep.mValues.push_back(total.mValue/total.mCount);
             }
-            statStep.mAccumulator1 = 0.0;
-            statStep.mAccumulator2 = 0.0;
             break;
          }
          case ProcessStep::BAND_HARMEAN_ACCUM:
          {
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            if (statStep.mAccumulator1 == 0.0 || statStep.mAccumulator2 == 0.0)
+            StatAccumulator total = statStep.reduceRows();
+            if (total.mValue == 0.0 || total.mCount == 0.0)
             {
                if (mFailOnError)
                {
@@ -380,16 +824,15 @@ void ProcessStack::nextBand()
             }
             else
             {
-               statStep.mValues.push_back(1.0/(statStep.mAccumulator1/statStep.mAccumulator2));
+               statStep.mValues.push_back(1.0/(total.mValue/total.mCount));
             }
-            statStep.mAccumulator1 = 0.0;
-            statStep.mAccumulator2 = 0.0;
             break;
          }
          case ProcessStep::BAND_STDDEV_ACCUM:
          {
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            if (statStep.mAccumulator3 <= 1.0)
+            StatAccumulator total = statStep.reduceRows();
+            if (total.mCount <= 1.0)
             {
                if (mFailOnError)
                {
@@ -399,13 +842,8 @@ void ProcessStack::nextBand()
             }
             else
             {
-               double numerator = fabs(statStep.mAccumulator3 * statStep.mAccumulator2 - statStep.mAccumulator1 * statStep.mAccumulator1);
-               double stdDev = sqrt((numerator / statStep.mAccumulator3) / (statStep.mAccumulator3 - 1.0));
-               statStep.mValues.push_back(stdDev);
+               statStep.mValues.push_back(sqrt(total.mDeviations/(total.mCount-1.0)));
             }
-            statStep.mAccumulator1 = 0.0;
-            statStep.mAccumulator2 = 0.0;
-            statStep.mAccumulator3 = 0.0;
             break;
          }
          default:
@@ -479,194 +917,200 @@ void ProcessStack::compute(vector<double>& stack, RasterMathProgress& progress)
       {
          case ProcessStep::NUMBER:
             stack.push_back(step.mValue);
-            continue;
+            break;
          case ProcessStep::VALUE_RASTER:
             stack.push_back(step.mValue);
             if (!step.nextColumn() && mFailOnError)
             {
                throw RasterMathException ("Raster column-size mismatch");
             }
-            continue;
+            if (static_cast<ProcessStepRaster&>(step).marksErrors() && ProcessStepRaster::isErrorMarker(stack.back()))
+            {
+               storeErrorValue();
+               stack.back() = mDefaultValue;
+               ppStep = mSteps.end()-1;
+            }
+            break;
          case ProcessStep::ADD:
          {
             SAFE_COMPUTE2(v2+v1);
-            continue;
+            break;
          }
          case ProcessStep::SUBTRACT:
          {
             SAFE_COMPUTE2(v2-v1);
-            continue;
+            break;
          }
          case ProcessStep::MULTIPLY:
          {
             SAFE_COMPUTE2(v2*v1);
-            continue;
+            break;
          }
          case ProcessStep::DIVIDE:
          {
             COMPUTE2(v1==0.0, v2/v1);
-            continue;
+            break;
          }
          case ProcessStep::RESULT_NUMBER:
             RM_VERIFY(!stack.empty());
             step.mValue = stack.back();
             stack.pop_back();
-            continue;
+            break;
          case ProcessStep::RESULT_SIGNATURE:
          {
             RM_VERIFY(!stack.empty());
             ProcessStepSignature& sigStep = static_cast<ProcessStepSignature&>(step);
             sigStep.mValues.push_back(stack.back());
             stack.pop_back();
-            continue;
+            break;
          }
          case ProcessStep::RESULT_RASTER:
          {
             RM_VERIFY(!stack.empty());
             ProcessStepRasterResult& rasterStep = static_cast<ProcessStepRasterResult&>(step);
             result = stack.back();
-            switchOnEncoding(rasterStep.mEncodingType, setRasterStepValue, rasterStep.mAccessor->getColumn(), result);
+            rasterStep.writeValue(result);
             stack.pop_back();
             if (!step.nextColumn() && mFailOnError)
             {
                throw RasterMathException ("Raster column-size mismatch");
             }
-            continue;
+            break;
          }
          case ProcessStep::NEGATE:
             RM_VERIFY(!stack.empty());
             stack.back() = -stack.back();
-            continue;
+            break;
          case ProcessStep::EXPONENTIATE:
          {
-            COMPUTE2(v1==0.0&&v2==0.0, pow(v2, v1));
-            continue;
+            COMPUTE2(v1==0.0&&v2==0.0, mFastMath ? FastMath::pow(v2, v1) : pow(v2, v1));
+            break;
          }
          case ProcessStep::ABS:
             RM_VERIFY(!stack.empty());
             stack.back() = fabs(stack.back());
-            continue;
+            break;
          case ProcessStep::SQRT:
          {
             COMPUTE1(v1<0.0, sqrt(v1));
-            continue;
+            break;
          }
          case ProcessStep::ACOS:
          {
             COMPUTE1(v1<-1.0||v1>1.0, acos(v1)/mToRadians);
-            continue;
+            break;
          }
          case ProcessStep::COS:
             RM_VERIFY(!stack.empty());
-            stack.back() = cos(stack.back()*mToRadians);
-            continue;
+            stack.back() = mFastMath ? FastMath::cos(stack.back()*mToRadians) : cos(stack.back()*mToRadians);
+            break;
          case ProcessStep::ASIN:
          {
             COMPUTE1(v1<-1.0||v1>1.0, asin(v1)/mToRadians);
-            continue;
+            break;
          }
          case ProcessStep::SIN:
             RM_VERIFY(!stack.empty());
-            stack.back() = sin(stack.back()*mToRadians);
-            continue;
+            stack.back() = mFastMath ? FastMath::sin(stack.back()*mToRadians) : sin(stack.back()*mToRadians);
+            break;
          case ProcessStep::ATAN:
          {
             COMPUTE1(v1==0.0, atan(v1)/mToRadians);
-            continue;
+            break;
          }
          case ProcessStep::TAN:
             RM_VERIFY(!stack.empty());
-            stack.back() = tan(stack.back()*mToRadians);
-            continue;
+            stack.back() = mFastMath ? FastMath::tan(stack.back()*mToRadians) : tan(stack.back()*mToRadians);
+            break;
          case ProcessStep::COSH:
             RM_VERIFY(!stack.empty());
             stack.back() = cosh(stack.back());
-            continue;
+            break;
          case ProcessStep::SINH:
             RM_VERIFY(!stack.empty());
             stack.back() = sinh(stack.back());
-            continue;
+            break;
          case ProcessStep::TANH:
             RM_VERIFY(!stack.empty());
             stack.back() = tanh(stack.back());
-            continue;
+            break;
          case ProcessStep::EXP:
             RM_VERIFY(!stack.empty());
-            stack.back() = exp(stack.back());
-            continue;
+            stack.back() = mFastMath ? FastMath::exp(stack.back()) : exp(stack.back());
+            break;
          case ProcessStep::LOG10:
          {
-            COMPUTE1(v1<=0.0, log10(v1));
-            continue;
+            COMPUTE1(v1<=0.0, mFastMath ? FastMath::log10(v1) : log10(v1));
+            break;
          }
          case ProcessStep::LOG2:
          {
-            COMPUTE1(v1<=0.0, log10(v1)/log10(2.0));
-            continue;
+            COMPUTE1(v1<=0.0, mFastMath ? FastMath::log2(v1) : log10(v1)/log10(2.0));
+            break;
          }
          case ProcessStep::LOG:
          {
-            COMPUTE1(v1<=0.0, ::log(v1));
-            continue;
+            COMPUTE1(v1<=0.0, mFastMath ? FastMath::log(v1) : ::log(v1));
+            break;
          }
          case ProcessStep::ATAN2:
          {
-            COMPUTE2(v1==0.0&&v2==0.0, atan2(v2, v1)/mToRadians);
-            continue;
+            COMPUTE2(v1==0.0&&v2==0.0, (mFastMath ? FastMath::atan2(v2, v1) : atan2(v2, v1))/mToRadians);
+            break;
          }
          case ProcessStep::LOGN:
          {
-            COMPUTE2(v1<=0.0||v2<=0.0, log10(v2)/log10(v1)); // optimize by making a special logStep with 1.0/log10(v1) precomputed
-            continue;
+            COMPUTE2(v1<=0.0||v2<=0.0, mFastMath ? FastMath::log(v2)/FastMath::log(v1) : log10(v2)/log10(v1)); // a constant base is reduced to SCALED_LOG10
+            break;
          }
          case ProcessStep::MODULO:
          {
             COMPUTE2(v1==0.0, fmod(v2, v1));
-            continue;
+            break;
          }
          case ProcessStep::LESS_THAN:
          {
             SAFE_COMPUTE2(static_cast<double>(v2<v1));
-            continue;
+            break;
          }
          case ProcessStep::GREATER_THAN:
          {
             SAFE_COMPUTE2(static_cast<double>(v2>v1));
-            continue;
+            break;
          }
          case ProcessStep::LESS_OR_EQUAL:
          {
             SAFE_COMPUTE2(static_cast<double>(v2<=v1));
-            continue;
+            break;
          }
          case ProcessStep::GREATER_OR_EQUAL:
          {
             SAFE_COMPUTE2(static_cast<double>(v2>=v1));
-            continue;
+            break;
          }
          case ProcessStep::EQUALS:
          {
             SAFE_COMPUTE2(static_cast<double>(v2==v1));
-            continue;
+            break;
          }
          case ProcessStep::NOT_EQUALS:
          {
             SAFE_COMPUTE2(static_cast<double>(v2!=v1));
-            continue;
+            break;
          }
          case ProcessStep::NOT:
             RM_VERIFY(!stack.empty());
             stack.back() = static_cast<double>(stack.back()==0.0);
-            continue;
+            break;
          case ProcessStep::AND:
          {
             SAFE_COMPUTE2(static_cast<double>(v2!=0.0 && v1!=0.0));
-            continue;
+            break;
          }
          case ProcessStep::OR:
          {
             SAFE_COMPUTE2(static_cast<double>(v2!=0.0 || v1!=0.0));
-            continue;
+            break;
          }
          case ProcessStep::CLAMP:
          {
@@ -678,11 +1122,11 @@ void ProcessStack::compute(vector<double>& stack, RasterMathProgress& progress)
             double v3 = stack.back();
             v3 = max(v2, min(v3, v1));
             stack.back() = v3;
-            continue;
+            break;
          }
          case ProcessStep::COMPUTED_SIGNATURE:
             stack.push_back(step.mValue);
-            continue;
+            break;
          case ProcessStep::BAND_MIN:
          case ProcessStep::BAND_MAX:
          case ProcessStep::BAND_SUM:
@@ -694,55 +1138,25 @@ void ProcessStack::compute(vector<double>& stack, RasterMathProgress& progress)
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
             statStep.execute(progress);
             stack.push_back(step.mValue);
-            continue;
+            break;
          }
          case ProcessStep::BAND_MIN_ACCUM:
-         {
-            RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 = min(statStep.mAccumulator1, stack.back());
-            stack.pop_back();
-            continue;
-         }
          case ProcessStep::BAND_MAX_ACCUM:
-         {
-            RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 = max(statStep.mAccumulator1, stack.back());
-            stack.pop_back();
-            continue;
-         }
          case ProcessStep::BAND_SUM_ACCUM:
-         {
-            RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 += stack.back();
-            stack.pop_back();
-            continue;
-         }
          case ProcessStep::BAND_MEAN_ACCUM:
+         case ProcessStep::BAND_STDDEV_ACCUM:
          {
             RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 += stack.back();
-            statStep.mAccumulator2++;
+            static_cast<ProcessStepStatFunc&>(step).accumulate(stack.back());
             stack.pop_back();
-            continue;
+            break;
          }
          case ProcessStep::BAND_GEOMEAN_ACCUM:
-         {
-            RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 *= stack.back();
-            statStep.mAccumulator2++;
-            stack.pop_back();
-            continue;
-         }
          case ProcessStep::BAND_HARMEAN_ACCUM:
          {
             RM_VERIFY(!stack.empty());
             ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            if (stack.back() == 0.0)
+            if (step.mStepType == ProcessStep::BAND_GEOMEAN_ACCUM ? stack.back() < 0.0 : stack.back() == 0.0)
             {
                storeErrorValue();
                stack.back() = mDefaultValue;
@@ -750,35 +1164,83 @@ void ProcessStack::compute(vector<double>& stack, RasterMathProgress& progress)
             }
             else
             {
-               statStep.mAccumulator1 += 1.0/stack.back();
-               statStep.mAccumulator2++;
+               statStep.accumulate(stack.back());
                stack.pop_back();
             }
-            continue;
-         }
-         case ProcessStep::BAND_STDDEV_ACCUM:
-         {
-            RM_VERIFY(!stack.empty());
-            ProcessStepStatFunc& statStep = static_cast<ProcessStepStatFunc&>(step);
-            statStep.mAccumulator1 += stack.back();
-            statStep.mAccumulator2 += stack.back()*stack.back();
-            statStep.mAccumulator3++;
-            stack.pop_back();
-            continue;
+            break;
          }
          case ProcessStep::VALUE_AOI:
             stack.push_back(step.mValue);
             step.nextColumn();
-            continue;
+            break;
+         case ProcessStep::MULTIPLY_CONSTANT:
+            RM_VERIFY(!stack.empty());
+            stack.back() *= static_cast<ProcessStepConstantFunction&>(step).mConstant;
+            break;
+         case ProcessStep::INTEGER_POWER:
+            RM_VERIFY(!stack.empty());
+            stack.back() = RasterMathKernels::integerPower(stack.back(),
+               static_cast<int>(static_cast<ProcessStepConstantFunction&>(step).mConstant));
+            break;
+         case ProcessStep::HALF_POWER:
+            RM_VERIFY(!stack.empty());
+            stack.back() = sqrt(stack.back());
+            break;
+         case ProcessStep::SCALED_LOG10:
+         {
+            COMPUTE1(v1<=0.0, (mFastMath ? FastMath::log10(v1) : log10(v1))*static_cast<ProcessStepConstantFunction&>(step).mConstant);
+            break;
+         }
          case ProcessStep::REFERENCE:
          {
             ProcessStepReference& refStep = static_cast<ProcessStepReference&>(step);
             stack.push_back(refStep.mRef);
-            continue;
+            break;
+         }
+         case ProcessStep::BAND_INVARIANT:
+            stack.push_back(step.mValue);
+            if (static_cast<ProcessStepInvariant&>(step).mError)
+            {
+               storeErrorValue();
+               stack.back() = mDefaultValue;
+               ppStep = mSteps.end()-1;
+            }
+            break;
+         case ProcessStep::CONDITIONAL:
+         {
+            // only the branch which the pixel takes is evaluated, and its errors are the pixel's errors
+            RM_VERIFY(!stack.empty());
+            ProcessStepConditional& conditionalStep = static_cast<ProcessStepConditional&>(step);
+            bool condition = (stack.back() != 0.0);
+            stack.pop_back();
+            size_t depth = stack.size();
+            ProcessStepConditional::skipBranch(condition ? conditionalStep.mFalseStack : conditionalStep.mTrueStack, 1);
+            try
+            {
+               (condition ? conditionalStep.mTrueStack : conditionalStep.mFalseStack).compute(stack, progress);
+            }
+            catch (const RasterMathAbortException&)
+            {
+               throw;
+            }
+            catch (const RasterMathException&)
+            {
+               stack.resize(depth);
+               stack.push_back(mDefaultValue);
+               storeErrorValue();
+               ppStep = mSteps.end()-1;
+            }
+            break;
          }
          default:
             break;
       }
+
+      // operator steps keep their value for the references which replace repeated subexpressions
+      if (isOperatorStep(step.mStepType))
+      {
+         step.mValue = stack.back();
+      }
    }
 }
 
@@ -795,7 +1257,7 @@ void ProcessStack::storeErrorValue()
    if (pStep->type() == ProcessStep::RESULT_RASTER)
    {
       ProcessStepRasterResult& rasterStep = static_cast<ProcessStepRasterResult&>(*pStep);
-      switchOnEncoding(rasterStep.mEncodingType, setRasterStepValue, rasterStep.mAccessor->getColumn(), mDefaultValue);
+      rasterStep.writeValue(mDefaultValue);
       rasterStep.nextColumn();
    }
    else if (pStep->type() == ProcessStep::RESULT_NUMBER)
@@ -812,8 +1274,7 @@ void ProcessStack::execute(RasterMathProgress& progress)
       throw RasterMathException("Formula is empty");
    }
 
-   optimize();
-   initializeSteps();
+   optimize(progress);
 
    RM_VERIFY(!mSteps.empty());
    RM_NULLCHK(mSteps.back());
@@ -821,17 +1282,94 @@ void ProcessStack::execute(RasterMathProgress& progress)
    int rowCount = mSteps.back()->rows();
    int columnCount = mSteps.back()->columns();
 
+   // single-band rasters are read once and kept in memory when the result has more bands
+   if (bandCount > 1)
+   {
+      for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+      {
+         ProcessStep& step = *RM_NULLCHK(*ppStep);
+         if (step.mStepType == ProcessStep::VALUE_RASTER && step.mBands == 1 &&
+            static_cast<int64_t>(step.mRows)*step.mColumns <= MAX_CACHED_VALUES)
+         {
+            static_cast<ProcessStepRaster&>(step).setCached(true);
+         }
+      }
+   }
+   initializeSteps();
+   executeBranchStatistics(progress);
+
+   ProcessStepRaster* pCopyInput = copyInput();
+   if (pCopyInput != NULL)
+   {
+      mExecution = COPY_EXECUTION;
+      executeCopy(*pCopyInput, progress);
+      return;
+   }
+
+   ProcessStepRaster* pLookupInput = lookupInput();
+   if (pLookupInput != NULL)
+   {
+      mExecution = LOOKUP_EXECUTION;
+      executeLookup(*pLookupInput, progress);
+      return;
+   }
+
+   // with a raster on disk, the threads computing bands or tiles would each wait on it, so
+   // it is read ahead and written behind in the pipeline instead, however many threads there are
+   if (canExecutePipeline(rowCount, columnCount))
+   {
+      mExecution = PIPELINE_EXECUTION;
+      executePipeline(bandCount, rowCount, columnCount, progress);
+      return;
+   }
+
+   if (canExecuteBands(bandCount, rowCount, columnCount))
+   {
+      mExecution = BAND_EXECUTION;
+      executeBands(bandCount, rowCount, columnCount, progress);
+      return;
+   }
+
+   if (canExecuteTiles(rowCount, columnCount))
+   {
+      mExecution = TILE_EXECUTION;
+      executeTiles(bandCount, rowCount, columnCount, progress);
+      return;
+   }
+
+   mExecution = SERIAL_EXECUTION;
+
    vector<double> workingStack;
    workingStack.reserve(mSteps.size());
+   auto_ptr<ProcessProgram> pProgram;
 
    for (int band=0; band<bandCount; ++band)
    {
+      bool invariants = evaluateInvariants(progress);
+      if (mEvaluationMode == ROW_EVALUATION && (invariants || pProgram.get() == NULL))
+      {
+         // values which are invariant for the band are fused into the program like numbers,
+         // so a program with any is rebuilt for each band
+         pProgram.reset(new ProcessProgram(mSteps, columnCount, mFailOnError, mDefaultValue, mToRadians,
+            mErrorMode == PROPAGATE_NAN, mPrecision == SINGLE_PRECISION, mFastMath));
+         if (!mNativeCache.empty())
+         {
+            pProgram->loadNative(mNativeCache);
+         }
+      }
       for (int row=0; row<rowCount; ++row)
       {
-         for (int column=0; column<columnCount; ++column)
+         if (mEvaluationMode == ROW_EVALUATION)
          {
-            workingStack.clear();
-            compute(workingStack, progress);
+            pProgram->computeRow(progress);
+         }
+         else
+         {
+            for (int column=0; column<columnCount; ++column)
+            {
+               workingStack.clear();
+               compute(workingStack, progress);
+            }
          }
          nextRow();
          bool aborted = progress.addWorkCompleted(columnCount*mSteps.size());
@@ -844,50 +1382,1343 @@ void ProcessStack::execute(RasterMathProgress& progress)
    }
 }
 
-int64_t ProcessStack::totalWork() const
+/**
+ * Whether the steps before the last can be computed from the copies which copySteps() makes.
+ * Only the inputs and the result are copied, with the other steps shared, so steps which keep
+ * state from pixel to pixel, such as the statistics computed on first use and the sub-stacks of
+ * conditionals, must be computed by the stack's own steps.
+ */
+bool ProcessStack::canCopySteps() const
 {
-   RM_VERIFY(!mSteps.empty());
-   RM_NULLCHK(mSteps.back());
-   int bandCount = mSteps.back()->bands();
-   int rowCount = mSteps.back()->rows();
-   int columnCount = mSteps.back()->columns();
-
-   int64_t work = static_cast<int64_t>(bandCount) * rowCount * columnCount * mSteps.size();
-   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin();
-      ppStep!=mSteps.end(); ++ppStep)
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end()-1; ++ppStep)
    {
-      work += RM_NULLCHK(*ppStep)->oneTimeWork();
+      if (!isCopyableStep(RM_NULLCHK(*ppStep)->type()))
+      {
+         return false;
+      }
    }
+   return true;
+}
 
-   return work;
+/**
+ * Whether each band can be computed in tiles by separate threads, into a raster or, in the pass of
+ * a statistic's sub-stack, into the statistic's rows. The steps of each thread's programs are copies
+ * of the inputs and the result, so the steps must allow copying with canCopySteps().
+ */
+bool ProcessStack::canExecuteTiles(int rowCount, int columnCount) const
+{
+   ProcessStep::StepType resultType = RM_NULLCHK(mSteps.back())->type();
+   if (mThreadCount < 2 || rowCount < 2 || columnCount < 1 || mEvaluationMode != ROW_EVALUATION ||
+      (resultType != ProcessStep::RESULT_RASTER && !isAccumulatorStep(resultType)))
+   {
+      return false;
+   }
+   return canCopySteps();
 }
 
-void ProcessStack::optimize()
+/**
+ * The steps for a thread computing tiles of the current band. The raster, AOI and result steps
+ * are copied, with accessors of their own, and returned in inputs as well; the references to them
+ * are rebuilt to refer to the copies. A statistic's copy shares the statistic's rows.
+ *
+ * With keepBand, the steps are kept to compute the current band after the stack has moved on,
+ * so the band's invariant and statistic values are copied too, and the rasters are only given
+ * accessors when separateAccessor() is called on them.
+ */
+vector<shared_ptr<ProcessStep> > ProcessStack::copySteps(vector<shared_ptr<ProcessStep> >& inputs, bool keepBand) const
 {
-   // long-term, create a suffix tree to identify repeated substrings
-   // for now, identify repeated raster or statistical function steps 
-   // via n^2 search :(
-   for (vector<shared_ptr<ProcessStep> >::iterator ppStep1=mSteps.begin();
-      ppStep1!=mSteps.end(); ++ppStep1)
+   vector<shared_ptr<ProcessStep> > steps;
+   steps.reserve(mSteps.size());
+   map<const ProcessStep*, shared_ptr<ProcessStep> > copies;
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
    {
-      for (vector<shared_ptr<ProcessStep> >::iterator ppStep2=ppStep1+1;
-         ppStep2!=mSteps.end(); ++ppStep2)
+      shared_ptr<ProcessStep> pStep = *ppStep;
+      switch (pStep->type())
       {
-         if (*RM_NULLCHK(*ppStep1) == *RM_NULLCHK(*ppStep2))
+         case ProcessStep::VALUE_RASTER:
+         case ProcessStep::RESULT_RASTER:
+         {
+            ProcessStepRaster* pRaster = NULL;
+            if (pStep->type() == ProcessStep::RESULT_RASTER)
+            {
+               pRaster = new ProcessStepRasterResult(static_cast<const ProcessStepRasterResult&>(*pStep));
+            }
+            else
+            {
+               pRaster = new ProcessStepRaster(static_cast<const ProcessStepRaster&>(*pStep));
+            }
+            pStep.reset(pRaster);
+            if (keepBand)
+            {
+               pRaster->releaseAccessor();
+            }
+            else
+            {
+               pRaster->separateAccessor();
+            }
+            break;
+         }
+         case ProcessStep::VALUE_AOI:
+            pStep.reset(new ProcessStepAoi(static_cast<const ProcessStepAoi&>(*pStep)));
+            break;
+         case ProcessStep::BAND_INVARIANT:
+            if (keepBand)
+            {
+               // only the value and error of the band are read, not the sub-stack
+               ProcessStepInvariant* pInvariant = new ProcessStepInvariant(static_cast<const ProcessStepInvariant&>(*pStep));
+               pInvariant->mSubStack.clear();
+               pStep.reset(pInvariant);
+            }
+            break;
+         case ProcessStep::COMPUTED_SIGNATURE:
+            if (keepBand)
+            {
+               ProcessStepStatFunc* pStatistic = new ProcessStepStatFunc(static_cast<const ProcessStepStatFunc&>(*pStep));
+               pStatistic->mValues.clear();
+               pStep.reset(pStatistic);
+            }
+            break;
+         case ProcessStep::BAND_MIN_ACCUM:
+         case ProcessStep::BAND_MAX_ACCUM:
+         case ProcessStep::BAND_MEAN_ACCUM:
+         case ProcessStep::BAND_GEOMEAN_ACCUM:
+         case ProcessStep::BAND_HARMEAN_ACCUM:
+         case ProcessStep::BAND_SUM_ACCUM:
+         case ProcessStep::BAND_STDDEV_ACCUM:
+            pStep.reset(new ProcessStepStatFunc(static_cast<const ProcessStepStatFunc&>(*pStep)));
+            break;
+         case ProcessStep::REFERENCE:
          {
-            ProcessStep::StepType type = (*ppStep1)->type();
-            if (type == ProcessStep::VALUE_RASTER || 
-               type == ProcessStep::BAND_MIN ||
-               type == ProcessStep::BAND_MAX ||
-               type == ProcessStep::BAND_MEAN ||
-               type == ProcessStep::BAND_GEOMEAN ||
-               type == ProcessStep::BAND_HARMEAN ||
-               type == ProcessStep::BAND_SUM ||
-               type == ProcessStep::BAND_STDDEV)
+            map<const ProcessStep*, shared_ptr<ProcessStep> >::const_iterator pCopy =
+               copies.find(&static_cast<const ProcessStepReference&>(*pStep).mStep);
+            if (pCopy != copies.end())
             {
-               *ppStep2 = shared_ptr<ProcessStep>(new ProcessStepReference(**ppStep1));
+               pStep.reset(new ProcessStepReference(*pCopy->second));
             }
+            break;
+         }
+         default:
+            break;
+      }
+      ProcessStep::StepType type = pStep->type();
+      if (pStep != *ppStep && type != ProcessStep::REFERENCE)
+      {
+         copies[ppStep->get()] = pStep;
+         if (type != ProcessStep::BAND_INVARIANT && type != ProcessStep::COMPUTED_SIGNATURE)
+         {
+            inputs.push_back(pStep);
+         }
+      }
+      steps.push_back(pStep);
+   }
+   return steps;
+}
+
+/**
+ * Computes each band in tiles, which a TileScheduler hands out to the threads, and which write
+ * disjoint pixels of the result. The band-invariant values are evaluated, and the programs
+ * compiled, before the threads are started. Each tile computes its pixels exactly as the
+ * single-threaded loop would, so the result is the same.
+ *
+ * Tiles are as wide as the result when a raster is narrower than it, since the single-threaded
+ * loop reads such a raster's missing columns as one run, and for a statistic, which accumulates
+ * each row as one run so that its value does not depend on the tiles.
+ */
+void ProcessStack::executeTiles(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress)
+{
+   int threadCount = min(mThreadCount, rowCount);
+   int tileColumns = min(columnCount, MAX_TILE_COLUMNS);
+   if (mSteps.back()->type() != ProcessStep::RESULT_RASTER)
+   {
+      tileColumns = columnCount;
+   }
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if ((*ppStep)->type() == ProcessStep::VALUE_RASTER && (*ppStep)->columns() < columnCount)
+      {
+         tileColumns = columnCount;
+      }
+   }
+   int tileRows = max(1, min(TILE_PIXELS/max(tileColumns, 1), rowCount/(threadCount*TILES_PER_THREAD)));
+   set<int> widths;
+   widths.insert(tileColumns);
+   if (columnCount%tileColumns != 0)
+   {
+      widths.insert(columnCount%tileColumns);
+   }
+
+   ProgramSettings settings(mFailOnError, mDefaultValue, mToRadians, mErrorMode == PROPAGATE_NAN,
+      mPrecision == SINGLE_PRECISION, mFastMath, mNativeCache);
+   TileScheduler scheduler(rowCount, columnCount, tileRows, tileColumns);
+   for (int band=0; band<bandCount; ++band)
+   {
+      evaluateInvariants(progress);
+
+      vector<shared_ptr<TileWorker> > workers;
+      vector<TileScheduler::Worker*> pWorkers;
+      for (int i=0; i<threadCount; ++i)
+      {
+         vector<shared_ptr<ProcessStep> > inputs;
+         vector<shared_ptr<ProcessStep> > steps = copySteps(inputs, false);
+         map<int, shared_ptr<ProcessProgram> > programs;
+         for (set<int>::const_iterator pWidth=widths.begin(); pWidth!=widths.end(); ++pWidth)
+         {
+            programs[*pWidth] = settings.create(steps, *pWidth);
          }
+         workers.push_back(shared_ptr<TileWorker>(new TileWorker(steps, inputs, programs, mFailOnError, progress)));
+         pWorkers.push_back(workers.back().get());
+      }
+
+      scheduler.execute(pWorkers, progress, static_cast<int64_t>(mSteps.size()));
+      skipRows(rowCount);
+      nextBand();
+   }
+}
+
+/**
+ * Moves the rasters past the rows of the band which copies of them have computed, so that
+ * nextBand() finds the rasters which ran out of bands, as after the single-threaded loop.
+ */
+void ProcessStack::skipRows(int rowCount)
+{
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      ProcessStep::StepType type = (*ppStep)->type();
+      if (type == ProcessStep::VALUE_RASTER || type == ProcessStep::RESULT_RASTER)
+      {
+         static_cast<ProcessStepRaster&>(**ppStep).skipRows(rowCount);
+      }
+   }
+}
+
+/**
+ * Whether whole bands can be computed at once, each by one of the threads, for a result with
+ * enough bands to keep the threads busy. A band only reads the same band of each raster, so
+ * the rasters must be band sequential; the threads would otherwise read and write the same
+ * interleaved rows for their different bands.
+ */
+bool ProcessStack::canExecuteBands(int bandCount, int rowCount, int columnCount) const
+{
+   const ProcessStep* pResult = RM_NULLCHK(mSteps.back().get());
+   if (pResult->type() != ProcessStep::RESULT_RASTER ||
+      static_cast<const ProcessStepRaster*>(pResult)->columnStride() != 1)
+   {
+      return false;
+   }
+   return canComputeBands(bandCount, rowCount, columnCount);
+}
+
+/**
+ * The conditions of canExecuteBands() on the steps other than the result raster, so that
+ * addResultStep() can ask them before the result exists and create a band sequential result
+ * only when its bands will be computed at once.
+ */
+bool ProcessStack::canComputeBands(int bandCount, int rowCount, int columnCount) const
+{
+   if (mThreadCount < 2 || bandCount < mThreadCount*BANDS_PER_THREAD || rowCount < 2 || columnCount < 1 ||
+      mEvaluationMode != ROW_EVALUATION || mSteps.empty())
+   {
+      return false;
+   }
+   vector<shared_ptr<ProcessStep> >::const_iterator pEnd = mSteps.end();
+   if (mSteps.back()->type() == ProcessStep::RESULT_RASTER)
+   {
+      --pEnd;
+   }
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=pEnd; ++ppStep)
+   {
+      ProcessStep::StepType type = RM_NULLCHK(*ppStep)->type();
+      if (!isCopyableStep(type) || (type == ProcessStep::VALUE_RASTER &&
+         static_cast<const ProcessStepRaster&>(**ppStep).columnStride() != 1))
+      {
+         return false;
       }
    }
+   return true;
+}
+
+/**
+ * Computes the bands at once, which a TileScheduler hands out to the threads whole. The stack
+ * first moves through every band, evaluating the band's invariant values and keeping copies of
+ * its steps, so the threads never change the stack's own steps. Each band is computed exactly
+ * as the single-threaded loop would, so the result is the same. Progress is reported, and an
+ * abort noticed, as each band finishes.
+ */
+void ProcessStack::executeBands(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress)
+{
+   // a raster which runs out of bands fails once the band it ran out in has been computed
+   vector<BandSteps> bands;
+   string bandError;
+   for (int band=0; band<bandCount && bandError.empty(); ++band)
+   {
+      evaluateInvariants(progress);
+      bands.push_back(BandSteps());
+      bands.back().mSteps = copySteps(bands.back().mInputs, true);
+      skipRows(rowCount);
+      try
+      {
+         nextBand();
+      }
+      catch (const RasterMathException& e)
+      {
+         bandError = e.getMessage();
+      }
+   }
+
+   ProgramSettings settings(mFailOnError, mDefaultValue, mToRadians, mErrorMode == PROPAGATE_NAN,
+      mPrecision == SINGLE_PRECISION, mFastMath, mNativeCache);
+   vector<shared_ptr<BandWorker> > workers;
+   vector<TileScheduler::Worker*> pWorkers;
+   for (int i=0; i<mThreadCount; ++i)
+   {
+      workers.push_back(shared_ptr<BandWorker>(new BandWorker(bands, settings, rowCount, columnCount, progress)));
+      pWorkers.push_back(workers.back().get());
+   }
+   TileScheduler scheduler(static_cast<int>(bands.size()), 1, 1, 1);
+   scheduler.execute(pWorkers, progress, static_cast<int64_t>(rowCount)*columnCount*mSteps.size());
+   if (!bandError.empty())
+   {
+      throw RasterMathException(bandError);
+   }
+}
+
+/**
+ * Whether the rows of the rasters read from or written to disk can be read ahead of the
+ * computation, and written behind it, by a RowPipeline within the pipeline's memory. The
+ * band is computed from copies of the steps, which must allow copying with canCopySteps().
+ */
+bool ProcessStack::canExecutePipeline(int rowCount, int columnCount) const
+{
+   if (mPipelineMemory <= 0 || rowCount < 1 || columnCount < 1 || mEvaluationMode != ROW_EVALUATION ||
+      RM_NULLCHK(mSteps.back())->type() != ProcessStep::RESULT_RASTER || !canCopySteps())
+   {
+      return false;
+   }
+   return hasRasterOnDisk();
+}
+
+/**
+ * Whether any raster the steps read or write is on disk, rather than in memory or held in
+ * memory by the step.
+ */
+bool ProcessStack::hasRasterOnDisk() const
+{
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      ProcessStep::StepType type = (*ppStep)->type();
+      if (type == ProcessStep::VALUE_RASTER || type == ProcessStep::RESULT_RASTER)
+      {
+         const ProcessStepRaster& raster = static_cast<const ProcessStepRaster&>(**ppStep);
+         if (raster.mpRows == NULL && raster.isOnDisk())
+         {
+            return true;
+         }
+      }
+   }
+   return false;
+}
+
+/**
+ * Computes each band in blocks of rows which a RowPipeline reads ahead, and whose result rows it
+ * writes behind, in threads of its own. The blocks take up to the pipeline's memory, and are at
+ * least a row. The stack moves through the bands a band ahead of the computation, evaluating the
+ * band's invariant values and keeping copies of its steps, so the pipeline reads the next band
+ * while the current one is computed. Each row is computed exactly as the single-threaded loop
+ * would, so the result is the same.
+ */
+void ProcessStack::executePipeline(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress)
+{
+   int64_t rowBytes = static_cast<int64_t>(columnCount)*sizeof(double);
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if ((*ppStep)->type() == ProcessStep::VALUE_RASTER && static_cast<const ProcessStepRaster&>(**ppStep).mpRows == NULL)
+      {
+         rowBytes += static_cast<int64_t>((*ppStep)->columns())*sizeof(double);
+      }
+   }
+   int blockRows = static_cast<int>(max<int64_t>(1, min<int64_t>(rowCount, mPipelineMemory/(rowBytes*PIPELINE_BLOCKS))));
+
+   ProgramSettings settings(mFailOnError, mDefaultValue, mToRadians, mErrorMode == PROPAGATE_NAN,
+      mPrecision == SINGLE_PRECISION, mFastMath, mNativeCache);
+   // a raster which runs out of bands fails once the band it ran out in has been computed
+   string bandError;
+   // the bands until they have been written, destroyed after the pipeline's threads have stopped
+   deque<shared_ptr<PipelineBand> > bands;
+   RowPipeline pipeline(blockRows, PIPELINE_BLOCKS);
+   int readBands = 0;
+   for (int band=0; band<bandCount; ++band)
+   {
+      while (readBands < min(band+2, bandCount) && bandError.empty())
+      {
+         evaluateInvariants(progress);
+         shared_ptr<PipelineBand> pBand(new PipelineBand);
+         pBand->mIndex = readBands;
+         vector<shared_ptr<ProcessStep> > inputs;
+         vector<shared_ptr<ProcessStep> > steps = copySteps(inputs, true);
+         vector<ProcessStepRaster*> readInputs;
+         for (vector<shared_ptr<ProcessStep> >::const_iterator ppInput=inputs.begin(); ppInput!=inputs.end(); ++ppInput)
+         {
+            ProcessStep::StepType type = (*ppInput)->type();
+            if (type != ProcessStep::VALUE_RASTER && type != ProcessStep::RESULT_RASTER)
+            {
+               continue;
+            }
+            // the rasters which ran out of bands have no rows to read, and the cached rasters hold theirs
+            ProcessStepRaster& raster = static_cast<ProcessStepRaster&>(**ppInput);
+            if (raster.mCurrentBand == -1 || raster.mpRows != NULL)
+            {
+               continue;
+            }
+            shared_ptr<ProcessStepRaster> pAccessor(new ProcessStepRaster(raster));
+            pAccessor->separateAccessor();
+            if (type == ProcessStep::RESULT_RASTER)
+            {
+               pBand->mpResult = &raster;
+               pBand->mpResultAccessor = pAccessor;
+            }
+            else
+            {
+               pBand->mInputs.push_back(&raster);
+               pBand->mInputAccessors.push_back(pAccessor);
+               readInputs.push_back(pAccessor.get());
+            }
+         }
+         map<int, shared_ptr<ProcessProgram> > programs;
+         programs[columnCount] = settings.create(steps, columnCount);
+         pBand->mpWorker.reset(new TileWorker(steps, inputs, programs, mFailOnError, progress));
+         pipeline.readBand(readInputs, *RM_NULLCHK(pBand->mpResultAccessor), rowCount);
+         bands.push_back(pBand);
+         ++readBands;
+
+         skipRows(rowCount);
+         try
+         {
+            nextBand();
+         }
+         catch (const RasterMathException& e)
+         {
+            bandError = e.getMessage();
+         }
+      }
+      if (band == readBands)
+      {
+         break;
+      }
+
+      PipelineBand& current = *bands[band-bands.front()->mIndex];
+      for (int row=0; row<rowCount; )
+      {
+         RowPipeline::Block& block = pipeline.nextBlock();
+         for (size_t i=0; i<current.mInputs.size(); ++i)
+         {
+            current.mInputs[i]->setRows(&block.mInputs[i][0], block.mFirstRow, block.mRowCount);
+         }
+         current.mpResult->setRows(&block.mResult[0], block.mFirstRow, block.mRowCount);
+         for (; row<block.mFirstRow+block.mRowCount; ++row)
+         {
+            TileScheduler::Tile tile = {row, 1, 0, columnCount};
+            current.mpWorker->computeTile(tile);
+            bool aborted = progress.addWorkCompleted(columnCount*mSteps.size());
+            if (aborted)
+            {
+               throw RasterMathAbortException("Raster Math aborted");
+            }
+         }
+         pipeline.writeBlock(block);
+
+         // the copies of the bands which have been written are released, along with their accessors
+         int writtenBands = pipeline.writtenBands();
+         while (!bands.empty() && bands.front()->mIndex < writtenBands && bands.front()->mIndex != band)
+         {
+            bands.pop_front();
+         }
+      }
+   }
+
+   pipeline.finish();
+   bands.clear();
+   if (!bandError.empty())
+   {
+      throw RasterMathException(bandError);
+   }
+}
+
+int64_t ProcessStack::totalWork() const
+{
+   RM_VERIFY(!mSteps.empty());
+   RM_NULLCHK(mSteps.back());
+   int bandCount = mSteps.back()->bands();
+   int rowCount = mSteps.back()->rows();
+   int columnCount = mSteps.back()->columns();
+
+   int64_t work = static_cast<int64_t>(bandCount) * rowCount * columnCount * mSteps.size();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin();
+      ppStep!=mSteps.end(); ++ppStep)
+   {
+      work += RM_NULLCHK(*ppStep)->oneTimeWork();
+   }
+
+   return work;
+}
+
+void ProcessStack::optimize(RasterMathProgress& progress)
+{
+   materializeArguments(progress);
+   replaceConstantInputs();
+   foldConstants(progress);
+   reduceStrength();
+   eliminateCommonSubexpressions();
+   hoistInvariants();
+   optimizeBranches(progress);
+}
+
+/**
+ * Optimizes the branches of conditionals. Each branch is only evaluated for some of the pixels,
+ * so nothing is hoisted out of it or shared with the rest of the formula.
+ */
+void ProcessStack::optimizeBranches(RasterMathProgress& progress)
+{
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType != ProcessStep::CONDITIONAL)
+      {
+         continue;
+      }
+      ProcessStepConditional& conditionalStep = static_cast<ProcessStepConditional&>(**ppStep);
+      ProcessStack* pBranches[] = {&conditionalStep.mTrueStack, &conditionalStep.mFalseStack};
+      for (int branch=0; branch<2; ++branch)
+      {
+         pBranches[branch]->foldConstants(progress);
+         pBranches[branch]->reduceStrength();
+         pBranches[branch]->eliminateCommonSubexpressions();
+         pBranches[branch]->optimizeBranches(progress);
+      }
+   }
+}
+
+/**
+ * Computes the statistics in the branches of conditionals before the first band, as the pixel loop
+ * would if it evaluated both branches, so each band still gets its own value of a statistic
+ * whichever band first takes its branch.
+ */
+void ProcessStack::executeBranchStatistics(RasterMathProgress& progress)
+{
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType != ProcessStep::CONDITIONAL)
+      {
+         continue;
+      }
+      ProcessStepConditional& conditionalStep = static_cast<ProcessStepConditional&>(**ppStep);
+      ProcessStack* pBranches[] = {&conditionalStep.mTrueStack, &conditionalStep.mFalseStack};
+      for (int branch=0; branch<2; ++branch)
+      {
+         vector<shared_ptr<ProcessStep> >& steps = pBranches[branch]->mSteps;
+         for (vector<shared_ptr<ProcessStep> >::iterator ppSubStep=steps.begin(); ppSubStep!=steps.end(); ++ppSubStep)
+         {
+            if (isStatisticStep(RM_NULLCHK(*ppSubStep)->mStepType))
+            {
+               static_cast<ProcessStepStatFunc&>(**ppSubStep).execute(progress);
+            }
+         }
+         pBranches[branch]->executeBranchStatistics(progress);
+      }
+   }
+}
+
+void ProcessStack::eliminateCommonSubexpressions()
+{
+   // every distinct subtree is numbered; operator steps are keyed by their type and the numbers
+   // of their operands, so a repeated subtree is found with a single lookup
+   map<vector<int64_t>, pair<int, size_t> > subtrees; // number and root step of each operator subtree
+   vector<pair<int, size_t> > values; // number and root step of each distinct raster or statistic step
+   vector<pair<int, size_t> > operands; // number and first step of each subtree on the working stack
+   vector<shared_ptr<ProcessStep> > steps;
+   steps.reserve(mSteps.size());
+   int subtreeCount = 0;
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      const ProcessStep& step = *RM_NULLCHK(*ppStep);
+      steps.push_back(*ppStep);
+      if (ProcessStep::isSink(step.type()))
+      {
+         RM_VERIFY(!operands.empty());
+         operands.pop_back();
+         continue;
+      }
+
+      size_t argCount = static_cast<size_t>(step.argCount());
+      RM_VERIFY(operands.size() >= argCount);
+      size_t start = (argCount == 0) ? steps.size()-1 : operands[operands.size()-argCount].second;
+      int subtree = -1;
+      size_t root = 0;
+      if (isOperatorStep(step.type()) || step.type() == ProcessStep::NUMBER)
+      {
+         vector<int64_t> key(1, step.type());
+         if (step.type() == ProcessStep::NUMBER)
+         {
+            key.push_back(valueBits(step.value()));
+         }
+         else if (ProcessStepConstantFunction::isConstantFunction(step.type()))
+         {
+            key.push_back(valueBits(static_cast<const ProcessStepConstantFunction&>(step).constant()));
+         }
+         for (size_t arg=operands.size()-argCount; arg<operands.size(); ++arg)
+         {
+            key.push_back(operands[arg].first);
+         }
+         if (isCommutativeStep(step.type()))
+         {
+            sort(key.begin()+1, key.end());
+         }
+
+         map<vector<int64_t>, pair<int, size_t> >::const_iterator pSubtree = subtrees.find(key);
+         if (pSubtree == subtrees.end())
+         {
+            subtrees[key] = make_pair(subtreeCount, steps.size()-1);
+         }
+         else if (step.type() != ProcessStep::NUMBER)
+         {
+            subtree = pSubtree->second.first;
+            root = pSubtree->second.second;
+         }
+         else
+         {
+            // numbers are cheaper to repeat than to reference
+            operands.push_back(make_pair(pSubtree->second.first, start));
+            continue;
+         }
+      }
+      else if (step.type() == ProcessStep::VALUE_RASTER || isStatisticStep(step.type()))
+      {
+         for (vector<pair<int, size_t> >::const_iterator pValue=values.begin(); pValue!=values.end(); ++pValue)
+         {
+            if (*steps[pValue->second] == step)
+            {
+               subtree = pValue->first;
+               root = pValue->second;
+               break;
+            }
+         }
+         if (subtree == -1)
+         {
+            values.push_back(make_pair(subtreeCount, steps.size()-1));
+         }
+      }
+
+      if (subtree == -1)
+      {
+         subtree = subtreeCount++;
+      }
+      else
+      {
+         steps.resize(start);
+         steps.push_back(shared_ptr<ProcessStep>(new ProcessStepReference(*steps[root])));
+      }
+      operands.resize(operands.size()-argCount);
+      operands.push_back(make_pair(subtree, start));
+   }
+   mSteps.swap(steps);
+}
+
+void ProcessStack::hoistInvariants()
+{
+   // a subtree of numbers, statistics and operators has the same value for every pixel of a band;
+   // each largest such subtree is replaced by a step which is evaluated once per band
+   set<const ProcessStep*> invariantSteps;
+   vector<pair<size_t, bool> > operands; // first step and invariance of each subtree on the working stack
+   vector<shared_ptr<ProcessStep> > steps;
+   steps.reserve(mSteps.size());
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      const ProcessStep& step = *RM_NULLCHK(*ppStep);
+      size_t argCount = ProcessStep::isSink(step.type()) ? 1 : static_cast<size_t>(step.argCount());
+      RM_VERIFY(operands.size() >= argCount);
+      size_t first = operands.size()-argCount;
+
+      bool invariant = isOperatorStep(step.type());
+      if (argCount == 0)
+      {
+         invariant = step.type() == ProcessStep::NUMBER || step.type() == ProcessStep::COMPUTED_SIGNATURE ||
+            isStatisticStep(step.type());
+         if (step.type() == ProcessStep::REFERENCE)
+         {
+            invariant = invariantSteps.count(&static_cast<const ProcessStepReference&>(step).mStep) != 0;
+         }
+      }
+      for (size_t arg=first; arg<operands.size(); ++arg)
+      {
+         invariant = invariant && operands[arg].second;
+      }
+
+      size_t start = (argCount == 0) ? steps.size() : operands[first].first;
+      if (invariant)
+      {
+         invariantSteps.insert(&step);
+      }
+      else
+      {
+         // the last operand is hoisted first, so the earlier operands keep their positions
+         for (size_t arg=operands.size(); arg>first; --arg)
+         {
+            size_t begin = operands[arg-1].first;
+            size_t end = (arg == operands.size()) ? steps.size() : operands[arg].first;
+            if (!operands[arg-1].second || (end-begin == 1 && steps[begin]->type() == ProcessStep::NUMBER))
+            {
+               continue;
+            }
+            shared_ptr<ProcessStepInvariant> pInvariant(new ProcessStepInvariant(
+               vector<shared_ptr<ProcessStep> >(steps.begin()+begin, steps.begin()+end)));
+            pInvariant->mSubStack.mToRadians = mToRadians;
+            steps.erase(steps.begin()+begin+1, steps.begin()+end);
+            steps[begin] = pInvariant;
+         }
+      }
+      steps.push_back(*ppStep);
+      operands.resize(first);
+      if (!ProcessStep::isSink(step.type()))
+      {
+         operands.push_back(make_pair(start, invariant));
+      }
+   }
+   mSteps.swap(steps);
+}
+
+bool ProcessStack::evaluateInvariants(RasterMathProgress& progress)
+{
+   bool invariants = false;
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      ProcessStep& step = *RM_NULLCHK(*ppStep);
+      if (step.mStepType != ProcessStep::BAND_INVARIANT)
+      {
+         continue;
+      }
+      invariants = true;
+
+      // statistics are computed first, so their failures are reported as usual
+      ProcessStepInvariant& invariantStep = static_cast<ProcessStepInvariant&>(step);
+      ProcessStack& subStack = invariantStep.mSubStack;
+      for (vector<shared_ptr<ProcessStep> >::iterator ppSubStep=subStack.mSteps.begin();
+         ppSubStep!=subStack.mSteps.end(); ++ppSubStep)
+      {
+         if (isStatisticStep(RM_NULLCHK(*ppSubStep)->mStepType))
+         {
+            static_cast<ProcessStepStatFunc&>(**ppSubStep).execute(progress);
+         }
+      }
+
+      // a computation error applies to every pixel of the band, according to the failure mode
+      vector<double> values;
+      invariantStep.mError = false;
+      try
+      {
+         subStack.compute(values, progress);
+      }
+      catch (const RasterMathException&)
+      {
+         invariantStep.mError = true;
+      }
+      if (invariantStep.mError)
+      {
+         step.mValue = mDefaultValue;
+      }
+      else
+      {
+         RM_VERIFY(values.size() == 1);
+         step.mValue = values.back();
+      }
+   }
+   return invariants;
+}
+
+/**
+ * Computes the arguments of statistics, such as the log(r1[2:50]) of
+ * log(r1[2:50]) - mean(log(r1[2:50])), into scratch rasters before the statistics are computed,
+ * when the same argument is used again. Otherwise it would be computed for every pixel by each
+ * statistic which takes it and again by the formula.
+ */
+void ProcessStack::materializeArguments(RasterMathProgress& progress)
+{
+   // statistics compute their arguments in double precision, in radians and with the C library's
+   // functions, and skip the pixels where they fail; the formula only matches them in this mode
+   if (mFastMath || mErrorMode != FLAG_ERRORS || (mEvaluationMode == ROW_EVALUATION && mPrecision != DOUBLE_PRECISION))
+   {
+      return;
+   }
+
+   size_t index = 0;
+   while (index < mSteps.size())
+   {
+      // materializing rewrites the steps, so the search starts again
+      index = materializeArgument(index, progress) ? 0 : index+1;
+   }
+}
+
+/**
+ * Materializes the argument of the statistic at index, if it is used more than once and computing
+ * it again for each use costs more than writing a scratch raster once and reading it for each use.
+ * The scratch raster goes where the result was asked to go, or when that was left open, in memory
+ * unless it is too large, when reading it costs more. An argument whose scratch raster is to be
+ * in memory but would not fit there is computed for each use instead.
+ *
+ * @return true if the steps were rewritten.
+ */
+bool ProcessStack::materializeArgument(size_t index, RasterMathProgress& progress)
+{
+   if (!isStatisticStep(RM_NULLCHK(mSteps[index])->mStepType))
+   {
+      return false;
+   }
+   const vector<shared_ptr<ProcessStep> >& statisticSteps =
+      static_cast<ProcessStepStatFunc&>(*mSteps[index]).mSubStack.getSteps();
+   RM_VERIFY(!statisticSteps.empty());
+   vector<shared_ptr<ProcessStep> > argument(statisticSteps.begin(), statisticSteps.end()-1);
+   if (!isMaterializable(argument))
+   {
+      return false;
+   }
+
+   // the formula's own copies of the argument are only replaced where the scratch raster
+   // reads the same as the argument would, as for a constant input
+   const ProcessStep& result = *RM_NULLCHK(mSteps.back());
+   const ProcessStep& value = *argument.back();
+   bool replaceSubtrees = value.mRows == result.mRows && value.mColumns == result.mColumns &&
+      (value.mBands == 1 || value.mBands == result.mBands);
+   vector<shared_ptr<ProcessStep> > statistics;
+   vector<size_t> subtrees; // the first step of each copy in the formula
+   for (size_t other=0; other<mSteps.size(); ++other)
+   {
+      ProcessStep& step = *RM_NULLCHK(mSteps[other]);
+      if (isStatisticStep(step.mStepType))
+      {
+         const vector<shared_ptr<ProcessStep> >& otherSteps = static_cast<ProcessStepStatFunc&>(step).mSubStack.getSteps();
+         if (otherSteps.size() == statisticSteps.size() &&
+            equal(argument.begin(), argument.end(), otherSteps.begin(), isSameStep))
+         {
+            statistics.push_back(mSteps[other]);
+         }
+      }
+      else if (replaceSubtrees && matchesSteps(other, argument))
+      {
+         subtrees.push_back(other);
+         other += argument.size()-1;
+      }
+   }
+
+   ProcessingLocation fitting = computeLocation(value.mRows, value.mColumns, value.mBands, FLT8BYTES);
+   if (mResultLocation.isValid() && mResultLocation == IN_MEMORY && fitting == ON_DISK)
+   {
+      return false;
+   }
+   bool inMemory = (mResultLocation.isValid() ? mResultLocation : fitting) == IN_MEMORY;
+   double uses = static_cast<double>(statistics.size()+subtrees.size());
+   double byteCost = (inMemory ? MEMORY_BYTE_COST : DISK_BYTE_COST)*sizeof(double);
+   if ((uses-1.0)*pixelCost(argument) <= (uses+1.0)*byteCost)
+   {
+      return false;
+   }
+
+   shared_ptr<ProcessStack> pScratch(new ProcessStack(*this));
+   pScratch->mSteps = argument;
+   pScratch->mpResultRaster = ModelResource<RasterElement>(RasterUtilities::createRasterElement(
+      getAvailableName("Raster Math Scratch", "RasterElement"), value.mRows, value.mColumns, value.mBands,
+      FLT8BYTES, BSQ, inMemory));
+   RasterElement* pElement = pScratch->mpResultRaster.get();
+   if (pElement == NULL)
+   {
+      return false;
+   }
+   pScratch->add(shared_ptr<ProcessStep>(new ProcessStepRasterResult(pElement)));
+   pScratch->setFailureMode(false, ProcessStepRaster::errorMarker());
+   pScratch->setEvaluationMode(ROW_EVALUATION); // as statistics compute their arguments
+   pScratch->setPrecision(DOUBLE_PRECISION);
+   pScratch->execute(progress);
+   mScratchStacks.push_back(pScratch);
+
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStatistic=statistics.begin(); ppStatistic!=statistics.end(); ++ppStatistic)
+   {
+      ProcessStack& subStack = static_cast<ProcessStepStatFunc&>(**ppStatistic).mSubStack;
+      shared_ptr<ProcessStep> pStatistic = subStack.mSteps.back();
+      subStack.mSteps.clear();
+      shared_ptr<ProcessStepRaster> pInput(new ProcessStepRaster("scratch", ProcessStep::VALUE_RASTER, pElement));
+      pInput->setMarksErrors(true);
+      subStack.add(pInput);
+      subStack.add(pStatistic);
+   }
+   for (vector<size_t>::reverse_iterator pFirst=subtrees.rbegin(); pFirst!=subtrees.rend(); ++pFirst)
+   {
+      shared_ptr<ProcessStepRaster> pInput(new ProcessStepRaster("scratch", ProcessStep::VALUE_RASTER, pElement));
+      pInput->setMarksErrors(true);
+      mSteps.erase(mSteps.begin()+*pFirst+1, mSteps.begin()+*pFirst+argument.size());
+      mSteps[*pFirst] = pInput;
+   }
+   return true;
+}
+
+/**
+ * Whether steps can be computed into a scratch raster: numbers, raster inputs and operators
+ * which compute the same values in the formula as in a statistic.
+ */
+bool ProcessStack::isMaterializable(const vector<shared_ptr<ProcessStep> >& steps) const
+{
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
+   {
+      const ProcessStep& step = *RM_NULLCHK(*ppStep);
+      if (step.mStepType == ProcessStep::VALUE_RASTER)
+      {
+         if (static_cast<const ProcessStepRaster&>(step).marksErrors())
+         {
+            return false;
+         }
+      }
+      else if ((!isOperatorStep(step.mStepType) && step.mStepType != ProcessStep::NUMBER) ||
+         (mToRadians != 1.0 && isAngleStep(step.mStepType)))
+      {
+         return false;
+      }
+   }
+   return !steps.empty();
+}
+
+/**
+ * Whether the steps starting at first are the same as steps.
+ */
+bool ProcessStack::matchesSteps(size_t first, const vector<shared_ptr<ProcessStep> >& steps) const
+{
+   return mSteps.size()-first >= steps.size() &&
+      equal(steps.begin(), steps.end(), mSteps.begin()+first, isSameStep);
+}
+
+/**
+ * Replaces the raster inputs whose pixels all have the same value, such as fill bands, with
+ * numbers, so the formula is folded around them and they are never read. Only inputs with the
+ * rows and columns of the result are replaced, as the pixels outside a smaller input read as
+ * the default value, and only inputs with one band or as many bands as the result. An input
+ * of several bands which are not all the same value still skips reading the bands which are
+ * constant, holding each one's value as its rows instead.
+ */
+void ProcessStack::replaceConstantInputs()
+{
+   const ProcessStep& result = *RM_NULLCHK(mSteps.back());
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      const ProcessStep& step = *RM_NULLCHK(*ppStep);
+      if (step.mStepType != ProcessStep::VALUE_RASTER || step.mRows != result.mRows ||
+         step.mColumns != result.mColumns || (step.mBands != 1 && step.mBands != result.mBands))
+      {
+         continue;
+      }
+      ProcessStepRaster& raster = static_cast<ProcessStepRaster&>(**ppStep);
+      map<int,double> constants;
+      bool sameValue = true;
+      for (int band=raster.mMinBand; band<=raster.mMaxBand; ++band)
+      {
+         double value = 0.0;
+         if (raster.isBandConstant(band, value))
+         {
+            sameValue = sameValue && (constants.empty() || constants.begin()->second == value);
+            constants[band] = value;
+         }
+      }
+      if (constants.size() == static_cast<size_t>(raster.mBands) && sameValue)
+      {
+         double value = constants.begin()->second;
+         stringstream description;
+         description << value;
+         *ppStep = shared_ptr<ProcessStep>(new ProcessStepNumber(description.str(), ProcessStep::NUMBER, value));
+         continue;
+      }
+      for (map<int,double>::const_iterator pConstant=constants.begin(); pConstant!=constants.end(); ++pConstant)
+      {
+         raster.setBandConstant(pConstant->first, pConstant->second);
+      }
+   }
+}
+
+void ProcessStack::foldConstants(RasterMathProgress& progress)
+{
+   size_t index = 0;
+   while (index < mSteps.size())
+   {
+      const ProcessStep& step = *RM_NULLCHK(mSteps[index]);
+      size_t argCount = static_cast<size_t>(step.argCount());
+      if (step.type() == ProcessStep::CONDITIONAL && index > 0 && RM_NULLCHK(mSteps[index-1])->type() == ProcessStep::NUMBER)
+      {
+         // a constant condition leaves only the branch it takes, which is folded in turn
+         const ProcessStepConditional& conditionalStep = static_cast<const ProcessStepConditional&>(step);
+         vector<shared_ptr<ProcessStep> > branch = ((mSteps[index-1]->value() != 0.0) ?
+            conditionalStep.mTrueStack : conditionalStep.mFalseStack).getSteps();
+         mSteps.erase(mSteps.begin()+index-1, mSteps.begin()+index+1);
+         mSteps.insert(mSteps.begin()+index-1, branch.begin(), branch.end());
+         --index;
+         continue;
+      }
+      if (!isOperatorStep(step.type()) || index < argCount)
+      {
+         ++index;
+         continue;
+      }
+
+      // operands are folded before the steps which use them, so a constant subtree is
+      // always a step whose operands are all numbers
+      size_t first = index-argCount;
+      bool constant = true;
+      for (size_t arg=first; arg<index; ++arg)
+      {
+         constant = constant && RM_NULLCHK(mSteps[arg])->type() == ProcessStep::NUMBER;
+      }
+      double value = 0.0;
+      if (constant && evaluateConstant(first, index, value, progress))
+      {
+         stringstream description;
+         description << value;
+         mSteps[first] = shared_ptr<ProcessStep>(new ProcessStepNumber(description.str(), ProcessStep::NUMBER, value));
+         mSteps.erase(mSteps.begin()+first+1, mSteps.begin()+index+1);
+         index = first+1;
+         continue;
+      }
+
+      // x*1, 1*x, x+0, 0+x, x-0, x/1 and x^1 leave the other operand in place of the step
+      double identity = 0.0;
+      bool commutative = false;
+      switch (step.type())
+      {
+         case ProcessStep::MULTIPLY:
+            identity = 1.0;
+            commutative = true;
+            break;
+         case ProcessStep::ADD:
+            commutative = true;
+            break;
+         case ProcessStep::SUBTRACT:
+            break;
+         case ProcessStep::DIVIDE:
+         case ProcessStep::EXPONENTIATE:
+            identity = 1.0;
+            break;
+         default:
+            ++index;
+            continue;
+      }
+      if (isNumber(*mSteps[index-1], identity))
+      {
+         mSteps.erase(mSteps.begin()+index-1, mSteps.begin()+index+1);
+         --index;
+         continue;
+      }
+      size_t left = subtreeStart(index-1);
+      if (commutative && left > 0 && isNumber(*mSteps[left-1], identity))
+      {
+         mSteps.erase(mSteps.begin()+index);
+         mSteps.erase(mSteps.begin()+left-1);
+         --index;
+         continue;
+      }
+      ++index;
+   }
+}
+
+void ProcessStack::reduceStrength()
+{
+   for (size_t index=0; index<mSteps.size(); ++index)
+   {
+      const ProcessStep& step = *RM_NULLCHK(mSteps[index]);
+      if (step.type() == ProcessStep::LOG2)
+      {
+         mSteps[index] = shared_ptr<ProcessStep>(
+            new ProcessStepConstantFunction(step, ProcessStep::SCALED_LOG10, 1.0/log10(2.0)));
+         continue;
+      }
+      if (step.argCount() != 2 || index == 0 || RM_NULLCHK(mSteps[index-1])->type() != ProcessStep::NUMBER)
+      {
+         continue;
+      }
+
+      // the right operand is a number; operands which would change the step's errors are left alone
+      double value = mSteps[index-1]->value();
+      ProcessStep::StepType type = step.type();
+      double constant = 0.0;
+      if (type == ProcessStep::DIVIDE && value != 0.0 && fabs(1.0/value) <= numeric_limits<double>::max())
+      {
+         type = ProcessStep::MULTIPLY_CONSTANT;
+         constant = 1.0/value;
+      }
+      else if (type == ProcessStep::EXPONENTIATE && value == 0.5)
+      {
+         type = ProcessStep::HALF_POWER;
+         constant = value;
+      }
+      else if (type == ProcessStep::EXPONENTIATE && value != 0.0 && fabs(value) <= 4.0 && value == floor(value))
+      {
+         type = ProcessStep::INTEGER_POWER;
+         constant = value;
+      }
+      else if (type == ProcessStep::LOGN && value > 0.0)
+      {
+         type = ProcessStep::SCALED_LOG10;
+         constant = 1.0/log10(value);
+      }
+      else
+      {
+         continue;
+      }
+      mSteps[index-1] = shared_ptr<ProcessStep>(new ProcessStepConstantFunction(step, type, constant));
+      mSteps.erase(mSteps.begin()+index);
+      --index;
+   }
+}
+
+bool ProcessStack::evaluateConstant(size_t first, size_t last, double& value, RasterMathProgress& progress) const
+{
+   ProcessStack constantStack;
+   constantStack.mSteps.assign(mSteps.begin()+first, mSteps.begin()+last+1);
+   constantStack.mToRadians = mToRadians;
+   constantStack.mFailOnError = true;
+
+   vector<double> values;
+   try
+   {
+      constantStack.compute(values, progress);
+   }
+   catch (const RasterMathException&)
+   {
+      // leave the error to be handled per pixel, according to the failure mode
+      return false;
+   }
+   RM_VERIFY(values.size() == 1);
+   value = values.back();
+   return true;
+}
+
+size_t ProcessStack::subtreeStart(size_t last) const
+{
+   int pending = 1;
+   for (size_t index=last+1; index>0; --index)
+   {
+      pending += RM_NULLCHK(mSteps[index-1])->argCount()-1;
+      if (pending == 0)
+      {
+         return index-1;
+      }
+   }
+   throw RasterMathException("Parse failure");
+}
+
+/**
+ * Finds the raster of a formula with one 8-bit or 16-bit input band, whose result can be looked
+ * up from a table of every possible input value rather than computed for each pixel.
+ *
+ * @return NULL if the formula has other pixel inputs, or the table would cost more than it saves.
+ */
+ProcessStepRaster* ProcessStack::lookupInput() const
+{
+   RM_VERIFY(!mSteps.empty());
+   const ProcessStep& result = *RM_NULLCHK(mSteps.back());
+   if (mEvaluationMode != ROW_EVALUATION || result.mStepType != ProcessStep::RESULT_RASTER || result.mBands != 1)
+   {
+      return NULL;
+   }
+
+   ProcessStepRaster* pInput = NULL;
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=mSteps.begin(); ppStep!=mSteps.end(); ++ppStep)
+   {
+      ProcessStep& step = *RM_NULLCHK(*ppStep);
+      if (step.mStepType == ProcessStep::VALUE_AOI || step.mStepType == ProcessStep::CONDITIONAL)
+      {
+         return NULL;
+      }
+      if (step.mStepType == ProcessStep::VALUE_RASTER)
+      {
+         if (pInput != NULL && !(*pInput == step))
+         {
+            return NULL;
+         }
+         pInput = static_cast<ProcessStepRaster*>(&step);
+      }
+   }
+
+   if (pInput == NULL || pInput->mBands != 1 || pInput->mRows != result.mRows || pInput->mColumns != result.mColumns)
+   {
+      return NULL;
+   }
+   int sampleCount = pInput->sampleCount();
+   if (sampleCount == 0 || static_cast<int64_t>(result.mRows)*result.mColumns < sampleCount)
+   {
+      return NULL;
+   }
+   return pInput;
+}
+
+/**
+ * Evaluates the formula once for each possible value of input, then writes the result raster
+ * by looking up each pixel's value. Values whose evaluation fails are handled according to the
+ * failure mode, as they are when each pixel is computed.
+ */
+void ProcessStack::executeLookup(ProcessStepRaster& input, RasterMathProgress& progress)
+{
+   evaluateInvariants(progress);
+
+   // the input is replaced by a reference to its value, which is set to each possible value in turn;
+   // its common subexpressions already refer to that value
+   shared_ptr<ProcessStep> pSample(new ProcessStepReference(input));
+   ProcessStack tableStack;
+   tableStack.mSteps.assign(mSteps.begin(), mSteps.end()-1);
+   for (vector<shared_ptr<ProcessStep> >::iterator ppStep=tableStack.mSteps.begin();
+      ppStep!=tableStack.mSteps.end(); ++ppStep)
+   {
+      if (RM_NULLCHK(*ppStep)->mStepType == ProcessStep::VALUE_RASTER)
+      {
+         *ppStep = pSample;
+      }
+   }
+   tableStack.mToRadians = mToRadians;
+   tableStack.mFailOnError = true;
+
+   int sampleCount = input.sampleCount();
+   vector<double> table(sampleCount, mDefaultValue);
+   vector<char> failed(sampleCount, 0);
+   vector<double> values;
+   for (int index=0; index<sampleCount; ++index)
+   {
+      input.mValue = input.sampleValue(index);
+      values.clear();
+      try
+      {
+         tableStack.compute(values, progress);
+      }
+      catch (const RasterMathException&)
+      {
+         failed[index] = 1;
+         continue;
+      }
+      RM_VERIFY(values.size() == 1);
+      if (mErrorMode == PROPAGATE_NAN && values.back() != values.back())
+      {
+         failed[index] = 1;
+         continue;
+      }
+      table[index] = values.back();
+   }
+
+   ProcessStepRaster& result = static_cast<ProcessStepRaster&>(*mSteps.back());
+   int rowCount = result.mRows;
+   int columnCount = result.mColumns;
+   vector<int> indices(columnCount);
+   vector<double> row(columnCount);
+   for (int rowIndex=0; rowIndex<rowCount; ++rowIndex)
+   {
+      input.readSampleIndices(&indices[0], columnCount);
+      for (int column=0; column<columnCount; ++column)
+      {
+         int index = indices[column];
+         if (mFailOnError && failed[index])
+         {
+            throw RasterMathException("Computation error");
+         }
+         row[column] = table[index];
+      }
+      result.writeRow(&row[0], columnCount);
+      nextRow();
+      bool aborted = progress.addWorkCompleted(columnCount*mSteps.size());
+      if (aborted)
+      {
+         throw RasterMathAbortException("Raster Math aborted");
+      }
+   }
+   nextBand();
+}
+
+/**
+ * Finds the raster of a formula which is only a raster input, such as r1[3:10], whose bands can
+ * be copied into the result a row at a time rather than computed for each pixel.
+ *
+ * @return NULL if the formula computes anything, or the input or result rows have no column stride.
+ */
+ProcessStepRaster* ProcessStack::copyInput() const
+{
+   RM_VERIFY(!mSteps.empty());
+   const ProcessStep& result = *RM_NULLCHK(mSteps.back());
+   if (mEvaluationMode != ROW_EVALUATION || result.mStepType != ProcessStep::RESULT_RASTER || mSteps.size() != 2 ||
+      RM_NULLCHK(mSteps.front())->mStepType != ProcessStep::VALUE_RASTER)
+   {
+      return NULL;
+   }
+
+   ProcessStepRaster& input = static_cast<ProcessStepRaster&>(*mSteps.front());
+   if (input.marksErrors() || input.mRows != result.mRows || input.mColumns != result.mColumns ||
+      (input.mBands != 1 && input.mBands != result.mBands) ||
+      input.columnStride() == 0 || static_cast<const ProcessStepRaster&>(result).columnStride() == 0)
+   {
+      return NULL;
+   }
+   return &input;
+}
+
+/**
+ * Copies each band of input into the result. Rows of the same integer data type whose values are
+ * adjacent are copied unchanged; the others are converted through double in one loop per row, with
+ * the values clamped to the result's data type as they are when each pixel is computed. When errors
+ * propagate as NaN, a NaN input value is an error, as it is for any formula.
+ */
+void ProcessStack::executeCopy(ProcessStepRaster& input, RasterMathProgress& progress)
+{
+   ProcessStepRaster& result = static_cast<ProcessStepRaster&>(*mSteps.back());
+   bool identical = false;
+   switch (input.mEncodingType)
+   {
+      case INT1UBYTE:
+      case INT1SBYTE:
+      case INT2UBYTES:
+      case INT2SBYTES:
+      case INT4UBYTES:
+      case INT4SBYTES:
+         identical = (input.mEncodingType == result.mEncodingType && input.columnStride() == 1 &&
+            result.columnStride() == 1);
+         break;
+      default:
+         break;
+   }
+
+   int bandCount = result.mBands;
+   int rowCount = result.mRows;
+   int columnCount = result.mColumns;
+   vector<double> row(columnCount);
+   for (int band=0; band<bandCount; ++band)
+   {
+      for (int rowIndex=0; rowIndex<rowCount; ++rowIndex)
+      {
+         // the rows of a cached raster or a constant band are held as values rather than read
+         if (identical && input.mpRows == NULL)
+         {
+            result.copyFullRow(input);
+         }
+         else
+         {
+            input.readFullRow(&row[0]);
+            if (mErrorMode == PROPAGATE_NAN)
+            {
+               for (int column=0; column<columnCount; ++column)
+               {
+                  if (row[column] != row[column])
+                  {
+                     if (mFailOnError)
+                     {
+                        throw RasterMathException ("Computation error");
+                     }
+                     row[column] = mDefaultValue;
+                  }
+               }
+            }
+            result.writeFullRow(&row[0]);
+         }
+         nextRow();
+         bool aborted = progress.addWorkCompleted(columnCount*mSteps.size());
+         if (aborted)
+         {
+            throw RasterMathAbortException("Raster Math aborted");
+         }
+      }
+      nextBand();
+   }
 }
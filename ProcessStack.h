@@ -19,11 +19,40 @@
 #include <vector>
 
 class ProcessStep;
+class ProcessStepRaster;
 class RasterMathProgress;
 
 class ProcessStack
 {
 public:
+   enum EvaluationMode
+   {
+      PIXEL_EVALUATION, // every step is applied to one pixel at a time
+      ROW_EVALUATION    // the steps are compiled into a ProcessProgram, which is applied to a whole row of pixels at a time
+   };
+
+   enum ErrorMode
+   {
+      FLAG_ERRORS,   // each failed operation is flagged where it happens
+      PROPAGATE_NAN  // with ROW_EVALUATION, failed operations produce NaN, and any NaN reaching a result is an error
+   };
+
+   enum Precision
+   {
+      DOUBLE_PRECISION,
+      SINGLE_PRECISION  // with ROW_EVALUATION, rows are read, computed and written as floats; statistics still accumulate in double
+   };
+
+   enum Execution
+   {
+      SERIAL_EXECUTION,   // the bands, rows and pixels are computed in turn
+      COPY_EXECUTION,     // the formula is a raster input, copied a row at a time
+      LOOKUP_EXECUTION,   // the formula is computed for each value of one 8-bit or 16-bit band
+      BAND_EXECUTION,     // whole bands are computed at once, one to a thread
+      TILE_EXECUTION,     // each band is computed in tiles by separate threads
+      PIPELINE_EXECUTION  // the rasters on disk are read ahead of the computation and written behind it
+   };
+
    ProcessStack();
    ProcessStack(const ProcessStack& rhs);
    void clear() { mSteps.clear(); }
@@ -33,11 +62,19 @@ public:
    const std::vector<boost::shared_ptr<ProcessStep> >& getSteps() const { return mSteps; }
    void compute(std::vector<double>& workingStack, RasterMathProgress& progress);
    void setDegrees(bool asDegrees);
+   void setFastMath(bool fastMath);
    RasterElement* releaseRaster();
    Signature* releaseSignature();
    void execute(RasterMathProgress& progress);
    void setFailureMode(bool failOnError, double defaultValue=0.0) { mFailOnError = failOnError; mDefaultValue = defaultValue; }
+   void setEvaluationMode(EvaluationMode mode) { mEvaluationMode = mode; }
+   void setErrorMode(ErrorMode mode) { mErrorMode = mode; }
+   void setPrecision(Precision precision) { mPrecision = precision; }
+   void setNativeCache(const std::string& directory) { mNativeCache = directory; } // empty to always interpret
+   void setThreadCount(int count);
+   void setPipelineMemory(int64_t bytes) { mPipelineMemory = bytes; } // 0 to read and write rasters on disk as they are computed
    int64_t totalWork() const;
+   Execution execution() const { return mExecution; } // how the last execute() computed the result
 
 private:
    void storeErrorValue();
@@ -46,14 +83,53 @@ private:
    void initializeSteps();
    void nextBand();
    void nextRow();
-   void optimize();
+   void optimize(RasterMathProgress& progress);
+   void materializeArguments(RasterMathProgress& progress);
+   bool materializeArgument(size_t index, RasterMathProgress& progress);
+   bool isMaterializable(const std::vector<boost::shared_ptr<ProcessStep> >& steps) const;
+   bool matchesSteps(size_t first, const std::vector<boost::shared_ptr<ProcessStep> >& steps) const;
+   void replaceConstantInputs();
+   void foldConstants(RasterMathProgress& progress);
+   void reduceStrength();
+   void eliminateCommonSubexpressions();
+   void hoistInvariants();
+   void optimizeBranches(RasterMathProgress& progress);
+   void executeBranchStatistics(RasterMathProgress& progress);
+   bool evaluateInvariants(RasterMathProgress& progress);
+   bool evaluateConstant(size_t first, size_t last, double& value, RasterMathProgress& progress) const;
+   size_t subtreeStart(size_t last) const;
+   ProcessStepRaster* lookupInput() const;
+   void executeLookup(ProcessStepRaster& input, RasterMathProgress& progress);
+   ProcessStepRaster* copyInput() const;
+   void executeCopy(ProcessStepRaster& input, RasterMathProgress& progress);
+   bool canCopySteps() const;
+   bool canExecuteTiles(int rowCount, int columnCount) const;
+   std::vector<boost::shared_ptr<ProcessStep> > copySteps(std::vector<boost::shared_ptr<ProcessStep> >& inputs, bool keepBand) const;
+   void executeTiles(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress);
+   void skipRows(int rowCount);
+   bool canExecuteBands(int bandCount, int rowCount, int columnCount) const;
+   bool canComputeBands(int bandCount, int rowCount, int columnCount) const;
+   void executeBands(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress);
+   bool hasRasterOnDisk() const;
+   bool canExecutePipeline(int rowCount, int columnCount) const;
+   void executePipeline(int bandCount, int rowCount, int columnCount, RasterMathProgress& progress);
 
    ModelResource<RasterElement> mpResultRaster;
-   std::vector<boost::shared_ptr<ProcessStep> > mSteps; // after mpResultRaster so destroyed before mpResultRaster
+   std::vector<boost::shared_ptr<ProcessStack> > mScratchStacks; // own the scratch rasters of materialized arguments
+   std::vector<boost::shared_ptr<ProcessStep> > mSteps; // after mpResultRaster and mScratchStacks so destroyed before them
    ModelResource<Signature> mpResultSignature;
+   ProcessingLocation mResultLocation; // as asked for by the user, or invalid to place rasters by their size
    double mDefaultValue;
    double mToRadians;
    bool mFailOnError;
+   EvaluationMode mEvaluationMode;
+   ErrorMode mErrorMode;
+   Precision mPrecision;
+   bool mFastMath;
+   std::string mNativeCache;
+   int mThreadCount;
+   int64_t mPipelineMemory;
+   Execution mExecution;
 };
 
 #endif
@@ -21,9 +21,13 @@
 #include "RasterDataDescriptor.h"
 #include "RasterElement.h"
 #include "RasterMathException.h"
+#include "Statistics.h"
 #include "switchOnEncoding.h"
 
+#include <algorithm>
+#include <limits>
 #include <sstream>
+#include <string.h>
 
 using namespace boost;
 using namespace Opticks;
@@ -31,6 +35,9 @@ using namespace std;
 
 namespace
 {
+   // a quiet NaN whose payload lies in the bits which a float keeps
+   const uint64_t ERROR_MARKER_BITS = 0x7FF81BD5A0000000ULL;
+
    Location<int,3> getArgDimensions(const vector<shared_ptr<ProcessStep> >& args, int argCount)
    {
       Location<int,3> dims;
@@ -66,6 +73,262 @@ namespace
    {
       return ModelServices::getDataValue(*pData, COMPLEX_MAGNITUDE);
    }
+
+   template<typename T, typename V>
+   void getRasterStepRow(T* pData, DataAccessor& accessor, V* pValues, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         if (i != 0)
+         {
+            accessor->nextColumn();
+            pData = reinterpret_cast<T*>(accessor->getColumn());
+         }
+         pValues[i] = static_cast<V>(getRasterStepValue(pData));
+      }
+   }
+
+   // integer samples are read and written without a round trip through double
+   template<typename T>
+   int getRasterStepInteger(T* pData)
+   {
+      return static_cast<int>(*pData);
+   }
+
+   int getRasterStepInteger(IntegerComplex* pData)
+   {
+      return static_cast<int>(getRasterStepValue(pData));
+   }
+
+   int getRasterStepInteger(FloatComplex* pData)
+   {
+      return static_cast<int>(getRasterStepValue(pData));
+   }
+
+   template<typename T>
+   void getRasterStepRow(T* pData, DataAccessor& accessor, int* pValues, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         if (i != 0)
+         {
+            accessor->nextColumn();
+            pData = reinterpret_cast<T*>(accessor->getColumn());
+         }
+         pValues[i] = getRasterStepInteger(pData);
+      }
+   }
+
+   template<typename T>
+   double maxValue()
+   {
+      return numeric_limits<T>::max();
+   }
+   template<typename T>
+   double minValue()
+   {
+      return numeric_limits<T>::min();
+   }
+   template<>
+   double minValue<float>()
+   {
+      return -numeric_limits<float>::max();
+   }
+   template<>
+   double minValue<double>()
+   {
+      return -numeric_limits<double>::max();
+   }
+
+   template<typename T>
+   double clampedValue(double data)
+   {
+      data = max(data, minValue<T>());
+      data = min(data, maxValue<T>());
+      return data;
+   }
+
+   template<typename T>
+   void setRasterStepValue(T* pRasterData, double data)
+   {
+      *pRasterData = clampedValue<T>(data);
+   }
+
+   template<typename T, typename V>
+   void setRasterStepRow(T* pRasterData, DataAccessor& accessor, const V* pValues, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         if (i != 0)
+         {
+            accessor->nextColumn();
+            pRasterData = reinterpret_cast<T*>(accessor->getColumn());
+         }
+         *pRasterData = clampedValue<T>(pValues[i]);
+      }
+   }
+
+   template<typename T>
+   void setRasterStepRow(T* pRasterData, DataAccessor& accessor, const int* pValues, int count)
+   {
+      const int minimum = static_cast<int>(max(minValue<T>(), static_cast<double>(numeric_limits<int>::min())));
+      const int maximum = static_cast<int>(min(maxValue<T>(), static_cast<double>(numeric_limits<int>::max())));
+      for (int i=0; i<count; ++i)
+      {
+         if (i != 0)
+         {
+            accessor->nextColumn();
+            pRasterData = reinterpret_cast<T*>(accessor->getColumn());
+         }
+         *pRasterData = static_cast<T>(min(max(pValues[i], minimum), maximum));
+      }
+   }
+
+   // the conversions of one data type, taking the raster data as DataAccessor returns it
+   template<typename T>
+   double readRasterValue(void* pData)
+   {
+      return getRasterStepValue(reinterpret_cast<T*>(pData));
+   }
+
+   template<typename T>
+   void writeRasterValue(void* pData, double value)
+   {
+      setRasterStepValue(reinterpret_cast<T*>(pData), value);
+   }
+
+   template<typename T, typename V>
+   void readRasterRow(void* pData, DataAccessor& accessor, V* pValues, int count)
+   {
+      getRasterStepRow(reinterpret_cast<T*>(pData), accessor, pValues, count);
+   }
+
+   template<typename T, typename V>
+   void writeRasterRow(void* pData, DataAccessor& accessor, const V* pValues, int count)
+   {
+      setRasterStepRow(reinterpret_cast<T*>(pData), accessor, pValues, count);
+   }
+
+   // whole rows whose values are stride elements apart, which are converted in one loop without the accessor
+   template<typename T>
+   void readRasterStrided(void* pData, int stride, double* pValues, int count)
+   {
+      T* pRasterData = reinterpret_cast<T*>(pData);
+      for (int i=0; i<count; ++i)
+      {
+         pValues[i] = getRasterStepValue(pRasterData+static_cast<size_t>(i)*stride);
+      }
+   }
+
+   template<typename T>
+   void writeRasterStrided(void* pData, int stride, const double* pValues, int count)
+   {
+      T* pRasterData = reinterpret_cast<T*>(pData);
+      for (int i=0; i<count; ++i)
+      {
+         setRasterStepValue(pRasterData+static_cast<size_t>(i)*stride, pValues[i]);
+      }
+   }
+}
+
+/**
+ * The reads and writes of one raster data type, instantiated for it, so that a step only switches
+ * on its encoding when it is created, and the conversions are inlined in the row loops.
+ */
+struct ProcessStepRaster::Conversions
+{
+   double (*mpReadValue)(void* pData);
+   void (*mpWriteValue)(void* pData, double value);
+   void (*mpReadDoubles)(void* pData, DataAccessor& accessor, double* pValues, int count);
+   void (*mpReadFloats)(void* pData, DataAccessor& accessor, float* pValues, int count);
+   void (*mpReadIntegers)(void* pData, DataAccessor& accessor, int* pValues, int count);
+   void (*mpWriteDoubles)(void* pData, DataAccessor& accessor, const double* pValues, int count);
+   void (*mpWriteFloats)(void* pData, DataAccessor& accessor, const float* pValues, int count);
+   void (*mpWriteIntegers)(void* pData, DataAccessor& accessor, const int* pValues, int count);
+   void (*mpReadStrided)(void* pData, int stride, double* pValues, int count);
+   void (*mpWriteStrided)(void* pData, int stride, const double* pValues, int count);
+
+   void readRow(void* pData, DataAccessor& accessor, double* pValues, int count) const
+   {
+      mpReadDoubles(pData, accessor, pValues, count);
+   }
+   void readRow(void* pData, DataAccessor& accessor, float* pValues, int count) const
+   {
+      mpReadFloats(pData, accessor, pValues, count);
+   }
+   void readRow(void* pData, DataAccessor& accessor, int* pValues, int count) const
+   {
+      mpReadIntegers(pData, accessor, pValues, count);
+   }
+   void writeRow(void* pData, DataAccessor& accessor, const double* pValues, int count) const
+   {
+      mpWriteDoubles(pData, accessor, pValues, count);
+   }
+   void writeRow(void* pData, DataAccessor& accessor, const float* pValues, int count) const
+   {
+      mpWriteFloats(pData, accessor, pValues, count);
+   }
+   void writeRow(void* pData, DataAccessor& accessor, const int* pValues, int count) const
+   {
+      mpWriteIntegers(pData, accessor, pValues, count);
+   }
+};
+
+/**
+ * The conversions of the data type T; the pointer only selects the type.
+ */
+template<typename T>
+const ProcessStepRaster::Conversions* ProcessStepRaster::conversionsFor(T*)
+{
+   static const Conversions sConversions =
+   {
+      readRasterValue<T>,
+      writeRasterValue<T>,
+      readRasterRow<T, double>,
+      readRasterRow<T, float>,
+      readRasterRow<T, int>,
+      writeRasterRow<T, double>,
+      writeRasterRow<T, float>,
+      writeRasterRow<T, int>,
+      readRasterStrided<T>,
+      writeRasterStrided<T>
+   };
+   return &sConversions;
+}
+
+bool ProcessStep::isSink(StepType type)
+{
+   switch (type)
+   {
+      case RESULT_NUMBER:
+      case RESULT_SIGNATURE:
+      case RESULT_RASTER:
+      case BAND_MIN_ACCUM:
+      case BAND_MAX_ACCUM:
+      case BAND_MEAN_ACCUM:
+      case BAND_GEOMEAN_ACCUM:
+      case BAND_HARMEAN_ACCUM:
+      case BAND_SUM_ACCUM:
+      case BAND_STDDEV_ACCUM:
+         return true;
+      default:
+         return false;
+   }
+}
+
+ProcessStepConstantFunction::ProcessStepConstantFunction(const ProcessStep& step, StepType type, double constant) :
+   ProcessStep(step.description(), type),
+   mConstant(constant)
+{
+   mArgCount = 1;
+   mRows = step.rows();
+   mColumns = step.columns();
+   mBands = step.bands();
+}
+
+bool ProcessStepConstantFunction::isConstantFunction(StepType type)
+{
+   return type == MULTIPLY_CONSTANT || type == INTEGER_POWER || type == HALF_POWER || type == SCALED_LOG10;
 }
 
 ProcessStepSignature::ProcessStepSignature(const std::string& description, Signature* pSignature, int bandCount) :
@@ -127,6 +390,44 @@ bool ProcessStepAoi::nextColumn()
    return true;
 }
 
+void ProcessStepAoi::skipColumns(int count)
+{
+   mCurrentColumn += count;
+   mValue = mpMask->getPixel(mCurrentColumn, mCurrentRow);
+}
+
+/**
+ * Moves to a pixel of the mask, where the step would be after reaching it with nextRow()
+ * and nextColumn().
+ */
+void ProcessStepAoi::moveTo(int row, int column)
+{
+   mCurrentRow = row;
+   mCurrentColumn = column;
+   mValue = mpMask->getPixel(mCurrentColumn, mCurrentRow);
+}
+
+void ProcessStepAoi::readRow(double* pValues, int count)
+{
+   readValues(pValues, count);
+}
+
+void ProcessStepAoi::readRow(float* pValues, int count)
+{
+   readValues(pValues, count);
+}
+
+template<typename T>
+void ProcessStepAoi::readValues(T* pValues, int count)
+{
+   for (int i=0; i<count; ++i)
+   {
+      pValues[i] = mpMask->getPixel(mCurrentColumn+i, mCurrentRow);
+   }
+   mCurrentColumn += count;
+   mValue = mpMask->getPixel(mCurrentColumn, mCurrentRow);
+}
+
 ProcessStepRaster::ProcessStepRaster(const std::string& description, StepType type, int minBand, int maxBand) : 
    ProcessStep(description, type),
    mMinBand(minBand),
@@ -136,8 +437,14 @@ ProcessStepRaster::ProcessStepRaster(const std::string& description, StepType ty
    mCurrentColumn(0),
    mpElement(NULL),
    mEncodingType(INT1UBYTE),
+   mpConversions(NULL),
    mAccessor(NULL, NULL),
-   mDefaultValue(1.0)
+   mDefaultValue(1.0),
+   mCached(false),
+   mpRows(NULL),
+   mFirstRow(0),
+   mRowCount(0),
+   mMarksErrors(false)
 {
    mArgCount = 0;
 
@@ -162,7 +469,36 @@ ProcessStepRaster::ProcessStepRaster(const std::string& description, StepType ty
    {
       throw RasterMathException("No RasterElement for the given raster indicator: " + description);
    }
+   attachElement(minBand, maxBand);
+}
+
+/**
+ * A step over every band of a raster which has no raster indicator, such as a scratch raster.
+ */
+ProcessStepRaster::ProcessStepRaster(const std::string& description, StepType type, RasterElement* pElement) : 
+   ProcessStep(description, type),
+   mMinBand(0),
+   mMaxBand(-1),
+   mCurrentBand(0),
+   mCurrentRow(0),
+   mCurrentColumn(0),
+   mpElement(RM_NULLCHK(pElement)),
+   mEncodingType(INT1UBYTE),
+   mpConversions(NULL),
+   mAccessor(NULL, NULL),
+   mDefaultValue(1.0),
+   mCached(false),
+   mpRows(NULL),
+   mFirstRow(0),
+   mRowCount(0),
+   mMarksErrors(false)
+{
+   mArgCount = 0;
+   attachElement(0, -1);
+}
 
+void ProcessStepRaster::attachElement(int minBand, int maxBand)
+{
    RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(mpElement->getDataDescriptor());
    if (pDescriptor == NULL)
    {
@@ -181,38 +517,107 @@ ProcessStepRaster::ProcessStepRaster(const std::string& description, StepType ty
    {
       stringstream indexErrors;
       indexErrors << "[" << minBand << ":" << maxBand << "], num bands = " << numBands;
-      throw RasterMathException("Invalid raster subscript(s) for raster indicator: " + description+indexErrors.str());
+      throw RasterMathException("Invalid raster subscript(s) for raster indicator: " + mDescription+indexErrors.str());
    }
 
    mBands = mMaxBand-mMinBand+1;
    mRows = pDescriptor->getRowCount();
    mColumns = pDescriptor->getColumnCount();
    mEncodingType = pDescriptor->getDataType();
+   switchOnEncoding(mEncodingType, mpConversions = conversionsFor, static_cast<void*>(NULL));
+   if (mpConversions == NULL)
+   {
+      throw RasterMathException("Unsupported data type for raster indicator: " + mDescription);
+   }
+}
+
+/**
+ * The value which a scratch raster holds where its subexpression failed: a NaN with a payload
+ * which arithmetic on other values does not produce, and which survives conversion to float.
+ */
+double ProcessStepRaster::errorMarker()
+{
+   double value = 0.0;
+   memcpy(&value, &ERROR_MARKER_BITS, sizeof(value));
+   return value;
+}
+
+bool ProcessStepRaster::isErrorMarker(double value)
+{
+   uint64_t bits = 0;
+   memcpy(&bits, &value, sizeof(bits));
+   return bits == ERROR_MARKER_BITS;
 }
 
 void ProcessStepRaster::initialize()
 {
    mCurrentBand = mMinBand;
+   mpCache.reset();
+   mpRows = NULL;
    updateAccessor();
+   if (mCached && mBands == 1 && mRows > 0 && mColumns > 0)
+   {
+      mpCache.reset(new vector<double>(static_cast<size_t>(mRows)*mColumns));
+      for (int row=0; row<mRows && mAccessor.isValid(); ++row)
+      {
+         mpConversions->readRow(mAccessor->getColumn(), mAccessor, &(*mpCache)[static_cast<size_t>(row)*mColumns], mColumns);
+         mAccessor->nextRow();
+      }
+      setRows(&(*mpCache)[0], 0, mRows);
+   }
    if (mStepType == ProcessStep::VALUE_RASTER)
    {
-      switchOnEncoding(mEncodingType, mValue = getRasterStepValue, mAccessor->getColumn());
+      updateValue();
    }
 }
 
+/**
+ * Keeps the converted values of a single-band raster in memory when the step is initialized,
+ * so a result with more bands reuses them instead of reading the band again for each of its bands.
+ */
+void ProcessStepRaster::setCached(bool cached)
+{
+   mCached = cached;
+}
+
+/**
+ * Treats the pixels holding errorMarker() as computation errors, for a raster into which a
+ * subexpression has been computed once.
+ */
+void ProcessStepRaster::setMarksErrors(bool marksErrors)
+{
+   mMarksErrors = marksErrors;
+}
+
+/**
+ * Moves back to the first pixel of a single-band raster, for the next band of the result.
+ */
+void ProcessStepRaster::rewind()
+{
+   if (mpRows == NULL)
+   {
+      mAccessor->toPixel(0,0);
+   }
+   mCurrentRow = 0;
+   mCurrentColumn = 0;
+}
+
 bool ProcessStepRaster::nextRow()
 {
    if (mCurrentRow != -1)
    {
       ++mCurrentRow;
-      mAccessor->nextRow();
+      if (mpRows == NULL)
+      {
+         mAccessor->nextRow();
+      }
    }
    else
    {
       return false;
    }
 
-   if (mAccessor.isValid() == false)
+   if (mpRows == NULL ? mAccessor.isValid() == false : mCurrentRow >= mRows)
    {
       mCurrentRow = -1;
       mCurrentColumn = -1;
@@ -223,7 +628,7 @@ bool ProcessStepRaster::nextRow()
       mCurrentColumn = 0;
       if (mStepType == ProcessStep::VALUE_RASTER)
       {
-         switchOnEncoding(mEncodingType, mValue = getRasterStepValue, mAccessor->getColumn());
+         updateValue();
       }
    }
 
@@ -239,10 +644,13 @@ bool ProcessStepRaster::nextColumn()
    if (mCurrentColumn < mColumns-1)
    {
       ++mCurrentColumn;
-      mAccessor->nextColumn();
+      if (mpRows == NULL)
+      {
+         mAccessor->nextColumn();
+      }
       if (mStepType == ProcessStep::VALUE_RASTER)
       {
-         switchOnEncoding(mEncodingType, mValue = getRasterStepValue, mAccessor->getColumn());
+         updateValue();
       }
    }
    else
@@ -254,15 +662,520 @@ bool ProcessStepRaster::nextColumn()
    return true;
 }
 
+/**
+ * Moves past the next count pixels of the current row, as count calls to nextColumn() would,
+ * without converting their values.
+ */
+void ProcessStepRaster::skipColumns(int count)
+{
+   if (count == 0 || mCurrentColumn == -1)
+   {
+      return;
+   }
+   int available = min(count, mColumns-mCurrentColumn);
+   if (mpRows == NULL)
+   {
+      for (int i=1; i<available; ++i)
+      {
+         mAccessor->nextColumn();
+      }
+   }
+   advanceColumns(available);
+}
+
+/**
+ * Moves to a pixel of the current band, into the state which nextRow() and nextColumn() would
+ * leave the step in on reaching it, without reading the pixels between. A pixel past the last
+ * row or column of the raster leaves the step without a value there. A step whose band is
+ * missing stays without values. Unlike nextRow(), moving past the last row does not report
+ * a row-size mismatch.
+ */
+void ProcessStepRaster::moveTo(int row, int column)
+{
+   if (mCurrentBand == -1)
+   {
+      return;
+   }
+   if (row >= mRows)
+   {
+      mCurrentRow = -1;
+      mCurrentColumn = -1;
+      mValue = mDefaultValue;
+      return;
+   }
+   mCurrentRow = row;
+   if (column >= mColumns)
+   {
+      mCurrentColumn = -1;
+      mValue = mDefaultValue;
+      return;
+   }
+   mCurrentColumn = column;
+   if (mpRows == NULL)
+   {
+      mAccessor->toPixel(mCurrentRow, mCurrentColumn);
+   }
+   if (mStepType == ProcessStep::VALUE_RASTER)
+   {
+      updateValue();
+   }
+}
+
+/**
+ * Gives a copy of a step an accessor of its own, at the step's current pixel, so the copy
+ * can be moved through the raster independently of the step it was copied from. A cached
+ * raster shares its cache with the step instead.
+ */
+void ProcessStepRaster::separateAccessor()
+{
+   if (mCurrentBand == -1 || mpRows != NULL)
+   {
+      return;
+   }
+   mAccessor = bandAccessor(mCurrentBand);
+   if (mCurrentRow != -1)
+   {
+      mAccessor->toPixel(mCurrentRow, (mCurrentColumn == -1) ? mColumns-1 : mCurrentColumn);
+   }
+}
+
+/**
+ * Drops the step's accessor, for a copy which is kept to compute its band later, and which is
+ * given an accessor with separateAccessor() only then.
+ */
+void ProcessStepRaster::releaseAccessor()
+{
+   mAccessor = DataAccessor(NULL, NULL);
+}
+
+/**
+ * Moves the step past count rows without reading them, to where count calls to nextRow() would
+ * leave it, for a step whose rows have been computed by copies of it.
+ */
+void ProcessStepRaster::skipRows(int count)
+{
+   if (mCurrentRow == -1)
+   {
+      return;
+   }
+   mCurrentRow += count;
+   if (mCurrentRow >= mRows)
+   {
+      mCurrentRow = -1;
+      mCurrentColumn = -1;
+      mValue = mDefaultValue;
+      if (mpRows == NULL)
+      {
+         // past the last row, where the accessor is no longer valid
+         mAccessor->toPixel(mRows-1, 0);
+         mAccessor->nextRow();
+      }
+      return;
+   }
+   mCurrentColumn = 0;
+   if (mpRows == NULL)
+   {
+      mAccessor->toPixel(mCurrentRow, mCurrentColumn);
+   }
+   if (mStepType == ProcessStep::VALUE_RASTER)
+   {
+      updateValue();
+   }
+}
+
+/**
+ * Reads the next count values of the current row, as count calls to nextColumn() would.
+ * Columns past the end of this raster are filled with the default value.
+ *
+ * @return false if nextColumn() would have reported a column-size mismatch.
+ */
+bool ProcessStepRaster::readRow(double* pValues, int count)
+{
+   return readValues(pValues, count);
+}
+
+bool ProcessStepRaster::readRow(float* pValues, int count)
+{
+   return readValues(pValues, count);
+}
+
+/**
+ * Reads integer rasters without converting through double; the values of other data types are truncated.
+ */
+bool ProcessStepRaster::readRow(int* pValues, int count)
+{
+   return readValues(pValues, count);
+}
+
+template<typename T>
+bool ProcessStepRaster::readValues(T* pValues, int count)
+{
+   int available = 0;
+   bool valid = (mCurrentColumn != -1);
+   if (valid)
+   {
+      available = min(count, mColumns-mCurrentColumn);
+      if (mpRows == NULL)
+      {
+         mpConversions->readRow(mAccessor->getColumn(), mAccessor, pValues, available);
+      }
+      else
+      {
+         const double* pCached = rowValues(mCurrentRow)+mCurrentColumn;
+         std::copy(pCached, pCached+available, pValues);
+      }
+      advanceColumns(available);
+   }
+   for (int i=available; i<count; ++i)
+   {
+      pValues[i] = mDefaultValue;
+   }
+
+   if (valid)
+   {
+      return count <= available;
+   }
+   return count == 0;
+}
+
+/**
+ * Stores value, clamped to the range of the raster's data type, at the current pixel.
+ */
+void ProcessStepRaster::writeValue(double value)
+{
+   mpConversions->mpWriteValue(mAccessor->getColumn(), value);
+}
+
+/**
+ * Stores the next count values of the current row and moves past them, as count pairs of
+ * writeValue() and nextColumn() calls would.
+ */
+void ProcessStepRaster::writeRow(const double* pValues, int count)
+{
+   writeValues(pValues, count);
+}
+
+void ProcessStepRaster::writeRow(const float* pValues, int count)
+{
+   writeValues(pValues, count);
+}
+
+void ProcessStepRaster::writeRow(const int* pValues, int count)
+{
+   writeValues(pValues, count);
+}
+
+template<typename T>
+void ProcessStepRaster::writeValues(const T* pValues, int count)
+{
+   RM_VERIFY(mCurrentColumn != -1 && count <= mColumns-mCurrentColumn);
+   if (mpRows == NULL)
+   {
+      mpConversions->writeRow(mAccessor->getColumn(), mAccessor, pValues, count);
+   }
+   else
+   {
+      // clamped to the data type once the rows are written with writeRows()
+      std::copy(pValues, pValues+count, RM_NULLCHK(rowValues(mCurrentRow))+mCurrentColumn);
+   }
+   advanceColumns(count);
+}
+
+/**
+ * The number of elements between adjacent columns of a row of one band in the raster's data:
+ * 1 for BSQ data or data with a single band, and the band count for BIP data. A whole row of
+ * such data can be read or written at once. Returns 0 for BIL data, whose rows are not read this way.
+ */
+int ProcessStepRaster::columnStride() const
+{
+   RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(RM_NULLCHK(mpElement)->getDataDescriptor());
+   int bandCount = static_cast<int>(RM_NULLCHK(pDescriptor)->getBandCount());
+   if (bandCount == 1 || pDescriptor->getInterleaveFormat() == BSQ)
+   {
+      return 1;
+   }
+   return (pDescriptor->getInterleaveFormat() == BIP) ? bandCount : 0;
+}
+
+/**
+ * Reads every value of the current row, which must have a columnStride(), without moving to
+ * the next row.
+ */
+void ProcessStepRaster::readFullRow(double* pValues)
+{
+   if (mpRows == NULL)
+   {
+      mpConversions->mpReadStrided(mAccessor->getRow(), columnStride(), pValues, mColumns);
+   }
+   else
+   {
+      const double* pCached = rowValues(mCurrentRow);
+      std::copy(pCached, pCached+mColumns, pValues);
+   }
+}
+
+/**
+ * Stores every value of the current row, which must have a columnStride(), clamped to the
+ * range of the raster's data type, without moving to the next row.
+ */
+void ProcessStepRaster::writeFullRow(const double* pValues)
+{
+   mpConversions->mpWriteStrided(mAccessor->getRow(), columnStride(), pValues, mColumns);
+}
+
+/**
+ * Copies the current row of input, which has this raster's columns and data type, unchanged.
+ * The values of both rows must be adjacent, and input must not be cached.
+ */
+void ProcessStepRaster::copyFullRow(ProcessStepRaster& input)
+{
+   RM_VERIFY(input.mEncodingType == mEncodingType && input.mColumns == mColumns && input.mpRows == NULL &&
+      input.columnStride() == 1 && columnStride() == 1);
+   RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(RM_NULLCHK(mpElement)->getDataDescriptor());
+   size_t rowBytes = static_cast<size_t>(RM_NULLCHK(pDescriptor)->getBytesPerElement())*mColumns;
+   memcpy(mAccessor->getRow(), input.mAccessor->getRow(), rowBytes);
+}
+
+/**
+ * Reads and writes the rowCount rows from firstRow in pValues, by row, instead of through the
+ * accessor, as the values of a cached raster are, for a step whose rows are read and written
+ * by other steps. Values written are only converted to the raster's data type when the rows
+ * are written with writeRows(). The step's other rows are without values.
+ */
+void ProcessStepRaster::setRows(double* pValues, int firstRow, int rowCount)
+{
+   mpRows = RM_NULLCHK(pValues);
+   mFirstRow = firstRow;
+   mRowCount = rowCount;
+}
+
+/**
+ * Reads the rowCount rows from firstRow, by row, into pValues, for the rows held by another
+ * step with setRows(). The rows past the last row of the raster are not read. The step's
+ * position in the raster is not kept.
+ */
+void ProcessStepRaster::readRows(int firstRow, int rowCount, double* pValues)
+{
+   rowCount = min(rowCount, mRows-firstRow);
+   if (rowCount <= 0)
+   {
+      return;
+   }
+   mAccessor->toPixel(firstRow, 0);
+   for (int row=0; row<rowCount && mAccessor.isValid(); ++row)
+   {
+      mpConversions->readRow(mAccessor->getColumn(), mAccessor, pValues+static_cast<size_t>(row)*mColumns, mColumns);
+      mAccessor->nextRow();
+   }
+}
+
+/**
+ * Stores the rowCount rows from firstRow, by row, clamped to the range of the raster's data
+ * type, as writeRow() would have stored them. The step's position in the raster is not kept.
+ */
+void ProcessStepRaster::writeRows(int firstRow, int rowCount, const double* pValues)
+{
+   mAccessor->toPixel(firstRow, 0);
+   for (int row=0; row<rowCount; ++row)
+   {
+      mpConversions->writeRow(mAccessor->getColumn(), mAccessor, pValues+static_cast<size_t>(row)*mColumns, mColumns);
+      mAccessor->nextRow();
+   }
+}
+
+/**
+ * Whether the raster's data is read from and written to disk as it is accessed.
+ */
+bool ProcessStepRaster::isOnDisk() const
+{
+   RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(RM_NULLCHK(mpElement)->getDataDescriptor());
+   return RM_NULLCHK(pDescriptor)->getProcessingLocation() != IN_MEMORY;
+}
+
+/**
+ * The number of distinct values of an 8-bit or 16-bit integer raster, or 0 for the other data types.
+ */
+int ProcessStepRaster::sampleCount() const
+{
+   switch (mEncodingType)
+   {
+      case INT1UBYTE:
+      case INT1SBYTE:
+         return 256;
+      case INT2UBYTES:
+      case INT2SBYTES:
+         return 65536;
+      default:
+         return 0;
+   }
+}
+
+/**
+ * The raster value numbered index by readSampleIndices().
+ */
+double ProcessStepRaster::sampleValue(int index) const
+{
+   switch (mEncodingType)
+   {
+      case INT1SBYTE:
+         return index + numeric_limits<signed char>::min();
+      case INT2SBYTES:
+         return index + numeric_limits<short>::min();
+      default:
+         return index;
+   }
+}
+
+/**
+ * Reads the next count values of the current row as their numbers from the smallest value of
+ * the data type, and moves past them. The raster must have a nonzero sampleCount().
+ */
+void ProcessStepRaster::readSampleIndices(int* pIndices, int count)
+{
+   RM_VERIFY(sampleCount() != 0);
+   readRow(pIndices, count);
+   int minimum = static_cast<int>(sampleValue(0));
+   if (minimum != 0)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         pIndices[i] -= minimum;
+      }
+   }
+}
+
+/**
+ * Moves past count columns whose data has already been handled, leaving the accessor
+ * on the last of them. Puts the step into the same state count calls to nextColumn() would.
+ */
+void ProcessStepRaster::advanceColumns(int count)
+{
+   if (count == 0 || mCurrentColumn == -1)
+   {
+      return;
+   }
+   mCurrentColumn += count-1;
+   nextColumn();
+}
+
+void ProcessStepRaster::updateValue()
+{
+   if (mpRows == NULL)
+   {
+      mValue = mpConversions->mpReadValue(mAccessor->getColumn());
+   }
+   else
+   {
+      // a row outside those held has no value until they are replaced with its own
+      const double* pValues = rowValues(mCurrentRow);
+      mValue = (pValues == NULL) ? mDefaultValue : pValues[mCurrentColumn];
+   }
+}
+
+/**
+ * The values of a row held in memory, or NULL if the row is not among them.
+ */
+double* ProcessStepRaster::rowValues(int row) const
+{
+   if (row < mFirstRow || row >= mFirstRow+mRowCount)
+   {
+      return NULL;
+   }
+   if (mpConstantRow.get() != NULL)
+   {
+      // every row of a constant band is the same row
+      return mpRows;
+   }
+   return mpRows+static_cast<size_t>(row-mFirstRow)*mColumns;
+}
+
+/**
+ * Gives the step an accessor of the current band. A band given a value with setBandConstant()
+ * has no accessor; the value is held as each of its rows, as a cached raster's rows are held.
+ */
 void ProcessStepRaster::updateAccessor()
+{
+   map<int,double>::const_iterator pConstant = mBandConstants.find(mCurrentBand);
+   if (pConstant != mBandConstants.end())
+   {
+      mAccessor = DataAccessor(NULL, NULL);
+      mpConstantRow.reset(new vector<double>(mColumns, pConstant->second));
+      setRows(&(*mpConstantRow)[0], 0, mRows);
+      return;
+   }
+   if (mpConstantRow.get() != NULL)
+   {
+      mpConstantRow.reset();
+      mpRows = NULL;
+   }
+   mAccessor = bandAccessor(mCurrentBand);
+}
+
+DataAccessor ProcessStepRaster::bandAccessor(int band) const
 {
    RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(RM_NULLCHK(mpElement)->getDataDescriptor());
-   DimensionDescriptor startBand = RM_NULLCHK(pDescriptor)->getActiveBand(mCurrentBand);
+   DimensionDescriptor startBand = RM_NULLCHK(pDescriptor)->getActiveBand(band);
    DimensionDescriptor stopBand = startBand;
    FactoryResource<DataRequest> pRequest;
    RM_NULLCHK(pRequest.get());
    pRequest->setBands(startBand, stopBand);
-   mAccessor = mpElement->getDataAccessor(pRequest.release());
+   return mpElement->getDataAccessor(pRequest.release());
+}
+
+/**
+ * Whether every pixel of one of the raster's bands has the same value, such as a fill band, and
+ * if so returns it in value. A band whose statistics have already been calculated with a
+ * different minimum and maximum is dismissed without reading it. Since statistics leave out
+ * bad values, a band whose statistics say it is constant is still scanned, up to the first row
+ * with a different value.
+ */
+bool ProcessStepRaster::isBandConstant(int band, double& value) const
+{
+   if (mRows == 0 || mColumns == 0)
+   {
+      return false;
+   }
+   RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(RM_NULLCHK(mpElement)->getDataDescriptor());
+   const Statistics* pStatistics = mpElement->getStatistics(RM_NULLCHK(pDescriptor)->getActiveBand(band));
+   if (pStatistics != NULL && pStatistics->areStatisticsCalculated() &&
+      pStatistics->getMin() != pStatistics->getMax())
+   {
+      return false;
+   }
+
+   vector<double> values(mColumns);
+   DataAccessor accessor = bandAccessor(band);
+   for (int row=0; row<mRows; ++row)
+   {
+      if (!accessor.isValid())
+      {
+         return false;
+      }
+      mpConversions->readRow(accessor->getColumn(), accessor, &values[0], mColumns);
+      accessor->nextRow();
+      if (row == 0)
+      {
+         value = values[0];
+      }
+      // a NaN value is never constant, as it equals nothing
+      for (int i=0; i<mColumns; ++i)
+      {
+         if (values[i] != value)
+         {
+            return false;
+         }
+      }
+   }
+   return true;
+}
+
+/**
+ * Gives every pixel of band value, as isBandConstant() has found, so the band is never read.
+ * The step holds the value as the band's rows from when it next moves to the band.
+ */
+void ProcessStepRaster::setBandConstant(int band, double value)
+{
+   mBandConstants[band] = value;
 }
 
 ProcessStepRasterResult::ProcessStepRasterResult(int bandCount) :
@@ -270,6 +1183,11 @@ ProcessStepRasterResult::ProcessStepRasterResult(int bandCount) :
 {
 }
 
+ProcessStepRasterResult::ProcessStepRasterResult(RasterElement* pElement) :
+   ProcessStepRaster("result", RESULT_RASTER, pElement)
+{
+}
+
 ProcessStepFunction::ProcessStepFunction(const std::string& description, StepType type, const vector<shared_ptr<ProcessStep> >& args, int argCount) : 
    ProcessStep(description, type)
 {
@@ -15,6 +15,7 @@
 #include "TypesFile.h"
 
 #include <boost/shared_ptr.hpp>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -25,6 +26,7 @@ class Signature;
 
 class ProcessStep
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    enum StepType 
@@ -84,7 +86,27 @@ public:
       AND,
       OR,
       CLAMP,
-      REFERENCE
+      REFERENCE,
+      // fused forms of common formula shapes, only produced by ProcessProgram
+      NORMALIZED_DIFFERENCE,
+      AFFINE,
+      ADD_CONSTANT,
+      MULTIPLY_CONSTANT,
+      LESS_THAN_CONSTANT,
+      GREATER_THAN_CONSTANT,
+      LESS_OR_EQUAL_CONSTANT,
+      GREATER_OR_EQUAL_CONSTANT,
+      EQUALS_CONSTANT,
+      NOT_EQUALS_CONSTANT,
+      // strength-reduced forms of steps with a constant operand, produced by ProcessStack::optimize()
+      // along with MULTIPLY_CONSTANT
+      INTEGER_POWER,
+      HALF_POWER,
+      SCALED_LOG10,
+      // a subexpression evaluated once per band, produced by ProcessStack::optimize()
+      BAND_INVARIANT,
+      // a choice between two subexpressions, only one of which is evaluated for each pixel
+      CONDITIONAL
    };
    ProcessStep(const std::string& description, StepType type) : 
       mDescription(description), 
@@ -97,6 +119,11 @@ public:
    {
    }
 
+   /**
+    * Sink steps consume the value on top of the working stack without producing one.
+    */
+   static bool isSink(StepType type);
+
    bool isScalar() const
    {
       return (mRows==1)&&(mColumns==1)&&(mBands==1);
@@ -166,6 +193,11 @@ public:
       return true;
    }
 
+   // moves an input past the next count pixels of its row without reading them
+   virtual void skipColumns(int count)
+   {
+   }
+
    virtual bool operator==(const ProcessStep& rhs) const
    {
       if (rhs.mStepType != mStepType) return false;
@@ -206,6 +238,7 @@ public:
 
 class ProcessStepSignature : public ProcessStep
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    ProcessStepSignature(const std::string& description, Signature* pSignature, int bandCount);
@@ -225,12 +258,17 @@ private:
 
 class ProcessStepAoi : public ProcessStep
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    ProcessStepAoi(const std::string& description);
    void initialize();
    bool nextRow();
    bool nextColumn();
+   void skipColumns(int count);
+   void moveTo(int row, int column);
+   void readRow(double* pValues, int count);
+   void readRow(float* pValues, int count);
    bool operator==(const ProcessStep& rhs) const
    {
       if (ProcessStep::operator ==(rhs))
@@ -241,6 +279,9 @@ public:
    }
 
 private:
+   template<typename T>
+   void readValues(T* pValues, int count);
+
    AoiElement* mpElement;
    const BitMask* mpMask;
    int mCurrentRow;
@@ -249,12 +290,48 @@ private:
 
 class ProcessStepRaster : public ProcessStep
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    ProcessStepRaster(const std::string& description, StepType type, int minBand, int maxBand);
+   ProcessStepRaster(const std::string& description, StepType type, RasterElement* pElement);
+   static double errorMarker();
+   static bool isErrorMarker(double value);
    void initialize();
    bool nextRow();
    bool nextColumn();
+   void skipColumns(int count);
+   void moveTo(int row, int column);
+   void separateAccessor();
+   void releaseAccessor();
+   void skipRows(int count);
+   bool readRow(double* pValues, int count);
+   bool readRow(float* pValues, int count);
+   bool readRow(int* pValues, int count);
+   void setCached(bool cached);
+   void setMarksErrors(bool marksErrors);
+   bool marksErrors() const
+   {
+      return mMarksErrors;
+   }
+   void rewind();
+   void writeValue(double value);
+   void writeRow(const double* pValues, int count);
+   void writeRow(const float* pValues, int count);
+   void writeRow(const int* pValues, int count);
+   int sampleCount() const;
+   double sampleValue(int index) const;
+   void readSampleIndices(int* pIndices, int count);
+   bool isBandConstant(int band, double& value) const;
+   void setBandConstant(int band, double value);
+   int columnStride() const;
+   void readFullRow(double* pValues);
+   void writeFullRow(const double* pValues);
+   void copyFullRow(ProcessStepRaster& input);
+   void setRows(double* pValues, int firstRow, int rowCount);
+   void readRows(int firstRow, int rowCount, double* pValues);
+   void writeRows(int firstRow, int rowCount, const double* pValues);
+   bool isOnDisk() const;
    bool operator==(const ProcessStep& rhs) const
    {
       if (ProcessStep::operator ==(rhs))
@@ -269,7 +346,20 @@ public:
    }
 
 protected:
+   struct Conversions;
+
+   template<typename T>
+   static const Conversions* conversionsFor(T* pType);
+   void attachElement(int minBand, int maxBand);
    void updateAccessor();
+   DataAccessor bandAccessor(int band) const;
+   void updateValue();
+   void advanceColumns(int count);
+   double* rowValues(int row) const;
+   template<typename T>
+   bool readValues(T* pValues, int count);
+   template<typename T>
+   void writeValues(const T* pValues, int count);
    int mMinBand;
    int mMaxBand;
    int mCurrentBand;
@@ -277,23 +367,66 @@ protected:
    int mCurrentColumn;
    RasterElement* mpElement;
    EncodingType mEncodingType;
+   const Conversions* mpConversions; // the reads and writes of the encoding's data type
    DataAccessor mAccessor;
    double mDefaultValue;
+   bool mCached;
+   boost::shared_ptr<std::vector<double> > mpCache; // the converted values of a cached single-band raster, by row
+   double* mpRows; // the converted values of the rows held in memory, read and written instead of the accessor's
+   int mFirstRow;
+   int mRowCount;
+   bool mMarksErrors; // pixels holding errorMarker() are computation errors
+   std::map<int,double> mBandConstants; // the value of each band whose pixels all hold it, which is never read
+   boost::shared_ptr<std::vector<double> > mpConstantRow; // the current band's value, held as each of its rows
 };
 
 class ProcessStepRasterResult : public ProcessStepRaster
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    ProcessStepRasterResult(int bandCount);
+   ProcessStepRasterResult(RasterElement* pElement);
+};
+
+/**
+ * A step of one operand whose other operand has been folded into the step as a constant.
+ */
+class ProcessStepConstantFunction : public ProcessStep
+{
+   friend class ProcessProgram;
+   friend class ProcessStack;
+public:
+   ProcessStepConstantFunction(const ProcessStep& step, StepType type, double constant);
+   static bool isConstantFunction(StepType type);
+   double constant() const
+   {
+      return mConstant;
+   }
+   bool operator==(const ProcessStep& rhs) const
+   {
+      if (ProcessStep::operator ==(rhs))
+      {
+         return mConstant == static_cast<const ProcessStepConstantFunction&>(rhs).mConstant;
+      }
+      return false;
+   }
+
+private:
+   double mConstant;
 };
 
 class ProcessStepReference : public ProcessStep
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
-   ProcessStepReference(const ProcessStep& ref) : ProcessStep("ref", REFERENCE), mRef(ref.valueRef()) {}
+   ProcessStepReference(const ProcessStep& ref) : ProcessStep("ref", REFERENCE), mStep(ref), mRef(ref.valueRef())
+   {
+      mArgCount = 0;
+   }
 private:
+   const ProcessStep& mStep;
    const double& mRef;
 };
 
@@ -0,0 +1,137 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "ProcessStepConditional.h"
+#include "RasterMathException.h"
+
+#include <algorithm>
+
+using namespace boost;
+using namespace std;
+
+namespace
+{
+   bool equalSteps(const vector<shared_ptr<ProcessStep> >& steps1, const vector<shared_ptr<ProcessStep> >& steps2)
+   {
+      if (steps1.size() != steps2.size())
+      {
+         return false;
+      }
+      for (size_t i=0; i<steps1.size(); ++i)
+      {
+         if (!(*RM_NULLCHK(steps1[i].get()) == *RM_NULLCHK(steps2[i].get())))
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+}
+
+ProcessStepConditional::ProcessStepConditional(const ProcessStep& condition, const vector<shared_ptr<ProcessStep> >& trueSteps,
+                                               const vector<shared_ptr<ProcessStep> >& falseSteps) :
+   ProcessStep("conditional", CONDITIONAL)
+{
+   RM_VERIFY(!trueSteps.empty() && !falseSteps.empty());
+   const ProcessStep& trueStep = *RM_NULLCHK(trueSteps.back());
+   const ProcessStep& falseStep = *RM_NULLCHK(falseSteps.back());
+   mArgCount = 1;
+   mRows = max(condition.rows(), max(trueStep.rows(), falseStep.rows()));
+   mColumns = max(condition.columns(), max(trueStep.columns(), falseStep.columns()));
+   mBands = max(condition.bands(), max(trueStep.bands(), falseStep.bands()));
+
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=trueSteps.begin(); ppStep!=trueSteps.end(); ++ppStep)
+   {
+      mTrueStack.add(*ppStep);
+   }
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=falseSteps.begin(); ppStep!=falseSteps.end(); ++ppStep)
+   {
+      mFalseStack.add(*ppStep);
+   }
+
+   // a failed branch is caught by the step which evaluates it, and handled according to its failure mode
+   mTrueStack.setFailureMode(true);
+   mFalseStack.setFailureMode(true);
+}
+
+void ProcessStepConditional::initialize()
+{
+   const vector<shared_ptr<ProcessStep> >& trueSteps = mTrueStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=trueSteps.begin(); ppStep!=trueSteps.end(); ++ppStep)
+   {
+      RM_NULLCHK(*ppStep)->initialize();
+   }
+   const vector<shared_ptr<ProcessStep> >& falseSteps = mFalseStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=falseSteps.begin(); ppStep!=falseSteps.end(); ++ppStep)
+   {
+      RM_NULLCHK(*ppStep)->initialize();
+   }
+}
+
+bool ProcessStepConditional::nextRow()
+{
+   bool valid = true;
+   const vector<shared_ptr<ProcessStep> >& trueSteps = mTrueStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=trueSteps.begin(); ppStep!=trueSteps.end(); ++ppStep)
+   {
+      valid = RM_NULLCHK(*ppStep)->nextRow() && valid;
+   }
+   const vector<shared_ptr<ProcessStep> >& falseSteps = mFalseStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=falseSteps.begin(); ppStep!=falseSteps.end(); ++ppStep)
+   {
+      valid = RM_NULLCHK(*ppStep)->nextRow() && valid;
+   }
+   return valid;
+}
+
+void ProcessStepConditional::skipColumns(int count)
+{
+   skipBranch(mTrueStack, count);
+   skipBranch(mFalseStack, count);
+}
+
+/**
+ * Moves the inputs of a branch past the pixels which take the other branch.
+ */
+void ProcessStepConditional::skipBranch(const ProcessStack& branch, int count)
+{
+   const vector<shared_ptr<ProcessStep> >& steps = branch.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin(); ppStep!=steps.end(); ++ppStep)
+   {
+      RM_NULLCHK(*ppStep)->skipColumns(count);
+   }
+}
+
+int64_t ProcessStepConditional::oneTimeWork() const
+{
+   int64_t work = 0;
+   const vector<shared_ptr<ProcessStep> >& trueSteps = mTrueStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=trueSteps.begin(); ppStep!=trueSteps.end(); ++ppStep)
+   {
+      work += RM_NULLCHK(*ppStep)->oneTimeWork();
+   }
+   const vector<shared_ptr<ProcessStep> >& falseSteps = mFalseStack.getSteps();
+   for (vector<shared_ptr<ProcessStep> >::const_iterator ppStep=falseSteps.begin(); ppStep!=falseSteps.end(); ++ppStep)
+   {
+      work += RM_NULLCHK(*ppStep)->oneTimeWork();
+   }
+   return work;
+}
+
+bool ProcessStepConditional::operator==(const ProcessStep& rhs) const
+{
+   if (!ProcessStep::operator ==(rhs))
+   {
+      return false;
+   }
+
+   const ProcessStepConditional& conditionalRhs = static_cast<const ProcessStepConditional&>(rhs);
+   return equalSteps(mTrueStack.getSteps(), conditionalRhs.mTrueStack.getSteps()) &&
+      equalSteps(mFalseStack.getSteps(), conditionalRhs.mFalseStack.getSteps());
+}
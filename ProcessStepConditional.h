@@ -0,0 +1,44 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef PROCESS_STEP_CONDITIONAL_H
+#define PROCESS_STEP_CONDITIONAL_H
+
+#include "ProcessStack.h"
+#include "ProcessStep.h"
+
+/**
+ * A choice between two subexpressions, such as if(r1>0, log(r1), 0), made for each pixel by
+ * the value of its operand: any value but 0 takes the first branch.
+ *
+ * Each branch is a ProcessStack of its own, which is only evaluated for the pixels that take it,
+ * so an operation which would fail in the other branch is never attempted. The inputs of the
+ * branch which is not taken skip the pixel without reading it.
+ */
+class ProcessStepConditional : public ProcessStep
+{
+   friend class ProcessProgram;
+   friend class ProcessStack;
+public:
+   ProcessStepConditional(const ProcessStep& condition, const std::vector<boost::shared_ptr<ProcessStep> >& trueSteps,
+      const std::vector<boost::shared_ptr<ProcessStep> >& falseSteps);
+   void initialize();
+   bool nextRow();
+   void skipColumns(int count);
+   int64_t oneTimeWork() const;
+   bool operator==(const ProcessStep& rhs) const;
+
+private:
+   static void skipBranch(const ProcessStack& branch, int count);
+
+   ProcessStack mTrueStack;
+   ProcessStack mFalseStack;
+};
+
+#endif
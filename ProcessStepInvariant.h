@@ -0,0 +1,50 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef PROCESS_STEP_INVARIANT_H
+#define PROCESS_STEP_INVARIANT_H
+
+#include "ProcessStack.h"
+#include "ProcessStep.h"
+#include "RasterMathException.h"
+
+/**
+ * A subexpression whose value is the same for every pixel of a band, such as mean(r1)*2.
+ *
+ * ProcessStack hoists these subexpressions out of its steps and evaluates each of them once
+ * at the start of every band, so the pixel loop reads the value like a number.
+ */
+class ProcessStepInvariant : public ProcessStep
+{
+   friend class ProcessProgram;
+   friend class ProcessStack;
+public:
+   ProcessStepInvariant(const std::vector<boost::shared_ptr<ProcessStep> >& steps) :
+      ProcessStep("invariant", BAND_INVARIANT),
+      mError(false)
+   {
+      RM_VERIFY(!steps.empty());
+      mRows = RM_NULLCHK(steps.back())->rows();
+      mColumns = steps.back()->columns();
+      mBands = steps.back()->bands();
+      mArgCount = 0;
+      for (std::vector<boost::shared_ptr<ProcessStep> >::const_iterator ppStep=steps.begin();
+         ppStep!=steps.end(); ++ppStep)
+      {
+         mSubStack.add(*ppStep);
+      }
+      mSubStack.setFailureMode(true);
+   }
+
+private:
+   ProcessStack mSubStack;
+   bool mError; // the subexpression has no value for this band, so every pixel gets the default value
+};
+
+#endif
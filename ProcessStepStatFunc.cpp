@@ -12,7 +12,9 @@
 #include "RasterMathProgress.h"
 
 #include <boost/bind.hpp>
+#include <algorithm>
 #include <limits>
+#include <math.h>
 
 using namespace boost;
 using namespace std;
@@ -22,9 +24,8 @@ ProcessStepStatFunc::ProcessStepStatFunc(const string& description, StepType typ
    mSubStackBands(mBands),
    mSubStackRows(mRows),
    mSubStackColumns(mColumns),
-   mAccumulator1(0.0),
-   mAccumulator2(0.0),
-   mAccumulator3(0.0)
+   mCurrentRow(0),
+   mpRows(new vector<StatAccumulator>)
 {
    mArgCount = 0;
    if (mRows == 1 && mColumns == 1)
@@ -33,8 +34,6 @@ ProcessStepStatFunc::ProcessStepStatFunc(const string& description, StepType typ
    }
 
    mRows = mColumns = 1;
-
-   initializeAccumulators();
 }
 
 void ProcessStepStatFunc::setSubStack(const vector<shared_ptr<ProcessStep> >& subStack)
@@ -45,19 +44,136 @@ void ProcessStepStatFunc::setSubStack(const vector<shared_ptr<ProcessStep> >& su
    }
 }
 
-void ProcessStepStatFunc::initializeAccumulators()
+/**
+ * Starts the accumulation of the first band, in the pass of the sub-stack.
+ */
+void ProcessStepStatFunc::initialize()
 {
-   mAccumulator1 = mAccumulator2 = mAccumulator3 = 0.0;
+   if (mStepType >= BAND_MIN_ACCUM && mStepType <= BAND_STDDEV_ACCUM)
+   {
+      mpRows.reset(new vector<StatAccumulator>(mRows, emptyAccumulator()));
+      mCurrentRow = 0;
+      mRowAccumulator = emptyAccumulator();
+   }
+}
 
+/**
+ * Keeps the partial value of the row just accumulated, and starts the next row.
+ */
+bool ProcessStepStatFunc::nextRow()
+{
+   if (mStepType >= BAND_MIN_ACCUM && mStepType <= BAND_STDDEV_ACCUM)
+   {
+      RM_VERIFY(mCurrentRow >= 0 && mCurrentRow < static_cast<int>(mpRows->size()));
+      (*mpRows)[mCurrentRow] = mRowAccumulator;
+      ++mCurrentRow;
+      mRowAccumulator = emptyAccumulator();
+   }
+   return true;
+}
+
+/**
+ * Starts accumulating a row other than the next one, in a copy of the step which computes
+ * some of the rows of the band in another thread.
+ */
+void ProcessStepStatFunc::moveTo(int row)
+{
+   mCurrentRow = row;
+   mRowAccumulator = emptyAccumulator();
+}
+
+StatAccumulator ProcessStepStatFunc::emptyAccumulator() const
+{
    switch (mStepType)
    {
-      case BAND_MIN:
-         mAccumulator1 = std::numeric_limits<double>::max();
+      case BAND_MIN_ACCUM:
+         return StatAccumulator(std::numeric_limits<double>::max());
+      case BAND_MAX_ACCUM:
+         return StatAccumulator(-std::numeric_limits<double>::max());
+      default:
+         return StatAccumulator();
+   }
+}
+
+/**
+ * Adds one pixel's value to the current row.
+ */
+void ProcessStepStatFunc::accumulate(double value)
+{
+   StatAccumulator pixel(value);
+   pixel.mCount = 1.0;
+   if (mStepType == BAND_GEOMEAN_ACCUM)
+   {
+      pixel.mValue = log(value);
+   }
+   else if (mStepType == BAND_HARMEAN_ACCUM)
+   {
+      pixel.mValue = 1.0/value;
+   }
+   merge(mRowAccumulator, pixel);
+}
+
+void ProcessStepStatFunc::merge(StatAccumulator& total, const StatAccumulator& partial) const
+{
+   if (partial.mCount == 0.0)
+   {
+      return;
+   }
+   switch (mStepType)
+   {
+      case BAND_MIN_ACCUM:
+         total.mValue = min(total.mValue, partial.mValue);
+         break;
+      case BAND_MAX_ACCUM:
+         total.mValue = max(total.mValue, partial.mValue);
          break;
-      case BAND_MAX:
-         mAccumulator1 = -std::numeric_limits<double>::max();
+      case BAND_STDDEV_ACCUM:
+      {
+         // Chan's update, which combines the means and squared deviations of two sets of values
+         // without the cancellation of a sum of squares
+         double count = total.mCount + partial.mCount;
+         double delta = partial.mValue - total.mValue;
+         total.mValue += delta*(partial.mCount/count);
+         total.mDeviations += partial.mDeviations + delta*delta*(total.mCount*partial.mCount/count);
+         break;
+      }
+      default:
+         total.mValue += partial.mValue;
          break;
    }
+   total.mCount += partial.mCount;
+}
+
+/**
+ * Merges the partial values of the band's rows, and starts the next band.
+ */
+StatAccumulator ProcessStepStatFunc::reduceRows()
+{
+   StatAccumulator total = reduceRows(0, mpRows->size());
+   mpRows->assign(mpRows->size(), emptyAccumulator());
+   mCurrentRow = 0;
+   mRowAccumulator = emptyAccumulator();
+   return total;
+}
+
+/**
+ * Merges the rows from first up to end, by merging the halves of the range, so that the order of the
+ * merges only depends on the number of rows.
+ */
+StatAccumulator ProcessStepStatFunc::reduceRows(size_t first, size_t end) const
+{
+   if (end-first == 1)
+   {
+      return (*mpRows)[first];
+   }
+   StatAccumulator total = emptyAccumulator();
+   if (end > first)
+   {
+      size_t middle = first + (end-first)/2;
+      total = reduceRows(first, middle);
+      merge(total, reduceRows(middle, end));
+   }
+   return total;
 }
 
 void ProcessStepStatFunc::execute(RasterMathProgress& progress)
@@ -13,27 +13,60 @@
 #include "ProcessStack.h"
 #include "ProcessStep.h"
 
+#include <boost/shared_ptr.hpp>
 #include <deque>
+#include <vector>
 
 class RasterMathProgress;
 
+/**
+ * The partial value of a statistic over some of the pixels of a band, which can be merged
+ * with the partial values of the other pixels.
+ */
+struct StatAccumulator
+{
+   StatAccumulator(double value=0.0) : mCount(0.0), mValue(value), mDeviations(0.0) {}
+
+   double mCount;
+   double mValue; // the minimum or maximum, the sum, the sum of logarithms or reciprocals, or the mean
+   double mDeviations; // for the standard deviation, the sum of squared deviations from the mean
+};
+
+/**
+ * A statistic of a band, computed by a pass of its sub-stack over the band before its first use.
+ *
+ * The pass accumulates the partial value of each row on its own, and at the end of each band the
+ * rows are merged pairwise, in a fixed tree over the row order. A statistic therefore has the same
+ * value however the rows are split among threads, and sums of many rows lose less precision than
+ * a running total. Standard deviations are merged from the means and squared deviations of the rows,
+ * and geometric means are computed from the sum of the logarithms.
+ */
 class ProcessStepStatFunc : public ProcessStepFunction
 {
+   friend class ProcessProgram;
    friend class ProcessStack;
 public:
    ProcessStepStatFunc(const std::string& description, StepType type, const std::vector<boost::shared_ptr<ProcessStep> >& args, int argCount);
    void setSubStack(const std::vector<boost::shared_ptr<ProcessStep> >& subStack);
    void execute(RasterMathProgress& progress);
-   void initializeAccumulators();
+   void initialize();
+   bool nextRow();
+   void moveTo(int row);
    int64_t oneTimeWork() const;
    bool operator==(const ProcessStep& rhs) const;
 
 protected:
+   StatAccumulator emptyAccumulator() const;
+   void accumulate(double value);
+   void merge(StatAccumulator& total, const StatAccumulator& partial) const;
+   StatAccumulator reduceRows();
+   StatAccumulator reduceRows(size_t first, size_t end) const;
+
    std::deque<double> mValues;
    ProcessStack mSubStack;
-   double mAccumulator1;
-   double mAccumulator2;
-   double mAccumulator3;
+   StatAccumulator mRowAccumulator; // the pixels of the current row accumulated so far
+   int mCurrentRow;
+   boost::shared_ptr<std::vector<StatAccumulator> > mpRows; // shared with the copies which accumulate rows in other threads
    int mSubStackBands;
    int mSubStackRows;
    int mSubStackColumns;
@@ -17,6 +17,7 @@
 #include "RasterMathRunner.h"
 #include "TypeConverter.h"
 
+#include <QtCore/QThread>
 #include <QtGui/QInputDialog>
 #include <QtGui/QMessageBox>
 #include <QtGui/QPushButton>
@@ -127,6 +128,7 @@ RasterMathDlgImp::RasterMathDlgImp(QWidget *pParent, RasterMathRunner& runner) :
    mpResultNameTextEdit->setText(defaultResultName);
 
    mpErrorUseTextEdit->setValidator(&mValidator);
+   mpThreadCountSpin->setValue(QThread::idealThreadCount());
 
    VERIFYNRV(connect(mpAddToFavoritesButton, SIGNAL(clicked()), this, SLOT(addToFavorites())));
    VERIFYNRV(connect(mpDeleteFavoriteButton, SIGNAL(clicked()), this, SLOT(deleteFavorite())));
@@ -143,6 +145,10 @@ RasterMathDlgImp::RasterMathDlgImp(QWidget *pParent, RasterMathRunner& runner) :
    VERIFYNRV(connect(mpErrorFailButton, SIGNAL(toggled(bool)), this, SLOT(needsRun())));
    VERIFYNRV(connect(mpErrorUseButton, SIGNAL(toggled(bool)), this, SLOT(needsRun())));
    VERIFYNRV(connect(mpErrorUseTextEdit, SIGNAL(textChanged (const QString &)), this, SLOT(needsRun())));
+   VERIFYNRV(connect(mpSinglePrecisionCheck, SIGNAL(toggled(bool)), this, SLOT(needsRun())));
+   VERIFYNRV(connect(mpFastMathCheck, SIGNAL(toggled(bool)), this, SLOT(needsRun())));
+   VERIFYNRV(connect(mpPropagateNanCheck, SIGNAL(toggled(bool)), this, SLOT(needsRun())));
+   VERIFYNRV(connect(mpThreadCountSpin, SIGNAL(valueChanged(int)), this, SLOT(needsRun())));
 
    for (int i=0; i<5; i++)
    {
@@ -343,6 +349,10 @@ void RasterMathDlgImp::executeRunner()
    mRunner.setResultEncoding(index2Encoding[mpPrecisionCombo->currentIndex()]);
    mRunner.setFailureMode(mpErrorFailButton->isChecked(), mpErrorUseTextEdit->text().toDouble());
    mRunner.setRadians(mpRadiansButton->isChecked());
+   mRunner.setSinglePrecision(mpSinglePrecisionCheck->isChecked());
+   mRunner.setFastMath(mpFastMathCheck->isChecked());
+   mRunner.setPropagateNan(mpPropagateNanCheck->isChecked());
+   mRunner.setThreadCount(mpThreadCountSpin->value());
    int locationIndex = mpLocationCombo->currentIndex();
    ProcessingLocation pl;
    map<int,ProcessingLocation> index2Location;
@@ -31,7 +31,8 @@ RmGrammar
    statfunc1 = ((str_p("min") | "max" | "mean" | "avg" | "geomean" | "harmean" | "sum" | "stdev") >> group)[&ParseStackBuilder::statfunc1];
    func2 = ((str_p("atan2") | "logn") >> '(' >> fullexpr >> ',' >> fullexpr >> ')')[&ParseStackBuilder::func2];
    func3 = ((str_p("clamp")) >> '(' >> fullexpr >> ',' >> fullexpr >> ',' >> fullexpr >> ')')[&ParseStackBuilder::func3];
-   function = (func1 | func2 | func3 | statfunc1);
+   conditional = ((str_p("if") | "where") >> '(' >> fullexpr >> ',' >> fullexpr >> ',' >> fullexpr >> ')')[&ParseStackBuilder::conditional];
+   function = (func1 | func2 | func3 | statfunc1 | conditional);
 
    group = '(' >> fullexpr >> ')';
 
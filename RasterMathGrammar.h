@@ -22,7 +22,7 @@ struct RmGrammar : public boost::spirit::grammar<RmGrammar>
          definition(RmGrammar const& self);
 
          boost::spirit::rule<ScannerT> fullexpr, expr8, expr7, expr6, expr5, expr4, expr3, expr2, expr1, 
-            not, conjunction, group, number, constant, func3, func2, func1, statfunc1, function, 
+            not, conjunction, group, number, constant, func3, func2, func1, statfunc1, conditional, function, 
             refName, ref1, ref2, ref3, ref4, ref5, fullref, integer, aoiName;
 
          boost::spirit::rule<ScannerT> const& start() const 
@@ -0,0 +1,971 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "RasterMathKernels.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define RM_X86
+#endif
+
+// The vector kernels are compiled with the instruction set enabled for just those functions,
+// so the plug-in as a whole still runs on CPUs without it.
+#if defined(RM_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#define RM_TARGET(isa)
+#define RM_HAVE_SSE2
+#if _MSC_VER >= 1600
+#define RM_HAVE_AVX
+#endif
+#if _MSC_VER >= 1910
+#define RM_HAVE_AVX512
+#endif
+#elif defined(RM_X86) && defined(__GNUC__)
+#include <cpuid.h>
+#define RM_TARGET(isa) __attribute__((target(isa)))
+#define RM_HAVE_SSE2
+#define RM_HAVE_AVX
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define RM_HAVE_AVX512
+#endif
+#endif
+
+#if defined(RM_HAVE_SSE2)
+#include <emmintrin.h>
+#endif
+#if defined(RM_HAVE_AVX) || defined(RM_HAVE_AVX512)
+#include <immintrin.h>
+#endif
+
+// scalar definitions of each operation, used by the SCALAR kernels and the vector kernel tails;
+// v2 is the left operand and v1 the right operand, as in ProcessStack::compute()
+#define RM_NEGATE -v1
+#define RM_ABS fabs(v1)
+#define RM_NOT static_cast<double>(v1==0.0)
+#define RM_ADD v2+v1
+#define RM_SUBTRACT v2-v1
+#define RM_MULTIPLY v2*v1
+#define RM_DIVIDE v2/v1
+#define RM_LESS_THAN static_cast<double>(v2<v1)
+#define RM_GREATER_THAN static_cast<double>(v2>v1)
+#define RM_LESS_OR_EQUAL static_cast<double>(v2<=v1)
+#define RM_GREATER_OR_EQUAL static_cast<double>(v2>=v1)
+#define RM_EQUALS static_cast<double>(v2==v1)
+#define RM_NOT_EQUALS static_cast<double>(v2!=v1)
+#define RM_AND static_cast<double>(v2!=0.0 && v1!=0.0)
+#define RM_OR static_cast<double>(v2!=0.0 || v1!=0.0)
+#define RM_CLAMP std::max(v2, std::min(v3, v1))
+#define RM_AFFINE v2*v1+v3
+
+
+// the vector kernel macros take the element type T of the rows, double or float
+#define RM_UNARY_KERNEL(target, name, T, vectorType, width, load, store, vectorExpr, scalarExpr) \
+   target void name(T* pDest, const T* pSrc, int count) \
+   { \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = load(pSrc+i); \
+         store(pDest+i, vectorExpr); \
+      } \
+      for (; i<count; ++i) \
+      { \
+         T v1 = pSrc[i]; \
+         pDest[i] = scalarExpr; \
+      } \
+   }
+
+#define RM_BINARY_KERNEL(target, name, T, vectorType, width, load, store, vectorExpr, scalarExpr) \
+   target void name(T* pDest, const T* pLhs, const T* pRhs, int count) \
+   { \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = load(pLhs+i); \
+         vectorType b = load(pRhs+i); \
+         store(pDest+i, vectorExpr); \
+      } \
+      for (; i<count; ++i) \
+      { \
+         T v2 = pLhs[i]; \
+         T v1 = pRhs[i]; \
+         pDest[i] = scalarExpr; \
+      } \
+   }
+
+// v2 is the row and v1 the constant, so the vector and scalar expressions of the binary kernels apply
+#define RM_CONSTANT_KERNEL(target, name, T, vectorType, width, load, store, set1, vectorExpr, scalarExpr) \
+   target void name(T* pDest, const T* pSrc, T value, int count) \
+   { \
+      vectorType b = set1(value); \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = load(pSrc+i); \
+         store(pDest+i, vectorExpr); \
+      } \
+      for (; i<count; ++i) \
+      { \
+         T v2 = pSrc[i]; \
+         T v1 = value; \
+         pDest[i] = scalarExpr; \
+      } \
+   }
+
+// the remaining lanes of a vector loop, or the whole row for the scalar kernels
+#define RM_DIVIDE_TAIL(T) \
+   for (; i<count; ++i) \
+   { \
+      T v2 = pLhs[i]; \
+      T v1 = pRhs[i]; \
+      if (v1 == 0.0) \
+      { \
+         pErrors[i] = 1; \
+         pDest[i] = errorValue; \
+         error = true; \
+      } \
+      else \
+      { \
+         pDest[i] = RM_DIVIDE; \
+      } \
+   }
+
+#define RM_CLAMP_TAIL(T) \
+   for (; i<count; ++i) \
+   { \
+      T v1 = pHigh[i]; \
+      T v2 = pLow[i]; \
+      T v3 = pValue[i]; \
+      pDest[i] = RM_CLAMP; \
+   }
+
+#define RM_AFFINE_TAIL(T) \
+   for (; i<count; ++i) \
+   { \
+      T v1 = scale; \
+      T v2 = pSrc[i]; \
+      T v3 = offset; \
+      pDest[i] = RM_AFFINE; \
+   }
+
+// the sum and difference are computed as separate steps, as the unfused formula would
+#define RM_NORMALIZED_DIFFERENCE_TAIL(T) \
+   for (; i<count; ++i) \
+   { \
+      T sum = pA[i]+pB[i]; \
+      if (sum == 0.0) \
+      { \
+         pErrors[i] = 1; \
+         pDest[i] = errorValue; \
+         error = true; \
+      } \
+      else \
+      { \
+         pDest[i] = (pA[i]-pB[i])/sum; \
+      } \
+   }
+
+namespace
+{
+   template<typename T>
+   void scalarNegate(T* pDest, const T* pSrc, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         T v1 = pSrc[i];
+         pDest[i] = RM_NEGATE;
+      }
+   }
+
+   template<typename T>
+   void scalarAbs(T* pDest, const T* pSrc, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         T v1 = pSrc[i];
+         pDest[i] = RM_ABS;
+      }
+   }
+
+   template<typename T>
+   void scalarNot(T* pDest, const T* pSrc, int count)
+   {
+      for (int i=0; i<count; ++i)
+      {
+         T v1 = pSrc[i];
+         pDest[i] = RM_NOT;
+      }
+   }
+
+#define RM_SCALAR_BINARY_KERNEL(name, scalarExpr) \
+   template<typename T> \
+   void name(T* pDest, const T* pLhs, const T* pRhs, int count) \
+   { \
+      for (int i=0; i<count; ++i) \
+      { \
+         T v2 = pLhs[i]; \
+         T v1 = pRhs[i]; \
+         pDest[i] = scalarExpr; \
+      } \
+   }
+
+   RM_SCALAR_BINARY_KERNEL(scalarAdd, RM_ADD)
+   RM_SCALAR_BINARY_KERNEL(scalarSubtract, RM_SUBTRACT)
+   RM_SCALAR_BINARY_KERNEL(scalarMultiply, RM_MULTIPLY)
+   RM_SCALAR_BINARY_KERNEL(scalarLessThan, RM_LESS_THAN)
+   RM_SCALAR_BINARY_KERNEL(scalarGreaterThan, RM_GREATER_THAN)
+   RM_SCALAR_BINARY_KERNEL(scalarLessOrEqual, RM_LESS_OR_EQUAL)
+   RM_SCALAR_BINARY_KERNEL(scalarGreaterOrEqual, RM_GREATER_OR_EQUAL)
+   RM_SCALAR_BINARY_KERNEL(scalarEquals, RM_EQUALS)
+   RM_SCALAR_BINARY_KERNEL(scalarNotEquals, RM_NOT_EQUALS)
+   RM_SCALAR_BINARY_KERNEL(scalarAnd, RM_AND)
+   RM_SCALAR_BINARY_KERNEL(scalarOr, RM_OR)
+
+   template<typename T>
+   bool scalarDivide(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, T errorValue, int count)
+   {
+      bool error = false;
+      int i = 0;
+      RM_DIVIDE_TAIL(T);
+      return error;
+   }
+
+   template<typename T>
+   void scalarClamp(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count)
+   {
+      int i = 0;
+      RM_CLAMP_TAIL(T);
+   }
+
+#define RM_SCALAR_CONSTANT_KERNEL(name, scalarExpr) \
+   template<typename T> \
+   void name(T* pDest, const T* pSrc, T value, int count) \
+   { \
+      for (int i=0; i<count; ++i) \
+      { \
+         T v2 = pSrc[i]; \
+         T v1 = value; \
+         pDest[i] = scalarExpr; \
+      } \
+   }
+
+   RM_SCALAR_CONSTANT_KERNEL(scalarAddConstant, RM_ADD)
+   RM_SCALAR_CONSTANT_KERNEL(scalarMultiplyConstant, RM_MULTIPLY)
+   RM_SCALAR_CONSTANT_KERNEL(scalarLessThanConstant, RM_LESS_THAN)
+   RM_SCALAR_CONSTANT_KERNEL(scalarGreaterThanConstant, RM_GREATER_THAN)
+   RM_SCALAR_CONSTANT_KERNEL(scalarLessOrEqualConstant, RM_LESS_OR_EQUAL)
+   RM_SCALAR_CONSTANT_KERNEL(scalarGreaterOrEqualConstant, RM_GREATER_OR_EQUAL)
+   RM_SCALAR_CONSTANT_KERNEL(scalarEqualsConstant, RM_EQUALS)
+   RM_SCALAR_CONSTANT_KERNEL(scalarNotEqualsConstant, RM_NOT_EQUALS)
+
+   template<typename T>
+   void scalarAffine(T* pDest, const T* pSrc, T scale, T offset, int count)
+   {
+      int i = 0;
+      RM_AFFINE_TAIL(T);
+   }
+
+   template<typename T>
+   bool scalarNormalizedDifference(T* pDest, const T* pA, const T* pB, char* pErrors, T errorValue, int count)
+   {
+      bool error = false;
+      int i = 0;
+      RM_NORMALIZED_DIFFERENCE_TAIL(T);
+      return error;
+   }
+
+// Each instruction set defines its kernels once, with sfx naming the packed type of the
+// intrinsics (pd or ps), and instantiates them for double and float rows. The kernels of
+// both row types share names, and the kernel tables pick them by their signatures.
+// Divisions blend in the error value rather than branching per lane. The clamp operand
+// order reproduces std::min/std::max, including for NaN values.
+#if defined(RM_HAVE_SSE2)
+#define RM_SSE2 RM_TARGET("sse2")
+
+   RM_SSE2 inline __m128d sse2Bool(__m128d mask)
+   {
+      return _mm_and_pd(mask, _mm_set1_pd(1.0));
+   }
+
+   RM_SSE2 inline __m128 sse2Bool(__m128 mask)
+   {
+      return _mm_and_ps(mask, _mm_set1_ps(1.0f));
+   }
+
+#define RM_SSE2_KERNELS(T, vectorType, width, sfx) \
+   RM_UNARY_KERNEL(RM_SSE2, sse2Negate, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      _mm_xor_##sfx(a, _mm_set1_##sfx(-0.0)), RM_NEGATE) \
+   RM_UNARY_KERNEL(RM_SSE2, sse2Abs, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      _mm_andnot_##sfx(_mm_set1_##sfx(-0.0), a), RM_ABS) \
+   RM_UNARY_KERNEL(RM_SSE2, sse2Not, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmpeq_##sfx(a, _mm_setzero_##sfx())), RM_NOT) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2Add, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      _mm_add_##sfx(a, b), RM_ADD) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2Subtract, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      _mm_sub_##sfx(a, b), RM_SUBTRACT) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2Multiply, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      _mm_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2LessThan, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmplt_##sfx(a, b)), RM_LESS_THAN) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2GreaterThan, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmpgt_##sfx(a, b)), RM_GREATER_THAN) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2LessOrEqual, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmple_##sfx(a, b)), RM_LESS_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2GreaterOrEqual, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmpge_##sfx(a, b)), RM_GREATER_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2Equals, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmpeq_##sfx(a, b)), RM_EQUALS) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2NotEquals, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_cmpneq_##sfx(a, b)), RM_NOT_EQUALS) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2And, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_and_##sfx(_mm_cmpneq_##sfx(a, _mm_setzero_##sfx()), _mm_cmpneq_##sfx(b, _mm_setzero_##sfx()))), RM_AND) \
+   RM_BINARY_KERNEL(RM_SSE2, sse2Or, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, \
+      sse2Bool(_mm_or_##sfx(_mm_cmpneq_##sfx(a, _mm_setzero_##sfx()), _mm_cmpneq_##sfx(b, _mm_setzero_##sfx()))), RM_OR) \
+   \
+   RM_SSE2 bool sse2Divide(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm_loadu_##sfx(pLhs+i); \
+         vectorType b = _mm_loadu_##sfx(pRhs+i); \
+         vectorType zero = _mm_cmpeq_##sfx(b, _mm_setzero_##sfx()); \
+         vectorType quotient = _mm_div_##sfx(a, b); \
+         int zeroMask = _mm_movemask_##sfx(zero); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm_or_##sfx(_mm_and_##sfx(zero, _mm_set1_##sfx(errorValue)), _mm_andnot_##sfx(zero, quotient)); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_DIVIDE_TAIL(T); \
+      return error; \
+   } \
+   \
+   RM_SSE2 void sse2Clamp(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count) \
+   { \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType upper = _mm_min_##sfx(_mm_loadu_##sfx(pHigh+i), _mm_loadu_##sfx(pValue+i)); \
+         _mm_storeu_##sfx(pDest+i, _mm_max_##sfx(upper, _mm_loadu_##sfx(pLow+i))); \
+      } \
+      RM_CLAMP_TAIL(T); \
+   } \
+   \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2AddConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      _mm_add_##sfx(a, b), RM_ADD) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2MultiplyConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      _mm_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2LessThanConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmplt_##sfx(a, b)), RM_LESS_THAN) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2GreaterThanConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmpgt_##sfx(a, b)), RM_GREATER_THAN) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2LessOrEqualConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmple_##sfx(a, b)), RM_LESS_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2GreaterOrEqualConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmpge_##sfx(a, b)), RM_GREATER_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2EqualsConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmpeq_##sfx(a, b)), RM_EQUALS) \
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2NotEqualsConstant, T, vectorType, width, _mm_loadu_##sfx, _mm_storeu_##sfx, _mm_set1_##sfx, \
+      sse2Bool(_mm_cmpneq_##sfx(a, b)), RM_NOT_EQUALS) \
+   \
+   RM_SSE2 void sse2Affine(T* pDest, const T* pSrc, T scale, T offset, int count) \
+   { \
+      vectorType s = _mm_set1_##sfx(scale); \
+      vectorType o = _mm_set1_##sfx(offset); \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         _mm_storeu_##sfx(pDest+i, _mm_add_##sfx(_mm_mul_##sfx(_mm_loadu_##sfx(pSrc+i), s), o)); \
+      } \
+      RM_AFFINE_TAIL(T); \
+   } \
+   \
+   RM_SSE2 bool sse2NormalizedDifference(T* pDest, const T* pA, const T* pB, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm_loadu_##sfx(pA+i); \
+         vectorType b = _mm_loadu_##sfx(pB+i); \
+         vectorType sum = _mm_add_##sfx(a, b); \
+         vectorType zero = _mm_cmpeq_##sfx(sum, _mm_setzero_##sfx()); \
+         vectorType quotient = _mm_div_##sfx(_mm_sub_##sfx(a, b), sum); \
+         int zeroMask = _mm_movemask_##sfx(zero); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm_or_##sfx(_mm_and_##sfx(zero, _mm_set1_##sfx(errorValue)), _mm_andnot_##sfx(zero, quotient)); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_NORMALIZED_DIFFERENCE_TAIL(T); \
+      return error; \
+   }
+
+   RM_SSE2_KERNELS(double, __m128d, 2, pd)
+   RM_SSE2_KERNELS(float, __m128, 4, ps)
+
+   RM_SSE2 inline __m128i sse2Load(const int* pSrc)
+   {
+      return _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+   }
+
+   RM_SSE2 inline void sse2Store(int* pDest, __m128i values)
+   {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(pDest), values);
+   }
+
+   // SSE2 has no 32-bit multiply keeping the low halves, so the even and odd lanes are multiplied apart
+   RM_SSE2 inline __m128i sse2MultiplyLow(__m128i a, __m128i b)
+   {
+      __m128i even = _mm_mul_epu32(a, b);
+      __m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+      return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+   }
+
+   RM_BINARY_KERNEL(RM_SSE2, sse2Add, int, __m128i, 4, sse2Load, sse2Store, _mm_add_epi32(a, b), RM_ADD)
+   RM_BINARY_KERNEL(RM_SSE2, sse2Subtract, int, __m128i, 4, sse2Load, sse2Store, _mm_sub_epi32(a, b), RM_SUBTRACT)
+   RM_BINARY_KERNEL(RM_SSE2, sse2Multiply, int, __m128i, 4, sse2Load, sse2Store, sse2MultiplyLow(a, b), RM_MULTIPLY)
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2AddConstant, int, __m128i, 4, sse2Load, sse2Store, _mm_set1_epi32,
+      _mm_add_epi32(a, b), RM_ADD)
+   RM_CONSTANT_KERNEL(RM_SSE2, sse2MultiplyConstant, int, __m128i, 4, sse2Load, sse2Store, _mm_set1_epi32,
+      sse2MultiplyLow(a, b), RM_MULTIPLY)
+
+   RM_SSE2 void sse2Affine(int* pDest, const int* pSrc, int scale, int offset, int count)
+   {
+      __m128i s = _mm_set1_epi32(scale);
+      __m128i o = _mm_set1_epi32(offset);
+      int i = 0;
+      for (; i+4<=count; i+=4)
+      {
+         sse2Store(pDest+i, _mm_add_epi32(sse2MultiplyLow(sse2Load(pSrc+i), s), o));
+      }
+      RM_AFFINE_TAIL(int);
+   }
+#endif
+
+#if defined(RM_HAVE_AVX)
+#define RM_AVX RM_TARGET("avx")
+
+   RM_AVX inline __m256d avxBool(__m256d mask)
+   {
+      return _mm256_and_pd(mask, _mm256_set1_pd(1.0));
+   }
+
+   RM_AVX inline __m256 avxBool(__m256 mask)
+   {
+      return _mm256_and_ps(mask, _mm256_set1_ps(1.0f));
+   }
+
+   RM_AVX inline __m256d avxNonZero(__m256d a)
+   {
+      return _mm256_cmp_pd(a, _mm256_setzero_pd(), _CMP_NEQ_UQ);
+   }
+
+   RM_AVX inline __m256 avxNonZero(__m256 a)
+   {
+      return _mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_NEQ_UQ);
+   }
+
+#define RM_AVX_KERNELS(T, vectorType, width, sfx) \
+   RM_UNARY_KERNEL(RM_AVX, avxNegate, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      _mm256_xor_##sfx(a, _mm256_set1_##sfx(-0.0)), RM_NEGATE) \
+   RM_UNARY_KERNEL(RM_AVX, avxAbs, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      _mm256_andnot_##sfx(_mm256_set1_##sfx(-0.0), a), RM_ABS) \
+   RM_UNARY_KERNEL(RM_AVX, avxNot, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, _mm256_setzero_##sfx(), _CMP_EQ_OQ)), RM_NOT) \
+   RM_BINARY_KERNEL(RM_AVX, avxAdd, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      _mm256_add_##sfx(a, b), RM_ADD) \
+   RM_BINARY_KERNEL(RM_AVX, avxSubtract, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      _mm256_sub_##sfx(a, b), RM_SUBTRACT) \
+   RM_BINARY_KERNEL(RM_AVX, avxMultiply, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      _mm256_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_BINARY_KERNEL(RM_AVX, avxLessThan, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_LT_OQ)), RM_LESS_THAN) \
+   RM_BINARY_KERNEL(RM_AVX, avxGreaterThan, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_GT_OQ)), RM_GREATER_THAN) \
+   RM_BINARY_KERNEL(RM_AVX, avxLessOrEqual, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_LE_OQ)), RM_LESS_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_AVX, avxGreaterOrEqual, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_GE_OQ)), RM_GREATER_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_AVX, avxEquals, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_EQ_OQ)), RM_EQUALS) \
+   RM_BINARY_KERNEL(RM_AVX, avxNotEquals, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_NEQ_UQ)), RM_NOT_EQUALS) \
+   RM_BINARY_KERNEL(RM_AVX, avxAnd, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_and_##sfx(avxNonZero(a), avxNonZero(b))), RM_AND) \
+   RM_BINARY_KERNEL(RM_AVX, avxOr, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, \
+      avxBool(_mm256_or_##sfx(avxNonZero(a), avxNonZero(b))), RM_OR) \
+   \
+   RM_AVX bool avxDivide(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm256_loadu_##sfx(pLhs+i); \
+         vectorType b = _mm256_loadu_##sfx(pRhs+i); \
+         vectorType zero = _mm256_cmp_##sfx(b, _mm256_setzero_##sfx(), _CMP_EQ_OQ); \
+         vectorType quotient = _mm256_div_##sfx(a, b); \
+         int zeroMask = _mm256_movemask_##sfx(zero); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm256_blendv_##sfx(quotient, _mm256_set1_##sfx(errorValue), zero); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm256_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_DIVIDE_TAIL(T); \
+      return error; \
+   } \
+   \
+   RM_AVX void avxClamp(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count) \
+   { \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType upper = _mm256_min_##sfx(_mm256_loadu_##sfx(pHigh+i), _mm256_loadu_##sfx(pValue+i)); \
+         _mm256_storeu_##sfx(pDest+i, _mm256_max_##sfx(upper, _mm256_loadu_##sfx(pLow+i))); \
+      } \
+      RM_CLAMP_TAIL(T); \
+   } \
+   \
+   RM_CONSTANT_KERNEL(RM_AVX, avxAddConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      _mm256_add_##sfx(a, b), RM_ADD) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxMultiplyConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      _mm256_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxLessThanConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_LT_OQ)), RM_LESS_THAN) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxGreaterThanConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_GT_OQ)), RM_GREATER_THAN) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxLessOrEqualConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_LE_OQ)), RM_LESS_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxGreaterOrEqualConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_GE_OQ)), RM_GREATER_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxEqualsConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_EQ_OQ)), RM_EQUALS) \
+   RM_CONSTANT_KERNEL(RM_AVX, avxNotEqualsConstant, T, vectorType, width, _mm256_loadu_##sfx, _mm256_storeu_##sfx, _mm256_set1_##sfx, \
+      avxBool(_mm256_cmp_##sfx(a, b, _CMP_NEQ_UQ)), RM_NOT_EQUALS) \
+   \
+   RM_AVX void avxAffine(T* pDest, const T* pSrc, T scale, T offset, int count) \
+   { \
+      vectorType s = _mm256_set1_##sfx(scale); \
+      vectorType o = _mm256_set1_##sfx(offset); \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         _mm256_storeu_##sfx(pDest+i, _mm256_add_##sfx(_mm256_mul_##sfx(_mm256_loadu_##sfx(pSrc+i), s), o)); \
+      } \
+      RM_AFFINE_TAIL(T); \
+   } \
+   \
+   RM_AVX bool avxNormalizedDifference(T* pDest, const T* pA, const T* pB, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm256_loadu_##sfx(pA+i); \
+         vectorType b = _mm256_loadu_##sfx(pB+i); \
+         vectorType sum = _mm256_add_##sfx(a, b); \
+         vectorType zero = _mm256_cmp_##sfx(sum, _mm256_setzero_##sfx(), _CMP_EQ_OQ); \
+         vectorType quotient = _mm256_div_##sfx(_mm256_sub_##sfx(a, b), sum); \
+         int zeroMask = _mm256_movemask_##sfx(zero); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm256_blendv_##sfx(quotient, _mm256_set1_##sfx(errorValue), zero); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm256_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_NORMALIZED_DIFFERENCE_TAIL(T); \
+      return error; \
+   }
+
+   RM_AVX_KERNELS(double, __m256d, 4, pd)
+   RM_AVX_KERNELS(float, __m256, 8, ps)
+#endif
+
+#if defined(RM_HAVE_AVX512)
+#define RM_AVX512 RM_TARGET("avx512f")
+
+   RM_AVX512 inline __m512d avx512Bool(__mmask8 mask)
+   {
+      return _mm512_maskz_mov_pd(mask, _mm512_set1_pd(1.0));
+   }
+
+   RM_AVX512 inline __m512 avx512Bool(__mmask16 mask)
+   {
+      return _mm512_maskz_mov_ps(mask, _mm512_set1_ps(1.0f));
+   }
+
+   // without AVX512DQ there is no floating-point xor, so the sign is flipped as an integer
+   RM_AVX512 inline __m512d avx512FlipSign(__m512d a)
+   {
+      return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(0x8000000000000000LL)));
+   }
+
+   RM_AVX512 inline __m512 avx512FlipSign(__m512 a)
+   {
+      return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), _mm512_set1_epi32(static_cast<int>(0x80000000u))));
+   }
+
+   // the absolute value clears the sign bit the same way, as _mm512_abs_pd and _mm512_abs_ps are newer than AVX-512F
+   RM_AVX512 inline __m512d avx512ClearSign(__m512d a)
+   {
+      return _mm512_castsi512_pd(_mm512_andnot_si512(_mm512_set1_epi64(0x8000000000000000LL), _mm512_castpd_si512(a)));
+   }
+
+   RM_AVX512 inline __m512 avx512ClearSign(__m512 a)
+   {
+      return _mm512_castsi512_ps(_mm512_andnot_si512(_mm512_set1_epi32(static_cast<int>(0x80000000u)), _mm512_castps_si512(a)));
+   }
+
+   RM_AVX512 inline __mmask8 avx512NonZero(__m512d a)
+   {
+      return _mm512_cmp_pd_mask(a, _mm512_setzero_pd(), _CMP_NEQ_UQ);
+   }
+
+   RM_AVX512 inline __mmask16 avx512NonZero(__m512 a)
+   {
+      return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_NEQ_UQ);
+   }
+
+#define RM_AVX512_KERNELS(T, vectorType, maskType, width, sfx) \
+   RM_UNARY_KERNEL(RM_AVX512, avx512Negate, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512FlipSign(a), RM_NEGATE) \
+   RM_UNARY_KERNEL(RM_AVX512, avx512Abs, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512ClearSign(a), RM_ABS) \
+   RM_UNARY_KERNEL(RM_AVX512, avx512Not, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, _mm512_setzero_##sfx(), _CMP_EQ_OQ)), RM_NOT) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512Add, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      _mm512_add_##sfx(a, b), RM_ADD) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512Subtract, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      _mm512_sub_##sfx(a, b), RM_SUBTRACT) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512Multiply, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      _mm512_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512LessThan, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_LT_OQ)), RM_LESS_THAN) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512GreaterThan, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_GT_OQ)), RM_GREATER_THAN) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512LessOrEqual, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_LE_OQ)), RM_LESS_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512GreaterOrEqual, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_GE_OQ)), RM_GREATER_OR_EQUAL) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512Equals, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_EQ_OQ)), RM_EQUALS) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512NotEquals, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_NEQ_UQ)), RM_NOT_EQUALS) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512And, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(static_cast<maskType>(avx512NonZero(a) & avx512NonZero(b))), RM_AND) \
+   RM_BINARY_KERNEL(RM_AVX512, avx512Or, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, \
+      avx512Bool(static_cast<maskType>(avx512NonZero(a) | avx512NonZero(b))), RM_OR) \
+   \
+   RM_AVX512 bool avx512Divide(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm512_loadu_##sfx(pLhs+i); \
+         vectorType b = _mm512_loadu_##sfx(pRhs+i); \
+         maskType zeroMask = _mm512_cmp_##sfx##_mask(b, _mm512_setzero_##sfx(), _CMP_EQ_OQ); \
+         vectorType quotient = _mm512_div_##sfx(a, b); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm512_mask_mov_##sfx(quotient, zeroMask, _mm512_set1_##sfx(errorValue)); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm512_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_DIVIDE_TAIL(T); \
+      return error; \
+   } \
+   \
+   RM_AVX512 void avx512Clamp(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count) \
+   { \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType upper = _mm512_min_##sfx(_mm512_loadu_##sfx(pHigh+i), _mm512_loadu_##sfx(pValue+i)); \
+         _mm512_storeu_##sfx(pDest+i, _mm512_max_##sfx(upper, _mm512_loadu_##sfx(pLow+i))); \
+      } \
+      RM_CLAMP_TAIL(T); \
+   } \
+   \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512AddConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      _mm512_add_##sfx(a, b), RM_ADD) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512MultiplyConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      _mm512_mul_##sfx(a, b), RM_MULTIPLY) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512LessThanConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_LT_OQ)), RM_LESS_THAN) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512GreaterThanConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_GT_OQ)), RM_GREATER_THAN) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512LessOrEqualConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_LE_OQ)), RM_LESS_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512GreaterOrEqualConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_GE_OQ)), RM_GREATER_OR_EQUAL) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512EqualsConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_EQ_OQ)), RM_EQUALS) \
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512NotEqualsConstant, T, vectorType, width, _mm512_loadu_##sfx, _mm512_storeu_##sfx, _mm512_set1_##sfx, \
+      avx512Bool(_mm512_cmp_##sfx##_mask(a, b, _CMP_NEQ_UQ)), RM_NOT_EQUALS) \
+   \
+   RM_AVX512 void avx512Affine(T* pDest, const T* pSrc, T scale, T offset, int count) \
+   { \
+      vectorType s = _mm512_set1_##sfx(scale); \
+      vectorType o = _mm512_set1_##sfx(offset); \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         _mm512_storeu_##sfx(pDest+i, _mm512_add_##sfx(_mm512_mul_##sfx(_mm512_loadu_##sfx(pSrc+i), s), o)); \
+      } \
+      RM_AFFINE_TAIL(T); \
+   } \
+   \
+   RM_AVX512 bool avx512NormalizedDifference(T* pDest, const T* pA, const T* pB, char* pErrors, T errorValue, int count) \
+   { \
+      bool error = false; \
+      int i = 0; \
+      for (; i+width<=count; i+=width) \
+      { \
+         vectorType a = _mm512_loadu_##sfx(pA+i); \
+         vectorType b = _mm512_loadu_##sfx(pB+i); \
+         vectorType sum = _mm512_add_##sfx(a, b); \
+         maskType zeroMask = _mm512_cmp_##sfx##_mask(sum, _mm512_setzero_##sfx(), _CMP_EQ_OQ); \
+         vectorType quotient = _mm512_div_##sfx(_mm512_sub_##sfx(a, b), sum); \
+         if (zeroMask != 0) \
+         { \
+            quotient = _mm512_mask_mov_##sfx(quotient, zeroMask, _mm512_set1_##sfx(errorValue)); \
+            for (int lane=0; lane<width; ++lane) \
+            { \
+               pErrors[i+lane] |= static_cast<char>((zeroMask >> lane) & 1); \
+            } \
+            error = true; \
+         } \
+         _mm512_storeu_##sfx(pDest+i, quotient); \
+      } \
+      RM_NORMALIZED_DIFFERENCE_TAIL(T); \
+      return error; \
+   }
+
+   RM_AVX512_KERNELS(double, __m512d, __mmask8, 8, pd)
+   RM_AVX512_KERNELS(float, __m512, __mmask16, 16, ps)
+
+   RM_BINARY_KERNEL(RM_AVX512, avx512Add, int, __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512,
+      _mm512_add_epi32(a, b), RM_ADD)
+   RM_BINARY_KERNEL(RM_AVX512, avx512Subtract, int, __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512,
+      _mm512_sub_epi32(a, b), RM_SUBTRACT)
+   RM_BINARY_KERNEL(RM_AVX512, avx512Multiply, int, __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512,
+      _mm512_mullo_epi32(a, b), RM_MULTIPLY)
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512AddConstant, int, __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_set1_epi32,
+      _mm512_add_epi32(a, b), RM_ADD)
+   RM_CONSTANT_KERNEL(RM_AVX512, avx512MultiplyConstant, int, __m512i, 16, _mm512_loadu_si512, _mm512_storeu_si512, _mm512_set1_epi32,
+      _mm512_mullo_epi32(a, b), RM_MULTIPLY)
+
+   RM_AVX512 void avx512Affine(int* pDest, const int* pSrc, int scale, int offset, int count)
+   {
+      __m512i s = _mm512_set1_epi32(scale);
+      __m512i o = _mm512_set1_epi32(offset);
+      int i = 0;
+      for (; i+16<=count; i+=16)
+      {
+         _mm512_storeu_si512(pDest+i, _mm512_add_epi32(_mm512_mullo_epi32(_mm512_loadu_si512(pSrc+i), s), o));
+      }
+      RM_AFFINE_TAIL(int);
+   }
+#endif
+
+#if defined(RM_X86)
+   void cpuid(unsigned int leaf, unsigned int registers[4])
+   {
+#if defined(_MSC_VER)
+      int values[4];
+      __cpuidex(values, static_cast<int>(leaf), 0);
+      for (int i=0; i<4; ++i)
+      {
+         registers[i] = static_cast<unsigned int>(values[i]);
+      }
+#else
+      __cpuid_count(leaf, 0, registers[0], registers[1], registers[2], registers[3]);
+#endif
+   }
+
+   // the register state the operating system saves on a context switch
+   unsigned long long enabledRegisterState()
+   {
+#if defined(_MSC_VER) && _MSC_VER >= 1600
+      return _xgetbv(0);
+#elif defined(__GNUC__)
+      unsigned int low = 0;
+      unsigned int high = 0;
+      __asm__ __volatile__ ("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+      return (static_cast<unsigned long long>(high) << 32) | low;
+#else
+      return 0;
+#endif
+   }
+#endif
+
+   RasterMathKernels::InstructionSet detectInstructionSet()
+   {
+      RasterMathKernels::InstructionSet best = RasterMathKernels::SCALAR;
+#if defined(RM_X86)
+      unsigned int registers[4] = {0, 0, 0, 0};
+      cpuid(0, registers);
+      unsigned int maxLeaf = registers[0];
+      if (maxLeaf < 1)
+      {
+         return best;
+      }
+
+      cpuid(1, registers);
+      const bool sse2 = (registers[3] & (1u << 26)) != 0;
+      const bool osxsave = (registers[2] & (1u << 27)) != 0;
+      const bool avx = (registers[2] & (1u << 28)) != 0;
+      if (!sse2)
+      {
+         return best;
+      }
+#if defined(RM_HAVE_SSE2)
+      best = RasterMathKernels::SSE2;
+#endif
+      if (!osxsave || !avx)
+      {
+         return best;
+      }
+
+      unsigned long long registerState = enabledRegisterState();
+      if ((registerState & 0x6) != 0x6)
+      {
+         return best;
+      }
+#if defined(RM_HAVE_AVX)
+      best = RasterMathKernels::AVX;
+#endif
+
+      if (maxLeaf >= 7)
+      {
+         cpuid(7, registers);
+         const bool avx512f = (registers[1] & (1u << 16)) != 0;
+         if (avx512f && (registerState & 0xe6) == 0xe6)
+         {
+#if defined(RM_HAVE_AVX512)
+            best = RasterMathKernels::AVX512;
+#endif
+         }
+      }
+#endif
+      return best;
+   }
+}
+
+const RasterMathKernels& RasterMathKernels::instance()
+{
+   static RasterMathKernels sKernels;
+   return sKernels;
+}
+
+// fills a kernel table with the kernels of one instruction set, whose names start with prefix;
+// the double or float overload of each kernel is chosen by the type of the table's pointers
+#define RM_USE_KERNELS(table, prefix) \
+   table.mpNegate = prefix##Negate; \
+   table.mpAbs = prefix##Abs; \
+   table.mpNot = prefix##Not; \
+   table.mpAdd = prefix##Add; \
+   table.mpSubtract = prefix##Subtract; \
+   table.mpMultiply = prefix##Multiply; \
+   table.mpLessThan = prefix##LessThan; \
+   table.mpGreaterThan = prefix##GreaterThan; \
+   table.mpLessOrEqual = prefix##LessOrEqual; \
+   table.mpGreaterOrEqual = prefix##GreaterOrEqual; \
+   table.mpEquals = prefix##Equals; \
+   table.mpNotEquals = prefix##NotEquals; \
+   table.mpAnd = prefix##And; \
+   table.mpOr = prefix##Or; \
+   table.mpDivide = prefix##Divide; \
+   table.mpClamp = prefix##Clamp; \
+   table.mpAddConstant = prefix##AddConstant; \
+   table.mpMultiplyConstant = prefix##MultiplyConstant; \
+   table.mpLessThanConstant = prefix##LessThanConstant; \
+   table.mpGreaterThanConstant = prefix##GreaterThanConstant; \
+   table.mpLessOrEqualConstant = prefix##LessOrEqualConstant; \
+   table.mpGreaterOrEqualConstant = prefix##GreaterOrEqualConstant; \
+   table.mpEqualsConstant = prefix##EqualsConstant; \
+   table.mpNotEqualsConstant = prefix##NotEqualsConstant; \
+   table.mpAffine = prefix##Affine; \
+   table.mpNormalizedDifference = prefix##NormalizedDifference
+
+#define RM_USE_INTEGER_KERNELS(table, prefix) \
+   table.mpAdd = prefix##Add; \
+   table.mpSubtract = prefix##Subtract; \
+   table.mpMultiply = prefix##Multiply; \
+   table.mpAddConstant = prefix##AddConstant; \
+   table.mpMultiplyConstant = prefix##MultiplyConstant; \
+   table.mpAffine = prefix##Affine
+
+RasterMathKernels::RasterMathKernels() :
+   mInstructionSet(detectInstructionSet())
+{
+   switch (mInstructionSet)
+   {
+#if defined(RM_HAVE_AVX512)
+      case AVX512:
+         RM_USE_KERNELS(mDoubleKernels, avx512);
+         RM_USE_KERNELS(mFloatKernels, avx512);
+         RM_USE_INTEGER_KERNELS(mIntegerKernels, avx512);
+         break;
+#endif
+#if defined(RM_HAVE_AVX)
+      case AVX:
+         RM_USE_KERNELS(mDoubleKernels, avx);
+         RM_USE_KERNELS(mFloatKernels, avx);
+         RM_USE_INTEGER_KERNELS(mIntegerKernels, sse2); // AVX has no 256-bit integer operations
+         break;
+#endif
+#if defined(RM_HAVE_SSE2)
+      case SSE2:
+         RM_USE_KERNELS(mDoubleKernels, sse2);
+         RM_USE_KERNELS(mFloatKernels, sse2);
+         RM_USE_INTEGER_KERNELS(mIntegerKernels, sse2);
+         break;
+#endif
+      default:
+         RM_USE_KERNELS(mDoubleKernels, scalar);
+         RM_USE_KERNELS(mFloatKernels, scalar);
+         RM_USE_INTEGER_KERNELS(mIntegerKernels, scalar);
+         break;
+   }
+}
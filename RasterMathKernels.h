@@ -0,0 +1,221 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef RASTERMATHKERNELS_H
+#define RASTERMATHKERNELS_H
+
+/**
+ * Row kernels for the arithmetic, comparison and logical step types.
+ *
+ * Each kernel processes count contiguous values. Binary kernels compute
+ * pDest[i] = pLhs[i] op pRhs[i], where pLhs holds the left operand of the formula
+ * (the deeper stack entry). Destinations may alias either source.
+ * Comparisons and logical operators produce 1.0 or 0.0, matching ProcessStack::compute().
+ * Constant kernels take a scalar right operand, and the fused kernels evaluate the common
+ * index formula shapes in a single pass over their inputs.
+ * Every kernel is available for rows of doubles and rows of floats; the float kernels
+ * process twice as many values per instruction. The add, subtract, multiply and affine kernels
+ * are also available for rows of 32-bit integers, whose values must be known not to overflow.
+ *
+ * The widest instruction set supported by both the compiler and the CPU is
+ * chosen the first time instance() is called.
+ */
+class RasterMathKernels
+{
+public:
+   enum InstructionSet
+   {
+      SCALAR,
+      SSE2,
+      AVX,
+      AVX512
+   };
+
+   static const RasterMathKernels& instance();
+
+   InstructionSet instructionSet() const { return mInstructionSet; }
+
+   template<typename T>
+   void negate(T* pDest, const T* pSrc, int count) const { table(pDest).mpNegate(pDest, pSrc, count); }
+   template<typename T>
+   void abs(T* pDest, const T* pSrc, int count) const { table(pDest).mpAbs(pDest, pSrc, count); }
+   template<typename T>
+   void logicalNot(T* pDest, const T* pSrc, int count) const { table(pDest).mpNot(pDest, pSrc, count); }
+
+#define RM_BINARY_FORWARDER(name, kernel) \
+   template<typename T> \
+   void name(T* pDest, const T* pLhs, const T* pRhs, int count) const { table(pDest).kernel(pDest, pLhs, pRhs, count); }
+
+   RM_BINARY_FORWARDER(add, mpAdd)
+   RM_BINARY_FORWARDER(subtract, mpSubtract)
+   RM_BINARY_FORWARDER(multiply, mpMultiply)
+   RM_BINARY_FORWARDER(lessThan, mpLessThan)
+   RM_BINARY_FORWARDER(greaterThan, mpGreaterThan)
+   RM_BINARY_FORWARDER(lessOrEqual, mpLessOrEqual)
+   RM_BINARY_FORWARDER(greaterOrEqual, mpGreaterOrEqual)
+   RM_BINARY_FORWARDER(equals, mpEquals)
+   RM_BINARY_FORWARDER(notEquals, mpNotEquals)
+   RM_BINARY_FORWARDER(logicalAnd, mpAnd)
+   RM_BINARY_FORWARDER(logicalOr, mpOr)
+#undef RM_BINARY_FORWARDER
+
+   /**
+    * Divides, flagging zero divisors in pErrors and storing errorValue for them.
+    *
+    * @return true if any divisor was zero.
+    */
+   template<typename T>
+   bool divide(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, double errorValue, int count) const
+   {
+      return table(pDest).mpDivide(pDest, pLhs, pRhs, pErrors, static_cast<T>(errorValue), count);
+   }
+
+   template<typename T>
+   void clamp(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count) const
+   {
+      table(pDest).mpClamp(pDest, pValue, pLow, pHigh, count);
+   }
+
+   // the constant is rounded to the row's value type once, as the row's values were
+#define RM_CONSTANT_FORWARDER(name, kernel) \
+   template<typename T> \
+   void name(T* pDest, const T* pSrc, double value, int count) const \
+   { \
+      table(pDest).kernel(pDest, pSrc, static_cast<T>(value), count); \
+   }
+
+   RM_CONSTANT_FORWARDER(addConstant, mpAddConstant)
+   RM_CONSTANT_FORWARDER(multiplyConstant, mpMultiplyConstant)
+   RM_CONSTANT_FORWARDER(lessThanConstant, mpLessThanConstant)
+   RM_CONSTANT_FORWARDER(greaterThanConstant, mpGreaterThanConstant)
+   RM_CONSTANT_FORWARDER(lessOrEqualConstant, mpLessOrEqualConstant)
+   RM_CONSTANT_FORWARDER(greaterOrEqualConstant, mpGreaterOrEqualConstant)
+   RM_CONSTANT_FORWARDER(equalsConstant, mpEqualsConstant)
+   RM_CONSTANT_FORWARDER(notEqualsConstant, mpNotEqualsConstant)
+#undef RM_CONSTANT_FORWARDER
+
+   /**
+    * Computes pDest[i] = pSrc[i]*scale+offset.
+    */
+   template<typename T>
+   void affine(T* pDest, const T* pSrc, double scale, double offset, int count) const
+   {
+      table(pDest).mpAffine(pDest, pSrc, static_cast<T>(scale), static_cast<T>(offset), count);
+   }
+
+   /**
+    * Computes (a-b)/(a+b), flagging zero sums in pErrors and storing errorValue for them.
+    *
+    * @return true if any sum was zero.
+    */
+   template<typename T>
+   bool normalizedDifference(T* pDest, const T* pA, const T* pB, char* pErrors, double errorValue, int count) const
+   {
+      return table(pDest).mpNormalizedDifference(pDest, pA, pB, pErrors, static_cast<T>(errorValue), count);
+   }
+
+   // integer rows, with integer constants
+   void add(int* pDest, const int* pLhs, const int* pRhs, int count) const { mIntegerKernels.mpAdd(pDest, pLhs, pRhs, count); }
+   void subtract(int* pDest, const int* pLhs, const int* pRhs, int count) const { mIntegerKernels.mpSubtract(pDest, pLhs, pRhs, count); }
+   void multiply(int* pDest, const int* pLhs, const int* pRhs, int count) const { mIntegerKernels.mpMultiply(pDest, pLhs, pRhs, count); }
+   void addConstant(int* pDest, const int* pSrc, int value, int count) const { mIntegerKernels.mpAddConstant(pDest, pSrc, value, count); }
+   void multiplyConstant(int* pDest, const int* pSrc, int value, int count) const
+   {
+      mIntegerKernels.mpMultiplyConstant(pDest, pSrc, value, count);
+   }
+   void affine(int* pDest, const int* pSrc, int scale, int offset, int count) const
+   {
+      mIntegerKernels.mpAffine(pDest, pSrc, scale, offset, count);
+   }
+
+   /**
+    * Raises value to an integer power with a chain of multiplies, for small exponents.
+    */
+   static double integerPower(double value, int exponent)
+   {
+      double result = 1.0;
+      double base = value;
+      for (int bits=(exponent < 0) ? -exponent : exponent; bits!=0; bits>>=1)
+      {
+         if ((bits & 1) != 0)
+         {
+            result *= base;
+         }
+         base *= base;
+      }
+      return (exponent < 0) ? 1.0/result : result;
+   }
+
+private:
+   RasterMathKernels();
+
+   /**
+    * The kernels for rows of one value type.
+    */
+   template<typename T>
+   struct Table
+   {
+      typedef void (*UnaryKernel)(T* pDest, const T* pSrc, int count);
+      typedef void (*BinaryKernel)(T* pDest, const T* pLhs, const T* pRhs, int count);
+      typedef bool (*CheckedBinaryKernel)(T* pDest, const T* pLhs, const T* pRhs, char* pErrors, T errorValue, int count);
+      typedef void (*ClampKernel)(T* pDest, const T* pValue, const T* pLow, const T* pHigh, int count);
+      typedef void (*ConstantKernel)(T* pDest, const T* pSrc, T value, int count);
+      typedef void (*AffineKernel)(T* pDest, const T* pSrc, T scale, T offset, int count);
+
+      UnaryKernel mpNegate;
+      UnaryKernel mpAbs;
+      UnaryKernel mpNot;
+      BinaryKernel mpAdd;
+      BinaryKernel mpSubtract;
+      BinaryKernel mpMultiply;
+      BinaryKernel mpLessThan;
+      BinaryKernel mpGreaterThan;
+      BinaryKernel mpLessOrEqual;
+      BinaryKernel mpGreaterOrEqual;
+      BinaryKernel mpEquals;
+      BinaryKernel mpNotEquals;
+      BinaryKernel mpAnd;
+      BinaryKernel mpOr;
+      CheckedBinaryKernel mpDivide;
+      ClampKernel mpClamp;
+      ConstantKernel mpAddConstant;
+      ConstantKernel mpMultiplyConstant;
+      ConstantKernel mpLessThanConstant;
+      ConstantKernel mpGreaterThanConstant;
+      ConstantKernel mpLessOrEqualConstant;
+      ConstantKernel mpGreaterOrEqualConstant;
+      ConstantKernel mpEqualsConstant;
+      ConstantKernel mpNotEqualsConstant;
+      AffineKernel mpAffine;
+      CheckedBinaryKernel mpNormalizedDifference;
+   };
+
+   /**
+    * The kernels for rows of integers.
+    */
+   struct IntegerTable
+   {
+      Table<int>::BinaryKernel mpAdd;
+      Table<int>::BinaryKernel mpSubtract;
+      Table<int>::BinaryKernel mpMultiply;
+      Table<int>::ConstantKernel mpAddConstant;
+      Table<int>::ConstantKernel mpMultiplyConstant;
+      Table<int>::AffineKernel mpAffine;
+   };
+
+   const Table<double>& table(const double*) const { return mDoubleKernels; }
+   const Table<float>& table(const float*) const { return mFloatKernels; }
+
+   InstructionSet mInstructionSet;
+   Table<double> mDoubleKernels;
+   Table<float> mFloatKernels;
+   IntegerTable mIntegerKernels;
+};
+
+#endif
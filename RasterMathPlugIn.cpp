@@ -25,7 +25,9 @@
 #include "RasterMathParser.h"
 #include "RasterMathPlugIn.h"
 #include "RasterMathRunner.h"
+#include "RasterMathTests.h"
 
+#include <QtCore/QThread>
 #include <QtGui/QMessageBox>
 #include <sstream>
 
@@ -40,6 +42,12 @@ namespace
    const string FAIL_ON_ERROR = "Fail on Error";
    const string DEFAULT_VALUE = "Default Value";
    const string RADIANS = "Radians";
+   const string SINGLE_PRECISION = "Single Precision";
+   const string FAST_MATH = "Fast Math";
+   const string PROPAGATE_NAN = "Propagate NaN";
+   const string NATIVE_CACHE = "Native Cache Directory";
+   const string THREAD_COUNT = "Thread Count";
+   const string PIPELINE_MEMORY = "Pipeline Memory";
    const string LOCATION = "Location";
    const string RASTER_ARG = "Raster ";
    const string RASTER2 = RASTER_ARG+"2";
@@ -167,12 +175,24 @@ bool RasterMathPlugIn::batchExecute(PlugInArgList* pInParam, PlugInArgList* pOut
    double defaultValue = *RM_NULLCHK(pInParam->getPlugInArgValue<double>(DEFAULT_VALUE));
    bool failOnError = *RM_NULLCHK(pInParam->getPlugInArgValue<bool>(FAIL_ON_ERROR));
    bool radians = *RM_NULLCHK(pInParam->getPlugInArgValue<bool>(RADIANS));
+   bool singlePrecision = *RM_NULLCHK(pInParam->getPlugInArgValue<bool>(SINGLE_PRECISION));
+   bool fastMath = *RM_NULLCHK(pInParam->getPlugInArgValue<bool>(FAST_MATH));
+   bool propagateNan = *RM_NULLCHK(pInParam->getPlugInArgValue<bool>(PROPAGATE_NAN));
+   string nativeCache = *RM_NULLCHK(pInParam->getPlugInArgValue<string>(NATIVE_CACHE));
+   int threadCount = *RM_NULLCHK(pInParam->getPlugInArgValue<int>(THREAD_COUNT));
+   int pipelineMemory = *RM_NULLCHK(pInParam->getPlugInArgValue<int>(PIPELINE_MEMORY));
    ProcessingLocation location = *RM_NULLCHK(pInParam->getPlugInArgValue<ProcessingLocation>(LOCATION));
 
    runner.setFailureMode(failOnError, defaultValue);
    runner.setBaseResultName(mResultsName);
    runner.setResultEncoding(mResultEncoding);
    runner.setRadians(radians);
+   runner.setSinglePrecision(singlePrecision);
+   runner.setFastMath(fastMath);
+   runner.setPropagateNan(propagateNan);
+   runner.setNativeCache(nativeCache);
+   runner.setThreadCount(threadCount);
+   runner.setPipelineMemory(pipelineMemory);
    runner.setResultLocation(location);
    runner.setDisplayType(static_cast<RasterMathRunner::DisplayType>(mDisplayLayer));
 
@@ -239,6 +259,12 @@ bool RasterMathPlugIn::getInputSpecification(PlugInArgList*& pArgList)
       VERIFY(pArgList->addArg<bool>(FAIL_ON_ERROR, false));
       VERIFY(pArgList->addArg<double>(DEFAULT_VALUE, 0.0));
       VERIFY(pArgList->addArg<bool>(RADIANS, true));
+      VERIFY(pArgList->addArg<bool>(SINGLE_PRECISION, false));
+      VERIFY(pArgList->addArg<bool>(FAST_MATH, false));
+      VERIFY(pArgList->addArg<bool>(PROPAGATE_NAN, false));
+      VERIFY(pArgList->addArg<string>(NATIVE_CACHE, string()));
+      VERIFY(pArgList->addArg<int>(THREAD_COUNT, QThread::idealThreadCount()));
+      VERIFY(pArgList->addArg<int>(PIPELINE_MEMORY, RasterMathRunner::DEFAULT_PIPELINE_MEMORY));
       VERIFY(pArgList->addArg<ProcessingLocation>(LOCATION, ProcessingLocation()));
       VERIFY(pArgList->addArg<RasterElement>(AOI1, NULL));
       VERIFY(pArgList->addArg<RasterElement>(AOI2, NULL));
@@ -264,3 +290,21 @@ bool RasterMathPlugIn::getOutputSpecification(PlugInArgList*& pArgList)
 
    return true;
 }
+
+bool RasterMathPlugIn::runOperationalTests(Progress* pProgress, ostream& failure)
+{
+   return runAllTests(pProgress, failure);
+}
+
+bool RasterMathPlugIn::runAllTests(Progress* pProgress, ostream& failure)
+{
+   try
+   {
+      return RasterMathTests::runAll(failure);
+   }
+   catch (RasterMathException& exception)
+   {
+      failure << exception.getMessage() << endl;
+   }
+   return false;
+}
@@ -11,6 +11,7 @@
 #define RASTERMATHPLUGIN_H
 
 #include "AlgorithmShell.h"
+#include "Testable.h"
 
 #include <string>
 
@@ -20,7 +21,7 @@ class RasterMathRunner;
 
 using namespace std;
 
-class RasterMathPlugIn : public AlgorithmShell
+class RasterMathPlugIn : public AlgorithmShell, public Testable
 {
 public:
    RasterMathPlugIn();
@@ -30,6 +31,9 @@ public:
    bool getInputSpecification(PlugInArgList*& pArgList);
    bool getOutputSpecification(PlugInArgList*& pArgList);
 
+   bool runOperationalTests(Progress* pProgress, ostream& failure);
+   bool runAllTests(Progress* pProgress, ostream& failure);
+
 private:
    bool batchExecute(PlugInArgList* pInParam, PlugInArgList* pOutParam, RasterMathRunner& runner);
 
@@ -27,6 +27,30 @@
 
 using namespace std;
 
+const int RasterMathRunner::DEFAULT_PIPELINE_MEMORY = 64;
+
+namespace
+{
+   const char* executionName(ProcessStack::Execution execution)
+   {
+      switch (execution)
+      {
+         case ProcessStack::COPY_EXECUTION:
+            return "copied";
+         case ProcessStack::LOOKUP_EXECUTION:
+            return "lookup table";
+         case ProcessStack::BAND_EXECUTION:
+            return "bands in parallel";
+         case ProcessStack::TILE_EXECUTION:
+            return "tiles in parallel";
+         case ProcessStack::PIPELINE_EXECUTION:
+            return "pipelined";
+         default:
+            return "serial";
+      }
+   }
+}
+
 RasterMathRunner::RasterMathRunner(Progress* pProgress, bool& aborted) :
    mDisplayType(DISPLAY_NONE),
    mBaseResultName("Raster Math Results"),
@@ -35,6 +59,11 @@ RasterMathRunner::RasterMathRunner(Progress* pProgress, bool& aborted) :
    mDefaultValue(0.0),
    mFailOnError(false),
    mRadians(true),
+   mSinglePrecision(false),
+   mFastMath(false),
+   mPropagateNan(false),
+   mThreadCount(1),
+   mPipelineMemory(DEFAULT_PIPELINE_MEMORY),
    mpRasterResult(NULL),
    mpSignatureResult(NULL),
    mScalarResult(0.0),
@@ -53,6 +82,12 @@ void RasterMathRunner::execute(const std::string &formula)
    ProcessStack& stack = parser.getProcessStack();
    stack.setFailureMode(mFailOnError, mDefaultValue);
    stack.setDegrees(!mRadians);
+   stack.setPrecision(mSinglePrecision ? ProcessStack::SINGLE_PRECISION : ProcessStack::DOUBLE_PRECISION);
+   stack.setFastMath(mFastMath);
+   stack.setErrorMode(mPropagateNan ? ProcessStack::PROPAGATE_NAN : ProcessStack::FLAG_ERRORS);
+   stack.setNativeCache(mNativeCache);
+   stack.setThreadCount(mThreadCount);
+   stack.setPipelineMemory(static_cast<int64_t>(mPipelineMemory)*1024*1024);
 
    const std::vector<boost::shared_ptr<ProcessStep> >& steps = stack.getSteps();
    if (steps.empty())
@@ -108,6 +143,8 @@ void RasterMathRunner::executeFull(ProcessStack& stack)
    MessageResource mr1(message.toStdString(), "RasterMath", "{FE28FF96-2352-4348-BF22-89D24C3295D1}");
    message = QString("Total Work: %1 operations").arg(static_cast<double>(totalWork));
    MessageResource mr2(message.toStdString(), "RasterMath", "{6029D5B0-2C44-4e9b-93E1-BAFCEE92C40B}");
+   message = QString("Execution: %1").arg(executionName(stack.execution()));
+   MessageResource mr3(message.toStdString(), "RasterMath", "{E51019BE-6F7C-4218-8988-D24FAAE243F9}");
 }
 
 void RasterMathRunner::setDisplayType(DisplayType type)
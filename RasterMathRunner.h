@@ -27,6 +27,10 @@ public:
       DISPLAY_RASTER_WINDOW
    };
 
+   // the megabytes of rows held in memory while rasters on disk are read ahead of and written
+   // behind the computation
+   static const int DEFAULT_PIPELINE_MEMORY;
+
    RasterMathRunner(Progress* pProgress, bool& aborted);
    void execute(const std::string& formula);
    void setDisplayType(DisplayType type);
@@ -34,6 +38,12 @@ public:
    void setResultEncoding(EncodingType type) { mResultEncoding = type; }
    void setFailureMode(bool failOnError, double defaultValue=0.0) { mFailOnError = failOnError; mDefaultValue = defaultValue; }
    void setRadians(bool radians);
+   void setSinglePrecision(bool singlePrecision) { mSinglePrecision = singlePrecision; }
+   void setFastMath(bool fastMath) { mFastMath = fastMath; }
+   void setPropagateNan(bool propagateNan) { mPropagateNan = propagateNan; }
+   void setNativeCache(const std::string& directory) { mNativeCache = directory; }
+   void setThreadCount(int count) { mThreadCount = count; }
+   void setPipelineMemory(int megabytes) { mPipelineMemory = megabytes; }
    void setResultLocation(const ProcessingLocation& location) 
    { 
       mResultLocation = location; 
@@ -56,6 +66,12 @@ private:
    double mDefaultValue;
    bool mFailOnError;
    bool mRadians;
+   bool mSinglePrecision;
+   bool mFastMath;
+   bool mPropagateNan;
+   std::string mNativeCache;
+   int mThreadCount;
+   int mPipelineMemory;
    RasterElement* mpRasterResult;
    Signature* mpSignatureResult;
    double mScalarResult;
@@ -0,0 +1,320 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "DataAccessor.h"
+#include "DataAccessorImpl.h"
+#include "DataRequest.h"
+#include "DimensionDescriptor.h"
+#include "ObjectResource.h"
+#include "ParseStackBuilder.h"
+#include "ProcessStack.h"
+#include "RasterCorrelator.h"
+#include "RasterDataDescriptor.h"
+#include "RasterElement.h"
+#include "RasterMathException.h"
+#include "RasterMathParser.h"
+#include "RasterMathProgress.h"
+#include "RasterMathRunner.h"
+#include "RasterMathTests.h"
+#include "RasterUtilities.h"
+
+#include <QtCore/QThread>
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+using namespace std;
+
+namespace
+{
+   const float CONSTANT_VALUE = 7.0f;
+
+   /**
+    * The value of a pixel of a test raster: the pixel's number within the raster, or
+    * CONSTANT_VALUE in its constant band.
+    */
+   float pixelValue(int band, int row, int column, int rowCount, int columnCount, int constantBand)
+   {
+      if (band == constantBand)
+      {
+         return CONSTANT_VALUE;
+      }
+      return static_cast<float>((band*rowCount+row)*columnCount+column);
+   }
+
+   DataAccessor bandAccessor(RasterElement* pRaster, int band, bool writable)
+   {
+      RasterDataDescriptor* pDescriptor = dynamic_cast<RasterDataDescriptor*>(pRaster->getDataDescriptor());
+      DimensionDescriptor bandDescriptor = RM_NULLCHK(pDescriptor)->getActiveBand(band);
+      FactoryResource<DataRequest> pRequest;
+      RM_NULLCHK(pRequest.get())->setWritable(writable);
+      pRequest->setBands(bandDescriptor, bandDescriptor);
+      return pRaster->getDataAccessor(pRequest.release());
+   }
+
+   /**
+    * A band sequential float raster holding pixelValue(), so that every band but constantBand
+    * is read rather than replaced by a number.
+    */
+   RasterElement* createRaster(const string& name, int rowCount, int columnCount, int bandCount=1,
+      int constantBand=-1, bool inMemory=true)
+   {
+      RasterElement* pRaster = RM_NULLCHK(RasterUtilities::createRasterElement(name, rowCount, columnCount,
+         bandCount, FLT4BYTES, BSQ, inMemory));
+      for (int band=0; band<bandCount; ++band)
+      {
+         DataAccessor accessor = bandAccessor(pRaster, band, true);
+         for (int row=0; row<rowCount; ++row)
+         {
+            for (int column=0; column<columnCount; ++column)
+            {
+               RM_VERIFY(accessor.isValid());
+               *reinterpret_cast<float*>(accessor->getColumn()) =
+                  pixelValue(band, row, column, rowCount, columnCount, constantBand);
+               accessor->nextColumn();
+            }
+            accessor->nextRow();
+         }
+      }
+      pRaster->updateData();
+      return pRaster;
+   }
+
+   /**
+    * How a formula is computed: as the plug-in computes it, but failing on errors.
+    */
+   struct Settings
+   {
+      Settings(ProcessStack::EvaluationMode mode, int threadCount) :
+         mMode(mode),
+         mThreadCount(threadCount),
+         mPipelineMemory(0)
+      {
+      }
+
+      ProcessStack::EvaluationMode mMode;
+      int mThreadCount;
+      int64_t mPipelineMemory;
+   };
+
+   /**
+    * Computes formula over the correlated rasters into a float raster in memory.
+    *
+    * @return the result, or NULL with the message of the error raised in error. The way the
+    *         stack computed it is returned in execution.
+    */
+   RasterElement* compute(const string& formula, const Settings& settings, string& error,
+      ProcessStack::Execution& execution)
+   {
+      try
+      {
+         ParseStackBuilder::clear();
+         RasterMathParser parser(formula);
+         ProcessStack& stack = parser.getProcessStack();
+         stack.setFailureMode(true);
+         stack.setEvaluationMode(settings.mMode);
+         stack.setThreadCount(settings.mThreadCount);
+         stack.setPipelineMemory(settings.mPipelineMemory);
+         stack.addResultStep("Raster Math Test Result", FLT4BYTES, ProcessingLocation(IN_MEMORY));
+         bool aborted = false;
+         RasterMathProgress progress(NULL, aborted, stack.totalWork());
+         stack.execute(progress);
+         execution = stack.execution();
+         return stack.releaseRaster();
+      }
+      catch (RasterMathException& exception)
+      {
+         error = exception.getMessage();
+      }
+      return NULL;
+   }
+
+   /**
+    * The number of pixels of a float result which differ from scale*pixelValue()+offset.
+    */
+   int countWrongPixels(RasterElement* pResult, int bandCount, int rowCount, int columnCount, int constantBand,
+      double scale, double offset)
+   {
+      int mismatches = 0;
+      for (int band=0; band<bandCount; ++band)
+      {
+         DataAccessor accessor = bandAccessor(pResult, band, false);
+         for (int row=0; row<rowCount; ++row)
+         {
+            for (int column=0; column<columnCount; ++column)
+            {
+               RM_VERIFY(accessor.isValid());
+               double expected = scale*pixelValue(band, row, column, rowCount, columnCount, constantBand) + offset;
+               if (*reinterpret_cast<float*>(accessor->getColumn()) != expected)
+               {
+                  ++mismatches;
+               }
+               accessor->nextColumn();
+            }
+            accessor->nextRow();
+         }
+      }
+      return mismatches;
+   }
+
+   /**
+    * A raster one column narrower than the result is a column-size mismatch, whether the
+    * pixels are computed one at a time or a row at a time.
+    */
+   bool testColumnMismatch(ostream& failure)
+   {
+      ModelResource<RasterElement> pWide(createRaster("Raster Math Test Wide", 4, 6));
+      ModelResource<RasterElement> pNarrow(createRaster("Raster Math Test Narrow", 4, 5));
+      map<int,RasterElement*> elements;
+      elements[1] = pWide.get();
+      elements[2] = pNarrow.get();
+      RM_NULLCHK(RasterCorrelator::instance())->setElements(elements);
+
+      const ProcessStack::EvaluationMode modes[] = { ProcessStack::PIXEL_EVALUATION, ProcessStack::ROW_EVALUATION };
+      const char* modeNames[] = { "pixel", "row" };
+      bool success = true;
+      for (int i=0; i<2; ++i)
+      {
+         string error;
+         ProcessStack::Execution execution = ProcessStack::SERIAL_EXECUTION;
+         ModelResource<RasterElement> pResult(compute("r1+r2", Settings(modes[i], 1), error, execution));
+         if (error != "Raster column-size mismatch")
+         {
+            failure << "Column mismatch, " << modeNames[i] << " evaluation: " <<
+               (error.empty() ? "no error" : error) << endl;
+            success = false;
+         }
+      }
+      return success;
+   }
+
+   /**
+    * A band whose pixels all hold one value, in an input whose other bands are read, gives
+    * the same result as reading it would, whether the pixels are computed one at a time, a
+    * row at a time, in tiles or copied.
+    */
+   bool testConstantBand(ostream& failure)
+   {
+      const int rowCount = 4;
+      const int columnCount = 6;
+      const int bandCount = 3;
+      const int constantBand = 1;
+      ModelResource<RasterElement> pInput(createRaster("Raster Math Test Bands", rowCount, columnCount,
+         bandCount, constantBand));
+      map<int,RasterElement*> elements;
+      elements[1] = pInput.get();
+      RM_NULLCHK(RasterCorrelator::instance())->setElements(elements);
+
+      struct Run
+      {
+         const char* mpFormula;
+         double mScale;
+         double mOffset;
+         ProcessStack::EvaluationMode mMode;
+         int mThreadCount;
+      };
+      const Run runs[] =
+      {
+         { "r1*2+1", 2.0, 1.0, ProcessStack::PIXEL_EVALUATION, 1 },
+         { "r1*2+1", 2.0, 1.0, ProcessStack::ROW_EVALUATION, 1 },
+         { "r1*2+1", 2.0, 1.0, ProcessStack::ROW_EVALUATION, 4 },
+         { "r1", 1.0, 0.0, ProcessStack::ROW_EVALUATION, 1 }
+      };
+      bool success = true;
+      for (size_t i=0; i<sizeof(runs)/sizeof(runs[0]); ++i)
+      {
+         const Run& run = runs[i];
+         string error;
+         ProcessStack::Execution execution = ProcessStack::SERIAL_EXECUTION;
+         ModelResource<RasterElement> pResult(compute(run.mpFormula, Settings(run.mMode, run.mThreadCount), error,
+            execution));
+         if (pResult.get() == NULL)
+         {
+            failure << "Constant band, " << run.mpFormula << ": " << error << endl;
+            success = false;
+            continue;
+         }
+         int mismatches = countWrongPixels(pResult.get(), bandCount, rowCount, columnCount, constantBand,
+            run.mScale, run.mOffset);
+         if (mismatches != 0)
+         {
+            failure << "Constant band, " << run.mpFormula << " with " << run.mThreadCount << " threads, " <<
+               (run.mMode == ProcessStack::ROW_EVALUATION ? "row" : "pixel") << " evaluation: " << mismatches <<
+               " wrong pixels" << endl;
+            success = false;
+         }
+      }
+      return success;
+   }
+
+   /**
+    * A raster on disk is computed in the pipeline with the plug-in's default thread count and
+    * pipeline memory, rather than in tiles by the threads, and gives the same result.
+    */
+   bool testPipeline(ostream& failure)
+   {
+      const int rowCount = 40;
+      const int columnCount = 30;
+      const int bandCount = 2;
+      ModelResource<RasterElement> pInput(createRaster("Raster Math Test On Disk", rowCount, columnCount,
+         bandCount, -1, false));
+      map<int,RasterElement*> elements;
+      elements[1] = pInput.get();
+      RM_NULLCHK(RasterCorrelator::instance())->setElements(elements);
+
+      // at least two threads, so the tiles could have been chosen on any machine
+      Settings settings(ProcessStack::ROW_EVALUATION, max(2, QThread::idealThreadCount()));
+      settings.mPipelineMemory = static_cast<int64_t>(RasterMathRunner::DEFAULT_PIPELINE_MEMORY)*1024*1024;
+      string error;
+      ProcessStack::Execution execution = ProcessStack::SERIAL_EXECUTION;
+      ModelResource<RasterElement> pResult(compute("r1*2+1", settings, error, execution));
+      if (pResult.get() == NULL)
+      {
+         failure << "Pipeline: " << error << endl;
+         return false;
+      }
+      bool success = true;
+      if (execution != ProcessStack::PIPELINE_EXECUTION)
+      {
+         failure << "Pipeline: a raster on disk was not computed in the pipeline with " <<
+            settings.mThreadCount << " threads" << endl;
+         success = false;
+      }
+      int mismatches = countWrongPixels(pResult.get(), bandCount, rowCount, columnCount, -1, 2.0, 1.0);
+      if (mismatches != 0)
+      {
+         failure << "Pipeline: " << mismatches << " wrong pixels" << endl;
+         success = false;
+      }
+      return success;
+   }
+}
+
+bool RasterMathTests::runAll(ostream& failure)
+{
+   // the tests correlate their own rasters, so the user's correlations are put back after them
+   RasterCorrelator* pCorrelator = RM_NULLCHK(RasterCorrelator::instance());
+   map<int,RasterElement*> elements;
+   for (int i=0; i<=RasterCorrelator::MAX_CORREL; ++i)
+   {
+      RasterElement* pElement = pCorrelator->getElement(i);
+      if (pElement != NULL)
+      {
+         elements[i] = pElement;
+      }
+   }
+
+   bool success = testColumnMismatch(failure);
+   success = testConstantBand(failure) && success;
+   success = testPipeline(failure) && success;
+
+   pCorrelator->setElements(elements);
+   return success;
+}
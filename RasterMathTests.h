@@ -0,0 +1,29 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef RASTERMATHTESTS_H
+#define RASTERMATHTESTS_H
+
+#include <ostream>
+
+/**
+ * Tests which compute formulas over small rasters made for them, run through the plug-in's
+ * Testable interface.
+ */
+namespace RasterMathTests
+{
+   /**
+    * Runs every test, writing a line to failure for each that fails.
+    *
+    * @return true if every test passed.
+    */
+   bool runAll(std::ostream& failure);
+}
+
+#endif
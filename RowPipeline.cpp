@@ -0,0 +1,255 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "ProcessStep.h"
+#include "RasterMathException.h"
+#include "RowPipeline.h"
+
+#include <algorithm>
+
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+using namespace std;
+using namespace boost;
+
+class RowPipeline::StageThread : public QThread
+{
+public:
+   StageThread(RowPipeline& pipeline, void (RowPipeline::*pStage)()) :
+      mPipeline(pipeline),
+      mpStage(pStage)
+   {
+   }
+
+   ~StageThread()
+   {
+      wait();
+   }
+
+protected:
+   void run()
+   {
+      try
+      {
+         (mPipeline.*mpStage)();
+      }
+      catch (const RasterMathException& e)
+      {
+         mPipeline.fail(e.getMessage());
+      }
+      catch (const std::exception& e)
+      {
+         mPipeline.fail(e.what());
+      }
+   }
+
+private:
+   RowPipeline& mPipeline;
+   void (RowPipeline::*mpStage)();
+};
+
+RowPipeline::RowPipeline(int blockRows, int blockCount) :
+   mBlockRows(max(blockRows, 1)),
+   mNextRow(0),
+   mQueuedBands(0),
+   mWrittenBands(0),
+   mStopped(false),
+   mFailed(false)
+{
+   // one block to read into, one to compute and one to write, at the least
+   for (int i=0; i<max(blockCount, 3); ++i)
+   {
+      mBlocks.push_back(shared_ptr<Block>(new Block));
+      mFreeBlocks.push_back(mBlocks.back().get());
+   }
+   mThreads.push_back(shared_ptr<StageThread>(new StageThread(*this, &RowPipeline::read)));
+   mThreads.push_back(shared_ptr<StageThread>(new StageThread(*this, &RowPipeline::write)));
+   for (vector<shared_ptr<StageThread> >::iterator ppThread=mThreads.begin(); ppThread!=mThreads.end(); ++ppThread)
+   {
+      (*ppThread)->start();
+   }
+}
+
+RowPipeline::~RowPipeline()
+{
+   {
+      QMutexLocker lock(&mMutex);
+      mStopped = true;
+      mChanged.wakeAll();
+   }
+   for (vector<shared_ptr<StageThread> >::iterator ppThread=mThreads.begin(); ppThread!=mThreads.end(); ++ppThread)
+   {
+      (*ppThread)->wait();
+   }
+}
+
+void RowPipeline::readBand(const vector<ProcessStepRaster*>& inputs, ProcessStepRaster& result, int rowCount)
+{
+   RM_VERIFY(rowCount > 0);
+   Band band;
+   band.mInputs = inputs;
+   band.mpResult = &result;
+   band.mRowCount = rowCount;
+
+   QMutexLocker lock(&mMutex);
+   mBands.push_back(band);
+   ++mQueuedBands;
+   mChanged.wakeAll();
+}
+
+RowPipeline::Block& RowPipeline::nextBlock()
+{
+   QMutexLocker lock(&mMutex);
+   while (!mFailed && mReadBlocks.empty())
+   {
+      mChanged.wait(&mMutex);
+   }
+   if (mFailed)
+   {
+      throw RasterMathException(mError);
+   }
+   Block* pBlock = mReadBlocks.front();
+   mReadBlocks.pop_front();
+   return *pBlock;
+}
+
+void RowPipeline::writeBlock(Block& block)
+{
+   QMutexLocker lock(&mMutex);
+   mWriteBlocks.push_back(&block);
+   mChanged.wakeAll();
+}
+
+int RowPipeline::writtenBands() const
+{
+   QMutexLocker lock(&mMutex);
+   return mWrittenBands;
+}
+
+void RowPipeline::finish()
+{
+   QMutexLocker lock(&mMutex);
+   while (!mFailed && mWrittenBands < mQueuedBands)
+   {
+      mChanged.wait(&mMutex);
+   }
+   if (mFailed)
+   {
+      throw RasterMathException(mError);
+   }
+}
+
+void RowPipeline::read()
+{
+   Band band;
+   Block* pBlock = NULL;
+   while (nextRead(band, pBlock))
+   {
+      // the rows past the end of an input are left unread, as the computation does not read them
+      pBlock->mInputs.resize(band.mInputs.size());
+      for (size_t i=0; i<band.mInputs.size(); ++i)
+      {
+         ProcessStepRaster& input = *RM_NULLCHK(band.mInputs[i]);
+         pBlock->mInputs[i].resize(static_cast<size_t>(pBlock->mRowCount)*input.columns());
+         input.readRows(pBlock->mFirstRow, pBlock->mRowCount, &pBlock->mInputs[i][0]);
+      }
+      pBlock->mResult.resize(static_cast<size_t>(pBlock->mRowCount)*band.mpResult->columns());
+
+      QMutexLocker lock(&mMutex);
+      mReadBlocks.push_back(pBlock);
+      mChanged.wakeAll();
+   }
+}
+
+/**
+ * Waits for a band to read and a free block to read its next rows into.
+ *
+ * @return false once the pipeline is stopped.
+ */
+bool RowPipeline::nextRead(Band& band, Block*& pBlock)
+{
+   QMutexLocker lock(&mMutex);
+   while (!mStopped && (mBands.empty() || mFreeBlocks.empty()))
+   {
+      mChanged.wait(&mMutex);
+   }
+   if (mStopped)
+   {
+      return false;
+   }
+
+   band = mBands.front();
+   pBlock = mFreeBlocks.front();
+   mFreeBlocks.pop_front();
+   pBlock->mFirstRow = mNextRow;
+   pBlock->mRowCount = min(mBlockRows, band.mRowCount-mNextRow);
+   pBlock->mpResult = band.mpResult;
+   mNextRow += pBlock->mRowCount;
+   pBlock->mLastOfBand = (mNextRow == band.mRowCount);
+   if (pBlock->mLastOfBand)
+   {
+      mBands.pop_front();
+      mNextRow = 0;
+   }
+   return true;
+}
+
+void RowPipeline::write()
+{
+   Block* pBlock = NULL;
+   while (nextWrite(pBlock))
+   {
+      RM_NULLCHK(pBlock->mpResult)->writeRows(pBlock->mFirstRow, pBlock->mRowCount, &pBlock->mResult[0]);
+
+      QMutexLocker lock(&mMutex);
+      if (pBlock->mLastOfBand)
+      {
+         ++mWrittenBands;
+      }
+      mFreeBlocks.push_back(pBlock);
+      mChanged.wakeAll();
+   }
+}
+
+/**
+ * Waits for a computed block to write.
+ *
+ * @return false once the pipeline is stopped.
+ */
+bool RowPipeline::nextWrite(Block*& pBlock)
+{
+   QMutexLocker lock(&mMutex);
+   while (!mStopped && mWriteBlocks.empty())
+   {
+      mChanged.wait(&mMutex);
+   }
+   if (mStopped)
+   {
+      return false;
+   }
+   pBlock = mWriteBlocks.front();
+   mWriteBlocks.pop_front();
+   return true;
+}
+
+/**
+ * Stops both stages, and fails the next wait of the computing thread with error.
+ */
+void RowPipeline::fail(const string& error)
+{
+   QMutexLocker lock(&mMutex);
+   if (!mFailed)
+   {
+      mError = error;
+      mFailed = true;
+   }
+   mStopped = true;
+   mChanged.wakeAll();
+}
@@ -0,0 +1,119 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef ROWPIPELINE_H
+#define ROWPIPELINE_H
+
+#include <boost/shared_ptr.hpp>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+class ProcessStepRaster;
+
+/**
+ * Reads the rows of the rasters of each band ahead of the thread which computes them, and writes
+ * the rows of the band's result behind it, each in a thread of its own, so the computation does
+ * not wait for rasters which are read from or written to disk, nor the disk for the computation.
+ *
+ * The rows move through the stages in blocks of a fixed number of rows. The reader fills a free
+ * block with the rows of each input, converted to double, the computing thread takes it with
+ * nextBlock(), fills in the rows of the result and hands it on with writeBlock(), and once the
+ * writer has stored the result's rows, the block is free again. The blocks are allocated once,
+ * so the rows in flight never take more memory than the blocks, and a stage which gets ahead
+ * of the others waits for a block to work on.
+ */
+class RowPipeline
+{
+public:
+   struct Block
+   {
+      int mFirstRow;
+      int mRowCount;
+      std::vector<std::vector<double> > mInputs; // mRowCount rows of each input's columns
+      std::vector<double> mResult; // mRowCount rows of the result's columns
+      ProcessStepRaster* mpResult;
+      bool mLastOfBand;
+   };
+
+   RowPipeline(int blockRows, int blockCount);
+
+   /**
+    * Stops the threads, without writing the blocks which have not been written yet.
+    */
+   ~RowPipeline();
+
+   /**
+    * Reads the rows of the next band, once those of the bands before it have been read, from
+    * inputs into the blocks, and writes the blocks' result rows to result. The steps have
+    * accessors of their own for the pipeline's threads, and must be kept until writtenBands()
+    * counts the band.
+    */
+   void readBand(const std::vector<ProcessStepRaster*>& inputs, ProcessStepRaster& result, int rowCount);
+
+   /**
+    * The next block of rows in the order of the bands, waiting until it has been read.
+    *
+    * @throw RasterMathException if the reader or writer failed.
+    */
+   Block& nextBlock();
+
+   void writeBlock(Block& block);
+
+   /**
+    * The number of bands whose rows have all been written.
+    */
+   int writtenBands() const;
+
+   /**
+    * Waits until the rows of every band have been written.
+    *
+    * @throw RasterMathException if the reader or writer failed.
+    */
+   void finish();
+
+private:
+   struct Band
+   {
+      std::vector<ProcessStepRaster*> mInputs;
+      ProcessStepRaster* mpResult;
+      int mRowCount;
+   };
+   class StageThread;
+
+   RowPipeline(const RowPipeline& rhs);
+   RowPipeline& operator=(const RowPipeline& rhs);
+
+   void read();
+   bool nextRead(Band& band, Block*& pBlock);
+   void write();
+   bool nextWrite(Block*& pBlock);
+   void fail(const std::string& error);
+
+   int mBlockRows;
+   std::vector<boost::shared_ptr<Block> > mBlocks;
+   mutable QMutex mMutex;
+   QWaitCondition mChanged; // any of the state below
+   std::deque<Band> mBands; // to read, with the rows of the first read up to mNextRow
+   int mNextRow;
+   int mQueuedBands;
+   int mWrittenBands;
+   std::deque<Block*> mFreeBlocks;
+   std::deque<Block*> mReadBlocks;
+   std::deque<Block*> mWriteBlocks;
+   bool mStopped;
+   bool mFailed;
+   std::string mError;
+   std::vector<boost::shared_ptr<StageThread> > mThreads; // last, so stopped before the rest is destroyed
+};
+
+#endif
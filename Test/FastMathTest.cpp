@@ -0,0 +1,340 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+/**
+ * Measures the errors of the FastMath functions against the C library, and fails if any is
+ * larger than the bound the table in FastMath.h gives for it.
+ *
+ * Each function is evaluated on arguments sampled across its domain, by the scalar function
+ * and by the row function, which uses the widest instruction set the CPU supports. Special
+ * values must give the same results as the C library. The program is built on its own, from
+ * this file and FastMath.cpp, for example with
+ *
+ *    c++ -O2 -I.. -I<Opticks>/application/Interfaces FastMathTest.cpp ../FastMath.cpp
+ *
+ * and returns nonzero if a bound does not hold.
+ */
+
+#include "FastMath.h"
+
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+   const int SAMPLE_COUNT = 1000000;
+
+   /**
+    * A 64-bit xorshift generator, so the samples are the same on every platform.
+    */
+   class Samples
+   {
+   public:
+      Samples() : mState(0x9e3779b97f4a7c15ULL) {}
+
+      double uniform(double low, double high)
+      {
+         mState ^= mState << 13;
+         mState ^= mState >> 7;
+         mState ^= mState << 17;
+         return low+(high-low)*(static_cast<double>(mState >> 11)/9007199254740992.0);
+      }
+
+      // logarithmically spaced, so every exponent in the range is sampled as often
+      double logUniform(double low, double high)
+      {
+         return ::exp(uniform(::log(low), ::log(high)));
+      }
+
+      double signedLogUniform(double low, double high)
+      {
+         double value = logUniform(low, high);
+         return (uniform(0.0, 1.0) < 0.5) ? -value : value;
+      }
+
+   private:
+      uint64_t mState;
+   };
+
+   struct Domain
+   {
+      enum Spacing
+      {
+         UNIFORM,
+         LOG_UNIFORM,
+         SIGNED_LOG_UNIFORM
+      };
+
+      Spacing mSpacing;
+      double mLow;
+      double mHigh;
+
+      double sample(Samples& samples) const
+      {
+         switch (mSpacing)
+         {
+            case LOG_UNIFORM:
+               return samples.logUniform(mLow, mHigh);
+            case SIGNED_LOG_UNIFORM:
+               return samples.signedLogUniform(mLow, mHigh);
+            default:
+               return samples.uniform(mLow, mHigh);
+         }
+      }
+   };
+
+   /**
+    * One sweep of a function over its domain, with the bounds of the table in FastMath.h.
+    */
+   struct Sweep
+   {
+      const char* mpName;
+      Domain mX;
+      Domain mY; // for atan2 and pow
+      bool mRelative;
+      double mDoubleBound;
+      double mFloatBound;
+   };
+
+   template<typename T>
+   struct Functions
+   {
+      typedef T (*Unary)(T x);
+      typedef T (*Binary)(T y, T x);
+      typedef void (*UnaryRow)(T* pDest, const T* pSrc, int count);
+      typedef void (*BinaryRow)(T* pDest, const T* pLhs, const T* pRhs, int count);
+   };
+
+   typedef double (*UnaryLibrary)(double x);
+   typedef double (*BinaryLibrary)(double y, double x);
+
+   template<typename T>
+   bool isNormal(double value)
+   {
+      double smallest = numeric_limits<T>::min();
+      double largest = numeric_limits<T>::max();
+      return fabs(value) >= smallest && fabs(value) <= largest;
+   }
+
+   template<typename T>
+   bool isSame(T value, T expected)
+   {
+      if (value != value || expected != expected)
+      {
+         return value != value && expected != expected;
+      }
+      return value == expected;
+   }
+
+   /**
+    * The largest error of pValues against the C library's values, over the samples whose exact
+    * values the type can represent as normal numbers.
+    */
+   template<typename T>
+   double maximumError(const vector<T>& values, const vector<double>& expected, bool relative)
+   {
+      double largest = 0.0;
+      for (size_t i=0; i<values.size(); ++i)
+      {
+         if (!isNormal<T>(expected[i]))
+         {
+            continue;
+         }
+         double rounded = static_cast<T>(expected[i]);
+         double error = fabs(values[i]-rounded);
+         if (relative)
+         {
+            error /= fabs(rounded);
+         }
+         largest = max(largest, error);
+      }
+      return largest;
+   }
+
+   template<typename T>
+   bool report(const Sweep& sweep, const char* pForm, double error)
+   {
+      double bound = (sizeof(T) == sizeof(double)) ? sweep.mDoubleBound : sweep.mFloatBound;
+      bool passed = (error <= bound);
+      printf("%-6s %-6s %-6s %-8s %.3g (bound %.3g)%s\n", sweep.mpName, (sizeof(T) == sizeof(double)) ? "double" : "float",
+         pForm, sweep.mRelative ? "relative" : "absolute", error, bound, passed ? "" : " FAILED");
+      return passed;
+   }
+
+   template<typename T>
+   bool checkUnary(const Sweep& sweep, typename Functions<T>::Unary pFunction, typename Functions<T>::UnaryRow pRow,
+      UnaryLibrary pLibrary)
+   {
+      Samples samples;
+      vector<T> arguments(SAMPLE_COUNT);
+      vector<double> expected(SAMPLE_COUNT);
+      vector<T> scalar(SAMPLE_COUNT);
+      for (int i=0; i<SAMPLE_COUNT; ++i)
+      {
+         arguments[i] = static_cast<T>(sweep.mX.sample(samples));
+         expected[i] = pLibrary(arguments[i]);
+         scalar[i] = pFunction(arguments[i]);
+      }
+      vector<T> row(SAMPLE_COUNT);
+      pRow(&row[0], &arguments[0], SAMPLE_COUNT);
+
+      bool passed = report<T>(sweep, "scalar", maximumError(scalar, expected, sweep.mRelative));
+      return report<T>(sweep, "row", maximumError(row, expected, sweep.mRelative)) && passed;
+   }
+
+   template<typename T>
+   bool checkBinary(const Sweep& sweep, typename Functions<T>::Binary pFunction, typename Functions<T>::BinaryRow pRow,
+      BinaryLibrary pLibrary)
+   {
+      Samples samples;
+      vector<T> lhs(SAMPLE_COUNT);
+      vector<T> rhs(SAMPLE_COUNT);
+      vector<double> expected(SAMPLE_COUNT);
+      vector<T> scalar(SAMPLE_COUNT);
+      for (int i=0; i<SAMPLE_COUNT; ++i)
+      {
+         lhs[i] = static_cast<T>(sweep.mX.sample(samples));
+         rhs[i] = static_cast<T>(sweep.mY.sample(samples));
+         expected[i] = pLibrary(lhs[i], rhs[i]);
+         scalar[i] = pFunction(lhs[i], rhs[i]);
+      }
+      vector<T> row(SAMPLE_COUNT);
+      pRow(&row[0], &lhs[0], &rhs[0], SAMPLE_COUNT);
+
+      bool passed = report<T>(sweep, "scalar", maximumError(scalar, expected, sweep.mRelative));
+      return report<T>(sweep, "row", maximumError(row, expected, sweep.mRelative)) && passed;
+   }
+
+   template<typename T>
+   bool isSpecial(T value)
+   {
+      return value == 0 || value != value || fabs(value) == numeric_limits<T>::infinity();
+   }
+
+   /**
+    * Whether the functions give the C library's results for special values, negative numbers and
+    * the arguments their reductions do not cover. The arguments are all pairs of a few special
+    * and ordinary values, of which those the condition of each function holds for are compared.
+    */
+   template<typename T>
+   bool checkSpecialValues()
+   {
+      const T infinity = numeric_limits<T>::infinity();
+      const T values[] = { static_cast<T>(0.0), static_cast<T>(-0.0), infinity, -infinity,
+         numeric_limits<T>::quiet_NaN(), static_cast<T>(1.0), static_cast<T>(-1.0), static_cast<T>(800.0),
+         static_cast<T>(-800.0), static_cast<T>(2.0e6), static_cast<T>(-3.0e7) };
+      const int valueCount = sizeof(values)/sizeof(values[0]);
+
+      vector<T> lhs;
+      vector<T> rhs;
+      for (int i=0; i<valueCount; ++i)
+      {
+         for (int j=0; j<valueCount; ++j)
+         {
+            lhs.push_back(values[i]);
+            rhs.push_back(values[j]);
+         }
+      }
+      vector<T> row(lhs.size());
+      int failures = 0;
+
+#define RM_CHECK_UNARY(name, library, condition) \
+      FastMath::name(&row[0], &lhs[0], static_cast<int>(lhs.size())); \
+      for (size_t i=0; i<lhs.size(); ++i) \
+      { \
+         T x = lhs[i]; \
+         T expected = static_cast<T>(library(x)); \
+         if ((condition) && (!isSame(FastMath::name(x), expected) || !isSame(row[i], expected))) \
+         { \
+            printf(#name "(%g) is %g, and %g in a row, not %g FAILED\n", static_cast<double>(x), \
+               static_cast<double>(FastMath::name(x)), static_cast<double>(row[i]), static_cast<double>(expected)); \
+            ++failures; \
+         } \
+      }
+#define RM_CHECK_BINARY(name, library, condition) \
+      FastMath::name(&row[0], &lhs[0], &rhs[0], static_cast<int>(lhs.size())); \
+      for (size_t i=0; i<lhs.size(); ++i) \
+      { \
+         T x = lhs[i]; \
+         T y = rhs[i]; \
+         T expected = static_cast<T>(library(x, y)); \
+         if ((condition) && (!isSame(FastMath::name(x, y), expected) || !isSame(row[i], expected))) \
+         { \
+            printf(#name "(%g, %g) is %g, and %g in a row, not %g FAILED\n", static_cast<double>(x), \
+               static_cast<double>(y), static_cast<double>(FastMath::name(x, y)), static_cast<double>(row[i]), \
+               static_cast<double>(expected)); \
+            ++failures; \
+         } \
+      }
+
+      // exp overflows and underflows, the logarithms are exact at 1, and sin, cos and tan fall
+      // back to the C library beyond the reduction
+      RM_CHECK_UNARY(exp, ::exp, isSpecial(x) || fabs(x) >= 800)
+      RM_CHECK_UNARY(log, ::log, isSpecial(x) || x < 0 || x == 1)
+      RM_CHECK_UNARY(log10, ::log10, isSpecial(x) || x < 0 || x == 1)
+      RM_CHECK_UNARY(log2, ::log2, isSpecial(x) || x < 0 || x == 1)
+      RM_CHECK_UNARY(sin, ::sin, isSpecial(x) || fabs(x) > 1e6)
+      RM_CHECK_UNARY(cos, ::cos, isSpecial(x) || fabs(x) > 1e6)
+      RM_CHECK_UNARY(tan, ::tan, isSpecial(x) || fabs(x) > 1e6)
+      RM_CHECK_BINARY(atan2, ::atan2, isSpecial(x) || isSpecial(y))
+      RM_CHECK_BINARY(pow, ::pow, isSpecial(x) || isSpecial(y) || x < 0)
+
+#undef RM_CHECK_UNARY
+#undef RM_CHECK_BINARY
+
+      printf("special %-6s %d failures\n", (sizeof(T) == sizeof(double)) ? "double" : "float", failures);
+      return failures == 0;
+   }
+
+   template<typename T>
+   bool checkAll()
+   {
+      const Domain none = { Domain::UNIFORM, 0.0, 0.0 };
+      const Sweep exp = { "exp", { Domain::UNIFORM, -745.0, 710.0 }, none, true, 5e-16, 1.2e-7 };
+      const Sweep log = { "log", { Domain::LOG_UNIFORM, 1e-300, 1e300 }, none, true, 5e-16, 1.2e-7 };
+      const Sweep logNearOne = { "log", { Domain::UNIFORM, 0.5, 2.0 }, none, true, 5e-16, 1.2e-7 };
+      const Sweep log10 = { "log10", { Domain::LOG_UNIFORM, 1e-300, 1e300 }, none, true, 5e-16, 1.2e-7 };
+      const Sweep log2 = { "log2", { Domain::LOG_UNIFORM, 1e-300, 1e300 }, none, true, 5e-16, 1.2e-7 };
+      const Sweep sin = { "sin", { Domain::SIGNED_LOG_UNIFORM, 1e-10, 2e6 }, none, false, 3e-16, 6e-8 };
+      const Sweep cos = { "cos", { Domain::SIGNED_LOG_UNIFORM, 1e-10, 2e6 }, none, false, 3e-16, 6e-8 };
+      const Sweep tan = { "tan", { Domain::SIGNED_LOG_UNIFORM, 1e-10, 2e6 }, none, true, 7e-16, 1.2e-7 };
+      const Sweep atan2 = { "atan2", { Domain::SIGNED_LOG_UNIFORM, 1e-100, 1e100 },
+         { Domain::SIGNED_LOG_UNIFORM, 1e-100, 1e100 }, false, 5e-16, 2.4e-7 };
+      const Sweep pow = { "pow", { Domain::LOG_UNIFORM, 1e-30, 1e30 }, { Domain::UNIFORM, -20.0, 20.0 },
+         true, 1e-13, 6e-8 };
+      const Sweep powWide = { "pow", { Domain::LOG_UNIFORM, 1e-300, 1e300 }, { Domain::UNIFORM, -2.3, 2.3 },
+         true, 1e-13, 6e-8 };
+
+      bool passed = checkUnary<T>(exp, FastMath::exp<T>, FastMath::exp<T>, ::exp);
+      passed = checkUnary<T>(log, FastMath::log<T>, FastMath::log<T>, ::log) && passed;
+      passed = checkUnary<T>(logNearOne, FastMath::log<T>, FastMath::log<T>, ::log) && passed;
+      passed = checkUnary<T>(log10, FastMath::log10<T>, FastMath::log10<T>, ::log10) && passed;
+      passed = checkUnary<T>(log2, FastMath::log2<T>, FastMath::log2<T>, ::log2) && passed;
+      passed = checkUnary<T>(sin, FastMath::sin<T>, FastMath::sin<T>, ::sin) && passed;
+      passed = checkUnary<T>(cos, FastMath::cos<T>, FastMath::cos<T>, ::cos) && passed;
+      passed = checkUnary<T>(tan, FastMath::tan<T>, FastMath::tan<T>, ::tan) && passed;
+      passed = checkBinary<T>(atan2, FastMath::atan2<T>, FastMath::atan2<T>, ::atan2) && passed;
+      passed = checkBinary<T>(pow, FastMath::pow<T>, FastMath::pow<T>, ::pow) && passed;
+      passed = checkBinary<T>(powWide, FastMath::pow<T>, FastMath::pow<T>, ::pow) && passed;
+      return checkSpecialValues<T>() && passed;
+   }
+}
+
+int main()
+{
+   bool passed = checkAll<double>();
+   passed = checkAll<float>() && passed;
+   printf(passed ? "passed\n" : "FAILED\n");
+   return passed ? 0 : 1;
+}
@@ -0,0 +1,240 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#include "RasterMathException.h"
+#include "RasterMathProgress.h"
+#include "TileScheduler.h"
+
+#include <algorithm>
+#include <deque>
+#include <string>
+
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+using namespace std;
+using namespace boost;
+
+namespace
+{
+   // how often the executing thread reports the progress of the workers, in milliseconds
+   const unsigned long PROGRESS_INTERVAL = 100;
+}
+
+struct TileScheduler::Queue
+{
+   Queue() : mCompletedPixels(0) {}
+
+   mutable QMutex mMutex;
+   deque<int> mTiles; // by index in row order
+   int64_t mCompletedPixels;
+};
+
+class TileScheduler::WorkerThread : public QThread
+{
+public:
+   WorkerThread(TileScheduler& scheduler, int index, Worker& worker) :
+      mScheduler(scheduler),
+      mIndex(index),
+      mWorker(worker),
+      mFailed(false)
+   {
+   }
+
+   ~WorkerThread()
+   {
+      wait();
+   }
+
+   bool failed() const
+   {
+      return mFailed;
+   }
+
+   const string& error() const
+   {
+      return mError;
+   }
+
+protected:
+   void run()
+   {
+      try
+      {
+         Tile tile;
+         while (static_cast<int>(mScheduler.mStopped) == 0 && mScheduler.nextTile(mIndex, tile))
+         {
+            mWorker.computeTile(tile);
+            mScheduler.finishTile(mIndex, tile);
+         }
+      }
+      catch (const RasterMathException& e)
+      {
+         fail(e.getMessage());
+      }
+      catch (const std::exception& e)
+      {
+         fail(e.what());
+      }
+   }
+
+private:
+   void fail(const string& error)
+   {
+      mError = error;
+      mFailed = true;
+      mScheduler.mStopped.fetchAndStoreOrdered(1);
+   }
+
+   TileScheduler& mScheduler;
+   int mIndex;
+   Worker& mWorker;
+   bool mFailed;
+   string mError;
+};
+
+TileScheduler::TileScheduler(int rowCount, int columnCount, int tileRows, int tileColumns) :
+   mRowCount(rowCount),
+   mColumnCount(columnCount),
+   mTileRows(max(tileRows, 1)),
+   mTileColumns(max(tileColumns, 1)),
+   mTileCount(0),
+   mStopped(0)
+{
+   if (mRowCount > 0 && mColumnCount > 0)
+   {
+      mTileCount = ((mRowCount+mTileRows-1)/mTileRows) * ((mColumnCount+mTileColumns-1)/mTileColumns);
+   }
+}
+
+TileScheduler::~TileScheduler()
+{
+}
+
+void TileScheduler::execute(const vector<Worker*>& workers, RasterMathProgress& progress, int64_t workPerPixel)
+{
+   RM_VERIFY(!workers.empty());
+   mStopped.fetchAndStoreOrdered(0);
+   mQueues.clear();
+   int workerCount = static_cast<int>(workers.size());
+   for (int i=0; i<workerCount; ++i)
+   {
+      shared_ptr<Queue> pQueue(new Queue);
+      int64_t firstTile = static_cast<int64_t>(mTileCount)*i/workerCount;
+      int64_t endTile = static_cast<int64_t>(mTileCount)*(i+1)/workerCount;
+      for (int64_t index=firstTile; index<endTile; ++index)
+      {
+         pQueue->mTiles.push_back(static_cast<int>(index));
+      }
+      mQueues.push_back(pQueue);
+   }
+
+   vector<shared_ptr<WorkerThread> > threads;
+   for (int i=0; i<workerCount; ++i)
+   {
+      threads.push_back(shared_ptr<WorkerThread>(new WorkerThread(*this, i, *RM_NULLCHK(workers[i]))));
+   }
+   for (vector<shared_ptr<WorkerThread> >::iterator ppThread=threads.begin(); ppThread!=threads.end(); ++ppThread)
+   {
+      (*ppThread)->start();
+   }
+
+   int64_t reportedPixels = 0;
+   bool aborted = false;
+   for (vector<shared_ptr<WorkerThread> >::iterator ppThread=threads.begin(); ppThread!=threads.end(); ++ppThread)
+   {
+      bool finished = false;
+      while (!finished)
+      {
+         finished = (*ppThread)->wait(PROGRESS_INTERVAL);
+         int64_t pixels = completedPixels();
+         aborted = progress.addWorkCompleted((pixels-reportedPixels)*workPerPixel);
+         reportedPixels = pixels;
+         if (aborted)
+         {
+            mStopped.fetchAndStoreOrdered(1);
+         }
+      }
+   }
+
+   for (vector<shared_ptr<WorkerThread> >::iterator ppThread=threads.begin(); ppThread!=threads.end(); ++ppThread)
+   {
+      if ((*ppThread)->failed())
+      {
+         throw RasterMathException((*ppThread)->error());
+      }
+   }
+   if (aborted)
+   {
+      throw RasterMathAbortException("Raster Math aborted");
+   }
+}
+
+TileScheduler::Tile TileScheduler::tile(int index) const
+{
+   int tilesPerRow = (mColumnCount+mTileColumns-1)/mTileColumns;
+   Tile tile;
+   tile.mFirstRow = (index/tilesPerRow)*mTileRows;
+   tile.mRowCount = min(mTileRows, mRowCount-tile.mFirstRow);
+   tile.mFirstColumn = (index%tilesPerRow)*mTileColumns;
+   tile.mColumnCount = min(mTileColumns, mColumnCount-tile.mFirstColumn);
+   return tile;
+}
+
+/**
+ * Takes the next tile from the front of the worker's queue, or failing that, steals one from the
+ * back of the next worker's queue which has any left.
+ *
+ * @return false once every tile has been taken.
+ */
+bool TileScheduler::nextTile(int worker, Tile& tile)
+{
+   int workerCount = static_cast<int>(mQueues.size());
+   for (int i=0; i<workerCount; ++i)
+   {
+      Queue& queue = *mQueues[(worker+i)%workerCount];
+      QMutexLocker lock(&queue.mMutex);
+      if (!queue.mTiles.empty())
+      {
+         int index = 0;
+         if (i == 0)
+         {
+            index = queue.mTiles.front();
+            queue.mTiles.pop_front();
+         }
+         else
+         {
+            index = queue.mTiles.back();
+            queue.mTiles.pop_back();
+         }
+         tile = this->tile(index);
+         return true;
+      }
+   }
+   return false;
+}
+
+void TileScheduler::finishTile(int worker, const Tile& tile)
+{
+   Queue& queue = *mQueues[worker];
+   QMutexLocker lock(&queue.mMutex);
+   queue.mCompletedPixels += static_cast<int64_t>(tile.mRowCount)*tile.mColumnCount;
+}
+
+int64_t TileScheduler::completedPixels() const
+{
+   int64_t pixels = 0;
+   for (vector<shared_ptr<Queue> >::const_iterator ppQueue=mQueues.begin(); ppQueue!=mQueues.end(); ++ppQueue)
+   {
+      QMutexLocker lock(&(*ppQueue)->mMutex);
+      pixels += (*ppQueue)->mCompletedPixels;
+   }
+   return pixels;
+}
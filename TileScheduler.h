@@ -0,0 +1,89 @@
+/*
+ * The information in this file is
+ * Copyright(c) 2009 Todd A. Johnson
+ * and is subject to the terms and conditions of the
+ * GNU Lesser General Public License Version 2.1
+ * The license text is available from   
+ * http://www.gnu.org/licenses/lgpl.html
+ */
+
+#ifndef TILESCHEDULER_H
+#define TILESCHEDULER_H
+
+#include "AppConfig.h"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
+#include <QtCore/QAtomicInt>
+
+class RasterMathProgress;
+
+/**
+ * Hands out the tiles of a raster pass to a set of threads.
+ *
+ * The rows and columns of the pass are cut into tiles, which are dealt out to the workers in
+ * contiguous runs in row order, so each worker starts on a region of its own. A worker takes
+ * the tiles of its own queue from the front, and once its queue is empty, steals from the back
+ * of another worker's queue, so a worker which finishes early takes on the slack of slower ones.
+ *
+ * The thread which executes the scheduler reports the progress of finished tiles, and checks for
+ * an abort, while it waits for the workers. A worker which fails stops the others after their
+ * current tile.
+ */
+class TileScheduler
+{
+public:
+   struct Tile
+   {
+      int mFirstRow;
+      int mRowCount;
+      int mFirstColumn;
+      int mColumnCount;
+   };
+
+   /**
+    * Computes tiles in one of the scheduler's threads. A worker is only called from one
+    * thread, so it can keep the state of its tiles from one to the next.
+    */
+   class Worker
+   {
+   public:
+      virtual ~Worker() {}
+      virtual void computeTile(const Tile& tile) = 0;
+   };
+
+   TileScheduler(int rowCount, int columnCount, int tileRows, int tileColumns);
+   ~TileScheduler();
+
+   /**
+    * Computes every tile with the workers, each in a thread of its own, and returns once they are
+    * done. Progress is advanced by workPerPixel for each pixel of a finished tile.
+    *
+    * @throw RasterMathException with the error of the first worker which failed.
+    * @throw RasterMathAbortException if the user aborted.
+    */
+   void execute(const std::vector<Worker*>& workers, RasterMathProgress& progress, int64_t workPerPixel);
+
+private:
+   struct Queue;
+   class WorkerThread;
+
+   TileScheduler(const TileScheduler& rhs);
+   TileScheduler& operator=(const TileScheduler& rhs);
+
+   Tile tile(int index) const;
+   bool nextTile(int worker, Tile& tile);
+   void finishTile(int worker, const Tile& tile);
+   int64_t completedPixels() const;
+
+   int mRowCount;
+   int mColumnCount;
+   int mTileRows;
+   int mTileColumns;
+   int mTileCount;
+   std::vector<boost::shared_ptr<Queue> > mQueues;
+   QAtomicInt mStopped;
+};
+
+#endif